@@ -28,9 +28,15 @@
 #define	DWARF_FRAME	".debug_frame"
 #define	DWARF_INFO	".debug_info"
 #define	DWARF_LINE	".debug_line"
+#define	DWARF_LINE_STR	".debug_line_str"
 #define	DWARF_LOC	".debug_loc"
+#define	DWARF_LOCLISTS	".debug_loclists"
 #define	DWARF_MACINFO	".debug_macinfo"
+#define	DWARF_MACRO	".debug_macro"
 #define	DWARF_PUBNAMES	".debug_pubnames"
+#define	DWARF_PUBTYPES	".debug_pubtypes"
+#define	DWARF_RANGES	".debug_ranges"
+#define	DWARF_RNGLISTS	".debug_rnglists"
 #define	DWARF_STR	".debug_str"
 
 /* TAG definitions */
@@ -503,4 +509,23 @@
 #define	DW_CFA_offset		0x80
 #define	DW_CFA_restore		0xc0
 
+/* pointer encodings in .eh_frame and .eh_frame_hdr */
+#define	DW_EH_PE_absptr		0x00
+#define	DW_EH_PE_uleb128	0x01
+#define	DW_EH_PE_udata2		0x02
+#define	DW_EH_PE_udata4		0x03
+#define	DW_EH_PE_udata8		0x04
+#define	DW_EH_PE_sleb128	0x09
+#define	DW_EH_PE_sdata2		0x0a
+#define	DW_EH_PE_sdata4		0x0b
+#define	DW_EH_PE_sdata8		0x0c
+#define	DW_EH_PE_signed		0x08
+#define	DW_EH_PE_pcrel		0x10
+#define	DW_EH_PE_textrel	0x20
+#define	DW_EH_PE_datarel	0x30
+#define	DW_EH_PE_funcrel	0x40
+#define	DW_EH_PE_aligned	0x50
+#define	DW_EH_PE_indirect	0x80
+#define	DW_EH_PE_omit		0xff
+
 #endif /* _DWARF_H_ */
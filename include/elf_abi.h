@@ -260,6 +260,24 @@ typedef struct {
 	Elf64_Xword	sh_entsize;	/* table entry size */
 } Elf64_Shdr;
 
+/* Compressed Section Header; precedes the SHF_COMPRESSED contents */
+typedef struct {
+	Elf32_Word	ch_type;	/* compression algorithm */
+	Elf32_Word	ch_size;	/* uncompressed size */
+	Elf32_Word	ch_addralign;	/* uncompressed alignment */
+} Elf32_Chdr;
+
+typedef struct {
+	Elf64_Half	ch_type;	/* compression algorithm */
+	Elf64_Half	ch_reserved;
+	Elf64_Xword	ch_size;	/* uncompressed size */
+	Elf64_Xword	ch_addralign;	/* uncompressed alignment */
+} Elf64_Chdr;
+
+/* ch_type */
+#define ELFCOMPRESS_ZLIB	1	/* zlib stream */
+#define ELFCOMPRESS_ZSTD	2	/* zstd frames */
+
 /* Special Section Indexes */
 #define SHN_UNDEF	0		/* undefined */
 #define SHN_LORESERVE	0xff00		/* lower bounds of reserved indexes */
@@ -333,6 +351,7 @@ typedef struct {
 #define SHF_ALLOC	0x2		/* occupies memory */
 #define SHF_EXECINSTR	0x4		/* executable */
 #define SHF_TLS		0x400		/* thread local storage */
+#define SHF_COMPRESSED	0x800		/* contents are compressed */
 #define SHF_MASKPROC	0xf0000000	/* reserved bits for processor */
 					/*  specific section attributes */
 
@@ -468,6 +487,7 @@ typedef struct {
 #define PT_HIPROC	0x7fffffff	/*  specific segment types */
 
 #define PT_OPENBSD_RANDOMIZE	0x65a3dbe6	/* fill with random data */
+#define PT_GNU_EH_FRAME	0x6474e550	/* .eh_frame_hdr search table */
 
 #define	PT_MIPS_OPTIONS	PT_LOPROC + 2
 
@@ -595,6 +615,8 @@ typedef struct {
  * bump the version.
  */
 
+#define NT_GNU_BUILD_ID		3	/* "GNU" note with the build-id */
+
 #define NT_OPENBSD_PROCINFO	10
 #define NT_OPENBSD_AUXV		11
 
@@ -691,6 +713,7 @@ struct elf_args {
 #define Elf_Ehdr	Elf32_Ehdr
 #define Elf_Phdr	Elf32_Phdr
 #define Elf_Shdr	Elf32_Shdr
+#define Elf_Chdr	Elf32_Chdr
 #define Elf_Sym		Elf32_Sym
 #define Elf_Rel		Elf32_Rel
 #define Elf_RelA	Elf32_Rela
@@ -717,6 +740,7 @@ struct elf_args {
 #define Elf_Ehdr	Elf64_Ehdr
 #define Elf_Phdr	Elf64_Phdr
 #define Elf_Shdr	Elf64_Shdr
+#define Elf_Chdr	Elf64_Chdr
 #define Elf_Sym		Elf64_Sym
 #define Elf_Rel		Elf64_Rel
 #define Elf_RelA	Elf64_Rela
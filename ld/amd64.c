@@ -42,12 +42,14 @@ const struct ldorder amd64_order[] = {
 			LD_CONTAINS | LD_DYNAMIC | LD_USED },
 	{ ldo_section,	ELF_NOTE, SHT_NOTE, SHF_ALLOC,
 			LD_NONMAGIC | LD_NOOMAGIC | LD_USED },
+	{ ldo_section,	ELF_NOTE_BUILDID, SHT_NOTE, SHF_ALLOC,
+			LD_NONMAGIC | LD_NOOMAGIC | LD_USED },
 	{ ldo_section,	ELF_INIT, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
 			LD_USED, XFILL },
 	{ ldo_section,	ELF_PLT, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
 			LD_DYNAMIC, XFILL },
 	{ ldo_section,	ELF_TEXT, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
-			0, XFILL },
+			0, XFILL, ld_textsub },
 	{ ldo_section,	ELF_GCC_LINK1T, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
 			LD_LINK1, XFILL },
 	{ ldo_section,	ELF_FINI, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
@@ -67,7 +69,7 @@ const struct ldorder amd64_order[] = {
 	{ ldo_symbol,	"__data_start", N_ABS },
 	{ ldo_section,	ELF_SDATA, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE },
 	{ ldo_section,	ELF_DATA, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE,
-			0, DFILL },
+			0, DFILL, ld_datasub },
 	{ ldo_section,	ELF_GCC_LINK1D, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE,
 			LD_LINK1 },
 	{ ldo_section,	ELF_CTORS, SHT_PROGBITS, SHF_ALLOC|SHF_WRITE, LD_USED },
@@ -101,18 +103,22 @@ const struct ldorder amd64_order[] = {
 	{ ldo_section,	ELF_STAB_INDEX, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	ELF_STAB_IDXSTR, SHT_PROGBITS, 0, LD_DEBUG },
 /*	{ ldo_section,	ELF_STAB_COMM, SHT_PROGBITS, 0, LD_DEBUG }, */
-#if 0
 	  /* dwarf mark II debugging sections */
 	{ ldo_section,	DWARF_ABBREV, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	DWARF_ARANGES, SHT_PROGBITS, 0, LD_DEBUG },
-	{ ldo_section,	DWARF_FRAMES, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_FRAME, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	DWARF_INFO, SHT_PROGBITS, 0, LD_DEBUG },
-	{ ldo_section,	DWARF_LINES, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_LINE, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_LINE_STR, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	DWARF_LOC, SHT_PROGBITS, 0, LD_DEBUG },
-	{ ldo_section,	DWARF_MACROS, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_LOCLISTS, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_MACINFO, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_MACRO, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	DWARF_PUBNAMES, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_PUBTYPES, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_RANGES, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_RNGLISTS, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	DWARF_STR, SHT_PROGBITS, 0, LD_DEBUG },
-#endif
 	{ ldo_kaput }
 };
 
@@ -150,11 +156,11 @@ amd64_fix(off_t off, struct section *os, char *sbuf, int len)
 		case R_X86_64_64:
 			if (ep - p < 8)
 				return ep - p;
-			if (rp->rl_sym->sl_name)
-				a64 = rp->rl_sym->sl_elfsym.sym64.st_value;
+			if (RL_SYM(os, rp)->sl_name)
+				a64 = RL_SYM(os, rp)->sl_elfsym.sym64.st_value;
 			else
 				a64 = ((Elf64_Shdr *)
-				    rp->rl_sym->sl_sect->os_sect)->sh_addr;
+				    RL_SYM(os, rp)->sl_sect->os_sect)->sh_addr;
 			amd64_fixone(p, a64, rp->rl_addend, rp->rl_type);
 			break;
 
@@ -163,11 +169,11 @@ amd64_fix(off_t off, struct section *os, char *sbuf, int len)
 		case R_X86_64_PC32:
 			if (ep - p < 4)
 				return ep - p;
-			if (rp->rl_sym->sl_name)
-				a32 = rp->rl_sym->sl_elfsym.sym64.st_value;
+			if (RL_SYM(os, rp)->sl_name)
+				a32 = RL_SYM(os, rp)->sl_elfsym.sym64.st_value;
 			else
 				a32 = ((Elf64_Shdr *)
-				    rp->rl_sym->sl_sect->os_sect)->sh_addr;
+				    RL_SYM(os, rp)->sl_sect->os_sect)->sh_addr;
 			if (rp->rl_type == R_X86_64_PC32)
 				a32 -= shdr->sh_addr + rp->rl_addr;
 
@@ -178,11 +184,11 @@ amd64_fix(off_t off, struct section *os, char *sbuf, int len)
 		case R_X86_64_PC16:
 			if (ep - p < 2)
 				return ep - p;
-			if (rp->rl_sym->sl_name)
-				a16 = rp->rl_sym->sl_elfsym.sym64.st_value;
+			if (RL_SYM(os, rp)->sl_name)
+				a16 = RL_SYM(os, rp)->sl_elfsym.sym64.st_value;
 			else
 				a16 = ((Elf64_Shdr *)
-				    rp->rl_sym->sl_sect->os_sect)->sh_addr;
+				    RL_SYM(os, rp)->sl_sect->os_sect)->sh_addr;
 			if (rp->rl_type == R_X86_64_PC16)
 				a16 -= shdr->sh_addr + rp->rl_addr;
 
@@ -268,3 +274,61 @@ amd64_fixone(char *p, uint64_t val, int64_t addend, uint type)
 
 	return 0;
 }
+
+/*
+ * size of the absolute relocation in the debugging sections
+ */
+int
+amd64_dbgrel(u_int type)
+{
+	switch (type) {
+	case R_X86_64_32:
+		return 4;
+	case R_X86_64_64:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * the relocation only makes a jump target (call, jmp or jcc)
+ * rather than taking the address; p is the section contents
+ */
+int
+amd64_branch(u_int type, const u_char *p, uint64_t off)
+{
+	switch (type) {
+	case R_X86_64_PLT32:
+		return 1;
+	case R_X86_64_PC32:
+		if (off >= 1 && (p[off - 1] == 0xe8 || p[off - 1] == 0xe9))
+			return 1;
+		if (off >= 2 && p[off - 2] == 0x0f &&
+		    (p[off - 1] & 0xf0) == 0x80)
+			return 1;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * the relocation only adds the value into the field so a moved
+ * symbol can be patched in place by the difference
+ */
+int
+amd64_additive(u_int type)
+{
+	switch (type) {
+	case R_X86_64_64:
+	case R_X86_64_32S:
+	case R_X86_64_32:
+	case R_X86_64_PC32:
+	case R_X86_64_16:
+	case R_X86_64_PC16:
+		return 1;
+	default:
+		return 0;
+	}
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2014 Michael Shalayeff
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef lint
+static const char rcsid[] =
+    "$ABSD$";
+#endif
+
+/*
+ * the build-id is a tree hash of the output: every chunk of the file
+ * is hashed on its own by the pool workers straight off the mapped
+ * output and the id is the hash of the chunk hashes.  the note itself
+ * is hashed as zeroes and patched in afterwards.
+ */
+
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sha1.h>
+#include <elf_abi.h>
+#include <elfuncs.h>
+#include <a.out.h>
+#include <err.h>
+
+#include "ld.h"
+
+int build_id;	/* 0 - none, LD_BUILDID_FAST or LD_BUILDID_SHA1 */
+
+struct bidhash {
+	const u_char *bh_map;	/* the output */
+	uint64_t bh_size;
+	u_char *bh_leaves;	/* chunk hashes */
+	size_t bh_len;		/* hash length */
+};
+
+uint64_t bid_mix(uint64_t, uint64_t);
+void bid_fast(const u_char *, size_t, uint64_t, u_char *);
+void bid_leaf(void *, int, int);
+
+/*
+ * length of the id in the note
+ */
+size_t
+buildid_len(void)
+{
+	return build_id == LD_BUILDID_SHA1? SHA1_DIGEST_LENGTH : 16;
+}
+
+uint64_t
+bid_mix(uint64_t h, uint64_t v)
+{
+	h = (h ^ v) * 0x9e3779b97f4a7c15ULL;
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	return h ^ (h >> 32);
+}
+
+/*
+ * the fast one: two lanes of the words mixed in;
+ * words are taken little-endian so the id does not depend
+ * on the host the link is done on.
+ */
+void
+bid_fast(const u_char *p, size_t n, uint64_t seed, u_char *out)
+{
+	u_char tail[16];
+	uint64_t a, b, w;
+	size_t i;
+	int k;
+
+	a = seed ^ 0x243f6a8885a308d3ULL;
+	b = seed ^ 0x13198a2e03707344ULL;
+	for (i = 0; i + 16 <= n; i += 16) {
+		memcpy(&w, p + i, sizeof w);
+		a = bid_mix(a, letoh64(w));
+		memcpy(&w, p + i + 8, sizeof w);
+		b = bid_mix(b, letoh64(w));
+	}
+	/* the tail goes in as one more block padded with zeroes */
+	if (i < n) {
+		memset(tail, 0, sizeof tail);
+		memcpy(tail, p + i, n - i);
+		memcpy(&w, tail, sizeof w);
+		a = bid_mix(a, letoh64(w));
+		memcpy(&w, tail + 8, sizeof w);
+		b = bid_mix(b, letoh64(w));
+	}
+	a = bid_mix(a, n);
+	b = bid_mix(b, a);
+	a = bid_mix(a, b);
+
+	for (k = 0; k < 8; k++) {
+		out[k] = a >> (8 * k);
+		out[8 + k] = b >> (8 * k);
+	}
+}
+
+void
+bid_leaf(void *v, int i, int w)
+{
+	struct bidhash *bh = v;
+	const u_char *p = bh->bh_map + (uint64_t)i * LD_BUILDID_CHUNK;
+	size_t n;
+	SHA1_CTX ctx;
+
+	n = MIN(LD_BUILDID_CHUNK, bh->bh_size - (uint64_t)i * LD_BUILDID_CHUNK);
+	if (build_id == LD_BUILDID_SHA1) {
+		SHA1Init(&ctx);
+		SHA1Update(&ctx, p, n);
+		SHA1Final(bh->bh_leaves + i * bh->bh_len, &ctx);
+	} else
+		bid_fast(p, n, i, bh->bh_leaves + i * bh->bh_len);
+}
+
+/*
+ * hash size bytes of the output open on the fd into the id
+ */
+void
+buildid_hash(const char *name, int fd, uint64_t size, u_char *id)
+{
+	struct bidhash bh;
+	SHA1_CTX ctx;
+	u_char sz[8];
+	void *map;
+	size_t n;
+	int k;
+
+	if (!size)
+		errx(1, "%s: empty output", name);
+
+	if ((map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) ==
+	    MAP_FAILED)
+		err(1, "mmap: %s", name);
+
+	n = (size + LD_BUILDID_CHUNK - 1) / LD_BUILDID_CHUNK;
+	if (n > INT_MAX)
+		errx(1, "%s: output too large", name);
+
+	bh.bh_map = map;
+	bh.bh_size = size;
+	bh.bh_len = buildid_len();
+	if (!(bh.bh_leaves = reallocarray(NULL, n, bh.bh_len)))
+		err(1, "reallocarray");
+
+	pool_run(n, bid_leaf, &bh);
+	munmap(map, size);
+
+	/* the root also covers the size */
+	for (k = 0; k < 8; k++)
+		sz[k] = size >> (8 * k);
+	if (build_id == LD_BUILDID_SHA1) {
+		SHA1Init(&ctx);
+		SHA1Update(&ctx, sz, sizeof sz);
+		SHA1Update(&ctx, bh.bh_leaves, n * bh.bh_len);
+		SHA1Final(id, &ctx);
+	} else
+		bid_fast(bh.bh_leaves, n * bh.bh_len, size, id);
+
+	free(bh.bh_leaves);
+}
@@ -44,12 +44,14 @@ const struct ldorder hppa_order[] = {
 			LD_CONTAINS | LD_DYNAMIC | LD_USED },
 	{ ldo_section,	ELF_NOTE, SHT_NOTE, SHF_ALLOC,
 			LD_NONMAGIC | LD_NOOMAGIC | LD_USED },
+	{ ldo_section,	ELF_NOTE_BUILDID, SHT_NOTE, SHF_ALLOC,
+			LD_NONMAGIC | LD_NOOMAGIC | LD_USED },
 	{ ldo_section,	ELF_INIT, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
 			LD_USED, XFILL },
 	{ ldo_section,	ELF_PLT, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
 			LD_DYNAMIC, XFILL },
 	{ ldo_section,	ELF_TEXT, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
-			0, XFILL },
+			0, XFILL, ld_textsub },
 	{ ldo_section,	ELF_GCC_LINK1T, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
 			LD_LINK1, XFILL },
 	{ ldo_section,	ELF_FINI, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
@@ -71,7 +73,7 @@ const struct ldorder hppa_order[] = {
 	{ ldo_symbol,	"__data_start", N_ABS },
 	{ ldo_section,	ELF_SDATA, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE },
 	{ ldo_section,	ELF_DATA, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE,
-			0, DFILL },
+			0, DFILL, ld_datasub },
 	{ ldo_section,	ELF_GCC_LINK1D, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE,
 			LD_LINK1, DFILL },
 	{ ldo_section,	ELF_CTORS, SHT_PROGBITS, SHF_ALLOC|SHF_WRITE, LD_USED },
@@ -106,18 +108,22 @@ const struct ldorder hppa_order[] = {
 	{ ldo_section,	ELF_STAB_INDEX, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	ELF_STAB_IDXSTR, SHT_PROGBITS, 0, LD_DEBUG },
 /*	{ ldo_section,	ELF_STAB_COMM, SHT_PROGBITS, 0, LD_DEBUG }, */
-#if 0
 	  /* dwarf mark II debugging sections */
 	{ ldo_section,	DWARF_ABBREV, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	DWARF_ARANGES, SHT_PROGBITS, 0, LD_DEBUG },
-	{ ldo_section,	DWARF_FRAMES, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_FRAME, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	DWARF_INFO, SHT_PROGBITS, 0, LD_DEBUG },
-	{ ldo_section,	DWARF_LINES, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_LINE, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_LINE_STR, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	DWARF_LOC, SHT_PROGBITS, 0, LD_DEBUG },
-	{ ldo_section,	DWARF_MACROS, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_LOCLISTS, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_MACINFO, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_MACRO, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	DWARF_PUBNAMES, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_PUBTYPES, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_RANGES, SHT_PROGBITS, 0, LD_DEBUG },
+	{ ldo_section,	DWARF_RNGLISTS, SHT_PROGBITS, 0, LD_DEBUG },
 	{ ldo_section,	DWARF_STR, SHT_PROGBITS, 0, LD_DEBUG },
-#endif
 	{ ldo_kaput }
 };
 
@@ -153,11 +159,11 @@ hppa_fix(off_t off, struct section *os, char *sbuf, int len)
 		if (ep - p < 4)
 			return ep - p;
 
-		if (rp->rl_sym->sl_name)
-			a64 = rp->rl_sym->sl_elfsym.sym32.st_value;
+		if (RL_SYM(os, rp)->sl_name)
+			a64 = RL_SYM(os, rp)->sl_elfsym.sym32.st_value;
 		else
 			a64 = ((Elf32_Shdr *)
-			    rp->rl_sym->sl_sect->os_sect)->sh_addr;
+			    RL_SYM(os, rp)->sl_sect->os_sect)->sh_addr;
 
 		switch (rp->rl_type) {
 		case RELOC_NONE:
@@ -400,3 +406,57 @@ hppa_fixone(char *p, uint64_t val, int64_t addend, uint type)
 
 	return 0;
 }
+
+/*
+ * size of the absolute relocation in the debugging sections
+ */
+int
+hppa_dbgrel(u_int type)
+{
+	switch (type) {
+	case RELOC_DIR32:
+		return 4;
+	case RELOC_DIR64:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * the relocation only makes a jump target (the pc-relative
+ * branches) rather than taking the address
+ */
+int
+hppa_branch(u_int type, const u_char *p, uint64_t off)
+{
+	switch (type) {
+	case RELOC_PCREL22C:
+	case RELOC_PCREL22F:
+	case RELOC_PCREL17R:
+	case RELOC_PCREL17F:
+	case RELOC_PCREL17C:
+	case RELOC_PCREL12F:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * the relocation only adds the value into the field so a moved
+ * symbol can be patched in place by the difference
+ */
+int
+hppa_additive(u_int type)
+{
+	switch (type) {
+	case RELOC_DIR32:
+	case RELOC_PCREL32:
+	case RELOC_SECREL32:
+	case RELOC_SEGREL32:
+		return 1;
+	default:
+		return 0;
+	}
+}
@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2014 Michael Shalayeff
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef lint
+static const char rcsid[] =
+    "$ABSD$";
+#endif
+
+/*
+ * incremental linking: the full link leaves the state next to
+ * the output (see elf_incrsave()) and the next link only reloads
+ * the objects that have changed since and patches them into the
+ * output in place (see elf_incrlink()).  whenever that is not
+ * possible the link is done in full as usual.
+ */
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <elf_abi.h>
+#include <elfuncs.h>
+#include <a.out.h>
+#include <err.h>
+
+#include "ld.h"
+
+int incremental;	/* keep the state for the incremental relinks */
+uint64_t incr_args;	/* command line hash */
+
+int incr_read(const char *, struct incr *);
+int incr_fread(FILE *, void *, size_t, size_t);
+
+/*
+ * hash the command line; any change forces the full link
+ */
+uint64_t
+incr_hash(int argc, char **argv)
+{
+	uint64_t h;
+	const u_char *p;
+	int i;
+
+	for (h = 14695981039346656037ULL, i = 0; i < argc; i++)
+		for (p = (u_char *)argv[i]; ; p++) {
+			h = (h ^ *p) * 1099511628211ULL;
+			if (!*p)
+				break;
+		}
+
+	return h;
+}
+
+/*
+ * object fingerprint
+ */
+int
+incr_stat(const char *path, int64_t *size, int64_t *mtime, int64_t *ino)
+{
+	struct stat sb;
+
+	if (stat(path, &sb))
+		return -1;
+
+	*size = sb.st_size;
+	*mtime = sb.st_mtime;
+	*ino = sb.st_ino;
+	return 0;
+}
+
+/*
+ * tell if the names are the same but for the ".N" suffix
+ * the static symbols get when their name is taken already
+ */
+int
+incr_samename(const char *a, const char *b)
+{
+	size_t la, lb;
+
+	la = strlen(a);
+	lb = strlen(b);
+	if (la > lb)
+		return incr_samename(b, a);
+
+	if (strncmp(a, b, la))
+		return 0;
+	if (la == lb)
+		return 1;
+
+	if (b[la] != '.' || !b[la + 1])
+		return 0;
+	for (b += la + 1; *b; b++)
+		if (!isdigit((u_char)*b))
+			return 0;
+	return 1;
+}
+
+int
+incr_fread(FILE *fp, void *vp, size_t n, size_t sz)
+{
+	void **pp = vp;
+
+	if (!n) {
+		*pp = NULL;
+		return 0;
+	}
+
+	if (!(*pp = reallocarray(NULL, n, sz)))
+		err(1, "reallocarray");
+
+	return fread(*pp, sz, n, fp) != n;
+}
+
+/*
+ * read the state in; any mismatch means there is none
+ */
+int
+incr_read(const char *path, struct incr *in)
+{
+	struct incrhdr *ih = &in->in_hdr;
+	FILE *fp;
+	int rv;
+
+	memset(in, 0, sizeof *in);
+	if (!(fp = fopen(path, "r")))
+		return -1;
+
+	if (fread(ih, sizeof *ih, 1, fp) != 1 ||
+	    memcmp(ih->ih_magic, LD_INCR_MAGIC, sizeof ih->ih_magic)) {
+		fclose(fp);
+		return -1;
+	}
+
+	rv = incr_fread(fp, &in->in_objs, ih->ih_nobjs, sizeof *in->in_objs) ||
+	    incr_fread(fp, &in->in_ords, ih->ih_nords, sizeof *in->in_ords) ||
+	    incr_fread(fp, &in->in_slots, ih->ih_nslots,
+	    sizeof *in->in_slots) ||
+	    incr_fread(fp, &in->in_syms, ih->ih_nsyms, sizeof *in->in_syms) ||
+	    incr_fread(fp, &in->in_ents, ih->ih_nents, sizeof *in->in_ents) ||
+	    incr_fread(fp, &in->in_rels, ih->ih_nrels, sizeof *in->in_rels) ||
+	    incr_fread(fp, &in->in_strs, ih->ih_strsz, 1);
+	fclose(fp);
+
+	if (rv || !ih->ih_strsz || in->in_strs[ih->ih_strsz - 1] != '\0') {
+		incr_free(in);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * write the state out replacing the old one atomically
+ */
+int
+incr_write(const char *output, struct incr *in)
+{
+	struct incrhdr *ih = &in->in_hdr;
+	char path[MAXPATHLEN], tmp[MAXPATHLEN];
+	int64_t ino;
+	FILE *fp;
+
+	if (snprintf(path, sizeof path, "%s%s", output, LD_INCR_SUFFIX) >=
+	    sizeof path ||
+	    snprintf(tmp, sizeof tmp, "%s.tmp", path) >= sizeof tmp) {
+		warnx("%s: name too long", output);
+		return -1;
+	}
+
+	memcpy(ih->ih_magic, LD_INCR_MAGIC, sizeof ih->ih_magic);
+	ih->ih_args = incr_args;
+	if (incr_stat(output, &ih->ih_osize, &ih->ih_omtime, &ino))
+		err(1, "stat: %s", output);
+
+	if (!(fp = fopen(tmp, "w")))
+		err(1, "fopen: %s", tmp);
+
+	if (fwrite(ih, sizeof *ih, 1, fp) != 1 ||
+	    fwrite(in->in_objs, sizeof *in->in_objs, ih->ih_nobjs, fp) !=
+	    ih->ih_nobjs ||
+	    fwrite(in->in_ords, sizeof *in->in_ords, ih->ih_nords, fp) !=
+	    ih->ih_nords ||
+	    fwrite(in->in_slots, sizeof *in->in_slots, ih->ih_nslots, fp) !=
+	    ih->ih_nslots ||
+	    fwrite(in->in_syms, sizeof *in->in_syms, ih->ih_nsyms, fp) !=
+	    ih->ih_nsyms ||
+	    fwrite(in->in_ents, sizeof *in->in_ents, ih->ih_nents, fp) !=
+	    ih->ih_nents ||
+	    fwrite(in->in_rels, sizeof *in->in_rels, ih->ih_nrels, fp) !=
+	    ih->ih_nrels ||
+	    fwrite(in->in_strs, 1, ih->ih_strsz, fp) != ih->ih_strsz)
+		err(1, "fwrite: %s", tmp);
+
+	if (fclose(fp) == EOF)
+		err(1, "fclose: %s", tmp);
+
+	if (rename(tmp, path))
+		err(1, "rename: %s", path);
+
+	return 0;
+}
+
+void
+incr_free(struct incr *in)
+{
+	free(in->in_objs);
+	free(in->in_ords);
+	free(in->in_slots);
+	free(in->in_syms);
+	free(in->in_ents);
+	free(in->in_rels);
+	free(in->in_strs);
+	free(in->in_changed);
+	memset(in, 0, sizeof *in);
+}
+
+/*
+ * try to relink the output incrementally;
+ * returns zero if the output is up to date and non-zero
+ * if the link has to be done in full.
+ * the patching is done in a child so a failure at any point
+ * leaves this process clean for the full link.
+ */
+int
+incr_relink(const char *output)
+{
+	struct incr in;
+	struct incrhdr *ih = &in.in_hdr;
+	struct incrobj *io;
+	char path[MAXPATHLEN];
+	int64_t size, mtime, ino;
+	pid_t pid;
+	int i, n, status;
+
+	if (snprintf(path, sizeof path, "%s%s", output, LD_INCR_SUFFIX) >=
+	    sizeof path)
+		return 1;
+
+	if (incr_read(path, &in))
+		return 1;
+
+	/* a different link or the output has been messed with */
+	if (ih->ih_args != incr_args ||
+	    incr_stat(output, &size, &mtime, &ino) ||
+	    size != ih->ih_osize || mtime != ih->ih_omtime) {
+		incr_free(&in);
+		return 1;
+	}
+
+	if (!(in.in_changed = calloc(ih->ih_nobjs, 1)))
+		err(1, "calloc");
+
+	for (n = i = 0, io = in.in_objs; i < ih->ih_nobjs; io++, i++) {
+		if (io->io_path >= ih->ih_strsz || io->io_name >= ih->ih_strsz)
+			break;
+		if (!incr_stat(in.in_strs + io->io_path, &size, &mtime, &ino) &&
+		    size == io->io_size && mtime == io->io_mtime &&
+		    ino == io->io_ino)
+			continue;
+
+		/* archives are only ever pulled in full */
+		if (io->io_path != io->io_name)
+			break;
+		in.in_changed[i] = 1;
+		n++;
+	}
+
+	if (i < ih->ih_nobjs) {
+		incr_free(&in);
+		return 1;
+	}
+
+	/* nothing to do */
+	if (!n) {
+		incr_free(&in);
+		return 0;
+	}
+
+	fflush(NULL);
+	switch (pid = fork()) {
+	case -1:
+		err(1, "fork");
+
+	case 0:
+		if (ih->ih_class == ELFCLASS32)
+			exit(elf32_incrlink(output, &in)? 2 : 0);
+		else
+			exit(elf64_incrlink(output, &in)? 2 : 0);
+	}
+
+	incr_free(&in);
+	if (waitpid(pid, &status, 0) < 0)
+		err(1, "waitpid");
+
+	return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
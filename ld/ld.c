@@ -22,6 +22,9 @@ static const char rcsid[] =
 
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <dirent.h>
 #include <limits.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -30,6 +33,7 @@ static const char rcsid[] =
 #include <ctype.h>
 #include <unistd.h>
 #include <elf_abi.h>
+#include <dwarf.h>
 #include <elfuncs.h>
 #include <a.out.h>
 #include <ar.h>
@@ -54,14 +58,19 @@ int elfclass;	/* ELFCLASSNONE */
 int machine;	/* EM_NONE */
 int magic = ZMAGIC;
 int as_needed;
+int ingroup;	/* libraries are searched as a group */
 int dflag;	/* force common allocation (even for -r) */
 int Bflag;	/* 0 - static, 1 - dynamic, 2 - shlib */
 int Xflag;	/* 0 - keep, 1 - sieve temps, 2 - sieve all locals */
 int check_sections;
 int gc_sections;
+int print_gc_sections;
+int icf;	/* 0 - none, LD_ICF_SAFE or LD_ICF_ALL */
+int print_icf_sections;
 int export_dynamic;
 int cref;
 int nostdlib;
+int batch;	/* uLD the pairs of files */
 int pie;
 int warncomm;
 int randomise = 1;/* combine objects in random order (vs command line) */
@@ -71,21 +80,38 @@ int strip;
 int errors;	/* non-fatal errors accumulated */
 int printmap;	/* print edit map to stdout */
 int eh_frame_hdr;
+int lowmem;	/* read the relocations again when needed */
 u_int64_t start_text, start_data, start_bss;
 char *mapfile;
+char *symordfile;	/* sections order by the symbols listed */
+int sort_section;	/* 0 - none or LD_SORT_* */
+uint64_t sort_before, sort_after;	/* padding in the sorted orders */
 const char *entry_name;
 struct symlist *sentry;
 #define	NTRACE	10
 const char *trace_names[NTRACE + 1];	/* plus NULL terminator */
 int trace_num = NTRACE;
 
-#define OPTSTRING "+A:B:c:C:d:D:e:Ef:F:gh:il:L:m:M:nNo:OqrR:sStT:u:vVxXy:Y:z:Z"
+#define OPTSTRING "-()A:B:c:C:d:D:e:Ef:F:gh:il:L:m:M:nNo:OqrR:sStT:u:vVxXy:Y:z:Z"
+/* long-only options */
+#define	LDOPT_THREADS	0x100
+#define	LDOPT_SYMORDER	0x101
+#define	LDOPT_ICF	0x102
+#define	LDOPT_TRACE	0x103
+#define	LDOPT_SGROUP	0x104
+#define	LDOPT_EGROUP	0x105
+#define	LDOPT_SORTSECT	0x106
+#define	LDOPT_BUILDID	0x107
+#define	LDOPT_ZDEBUG	0x108
 const struct option longopts[] = {
 	{ "architecture",	required_argument,	0, 'A' },
 	{ "as-needed",		no_argument,	&as_needed, 1 },
 	{ "no-as-needed",	no_argument,	&as_needed, 0 },
+	{ "batch",		no_argument,	&batch, 1 },
+	{ "build-id",		optional_argument,	0, LDOPT_BUILDID },
 	{ "check-sections",	no_argument,	&check_sections, 1 },
 	{ "no-check-sections",	no_argument,	&check_sections, 0 },
+	{ "compress-debug-sections", required_argument,	0, LDOPT_ZDEBUG },
 	{ "cref",		no_argument,	&cref, 1 },
 	{ "defsym",		required_argument,	0, 'D' },
 	{ "nostdlib",		no_argument,	&nostdlib, 1 },
@@ -103,6 +129,7 @@ const struct option longopts[] = {
 	{ "dynamic-linker",	required_argument,	NULL, 'd' },
 	{ "entry",		required_argument,	0, 'e' },
 	{ "export-dynamic",	no_argument,		0, 'E' },
+	{ "end-group",		no_argument,		0, LDOPT_EGROUP },
 	{ "eh-frame-hdr",	no_argument,	&eh_frame_hdr, 1 },
 	{ "EB",			no_argument,	&endian, ELFDATA2MSB },
 	{ "EL",			no_argument,	&endian, ELFDATA2LSB },
@@ -111,21 +138,35 @@ const struct option longopts[] = {
 	{ "fini",		required_argument,	0, 'c' },
 	{ "gc-sections",	no_argument,	&gc_sections, 1 },
 	{ "no-gc-sections",	no_argument,	&gc_sections, 0 },
+	{ "print-gc-sections",	no_argument,	&print_gc_sections, 1 },
+	{ "no-print-gc-sections", no_argument,	&print_gc_sections, 0 },
+	{ "icf",		required_argument,	0, LDOPT_ICF },
+	{ "print-icf-sections",	no_argument,	&print_icf_sections, 1 },
+	{ "no-print-icf-sections", no_argument,	&print_icf_sections, 0 },
+	{ "incremental",	no_argument,	&incremental, 1 },
 	{ "soname",		required_argument,	0, 'h' },
 	{ "init",		required_argument,	0, 'C' },
 	{ "library",		required_argument,	0, 'l' },
 	{ "library-path",	required_argument,	0, 'L' },
+	{ "reduce-memory-overheads", no_argument, &lowmem, 1 },
 	{ "print-map",		no_argument,		0, 'M' },
 	{ "Map",		required_argument,	0, 'M' },
 	{ "no-random",		no_argument,	&randomise, 0 },
 	{ "nmagic",		no_argument,	&magic, NMAGIC },
 	{ "omagic",		no_argument,	&magic, OMAGIC },
 	{ "output",		required_argument,	0, 'o' },
+	{ "threads",		required_argument,	0, LDOPT_THREADS },
+	{ "no-threads",		no_argument,	&nthreads, 1 },
 	{ "emit-relocs",	no_argument,		0, 'q' },
 	{ "relocatable",	no_argument,		0, 'r' },
 	{ "just-symbols",	required_argument,	0, 'R' },
 	{ "strip-all",		no_argument,		0, 's' },
+	{ "symbol-ordering-file", required_argument,	0, LDOPT_SYMORDER },
+	{ "sort-section",	required_argument,	0, LDOPT_SORTSECT },
 	{ "strip-debug",	no_argument,		0, 'S' },
+	{ "start-group",	no_argument,		0, LDOPT_SGROUP },
+	{ "stats",		no_argument,	&stats, 1 },
+	{ "time-trace",		required_argument,	0, LDOPT_TRACE },
 	{ "trace",		no_argument,		0, 't' },
 	{ "script",		required_argument,	0, 'T' },
 	{ "undefined",		required_argument,	0, 'u' },
@@ -139,33 +180,69 @@ const struct option longopts[] = {
 const struct ldarch ldarchs[] = {
 /*	{ EM_VAX,	ELFCLASS32, vax_order, vax_fix }, */
 /*	{ EM_ALPHA,	ELFCLASS64, alpha_order, alpha_fix }, */
-	{ EM_386,	ELFCLASS32, i386_order, i386_fix },
-	{ EM_AMD64,	ELFCLASS64, amd64_order, amd64_fix },
+	{ EM_386,	ELFCLASS32, i386_order, i386_fix, i386_fixone,
+	    i386_dbgrel, i386_branch, i386_additive },
+	{ EM_AMD64,	ELFCLASS64, amd64_order, amd64_fix, amd64_fixone,
+	    amd64_dbgrel, amd64_branch, amd64_additive },
 /*	{ EM_MIPS,	ELFCLASS32, mips_order, mips_fix }, */
 /*	{ EM_MIPS64,	ELFCLASS64, mips64_order, mips64_fix }, */
-	{ EM_PARISC,	ELFCLASS32, hppa_order, hppa_fix },
-	{ EM_PARISC,	ELFCLASS64, hppa_order, hppa_fix },
+	{ EM_PARISC,	ELFCLASS32, hppa_order, hppa_fix, hppa_fixone,
+	    hppa_dbgrel, hppa_branch, hppa_additive },
+	{ EM_PARISC,	ELFCLASS64, hppa_order, hppa_fix, hppa_fixone,
+	    hppa_dbgrel, hppa_branch, hppa_additive },
 /*	{ EM_PPC,	ELFCLASS32, ppc_order, ppc_fix }, */
 /*	{ EM_PPC64,	ELFCLASS64, ppc64_order, ppc64_fix }, */
 /*	{ EM_SPARC,	ELFCLASS32, sparc_order, sparc_fix }, */
-	{ EM_SPARCV9,	ELFCLASS64, sparc64_order, sparc64_fix },
+	{ EM_SPARCV9,	ELFCLASS64, sparc64_order, sparc64_fix, sparc64_fixone,
+	    sparc64_dbgrel, sparc64_branch, sparc64_additive },
 /*	{ EM_SH,	ELFCLASS32, sh_order, sh_fix }, */
-	{ EM_ARM,	ELFCLASS32, arm_order, arm_fix },
+	{ EM_ARM,	ELFCLASS32, arm_order, arm_fix, arm_fixone,
+	    arm_dbgrel, arm_branch, arm_additive },
 /*	{ EM_68K,	ELFCLASS32, m68k_order, m68k_fix }, */
 };
 const int ldnarch = sizeof(ldarchs)/sizeof(ldarchs[0]);
 const struct ldarch *ldarch;
 
+/*
+ * per-batch state for loading objects in parallel;
+ * each worker keeps its own file open as members of
+ * the same archive usually come together.
+ */
+struct objload {
+	struct objlist **ld_objs;
+	FILE *ld_fps[LD_MAXTHREADS];
+	const char *ld_paths[LD_MAXTHREADS];
+};
+
 int usage(void);
 int libdir_add(const char *);
-int obj_add(const char *, const char *, FILE *, off_t, struct objlist *);
+void obj_free(struct objlist *);
+FILE *obj_file(struct objload *, struct objlist *, int);
+void obj_loadhead(void *, int, int);
+void obj_loadone(void *, int, int);
+void obj_queue(const char *);
+void obj_flush(void);
+int libdir_read(struct pathlist *);
+int libdir_cmp(const void *, const void *);
+char *lib_find(const char *);
+uint32_t lib_hash(const char *);
+int lib_offcmp(const void *, const void *);
+int lib_idxcmp(const void *, const void *);
+struct archive *lib_open(const char *, FILE *);
+int lib_index(struct archive *, FILE *, off_t, u_long);
 int lib_add(const char *, FILE *fp);
-int lib_namtab(const char *, FILE *, u_long, off_t, u_long);
+int lib_group(void);
+int lib_lookup(struct symlist *, void *);
+int lib_scan(struct archive *);
 int lib_symdef(const char *, FILE *, u_long);
 int mmbr_name(struct ar_hdr *, char **, int, int *, FILE *);
 struct headorder *ldorder(const struct ldarch *);
 int order_check(struct objlist *, void *);
+void order_symbols(struct headorder *, const char *);
+void order_relocs(struct headorder *, const struct ldarch *);
 int uLD(const char *, const char *);
+void uld_one(void *, int, int);
+int uld_batch(char **, int);
 
 int
 usage(void)
@@ -179,13 +256,24 @@ int
 main(int argc, char *argv[])
 {
 	char output[MAXPATHLEN];
+	struct headorder *headorder;
+	struct ldorder *order;
 	u_int64_t *pst;
 	FILE *fp;
-	int ch, li;
+	char **inputs, *p;
+	int ch, li, rv, ninputs;
 
+	stat_init();
+	stat_begin("options");
+	incr_args = incr_hash(argc, argv);
 	strlcpy(output, "a.out", sizeof output);
 	libdir_add(_PATH_USRLIB);
 
+	/* files, libraries and groups are loaded in the order given */
+	if (!(inputs = calloc(argc, sizeof *inputs)))
+		err(1, "calloc");
+	ninputs = 0;
+
 	errors = 0;
 	while ((ch = getopt_long(argc, argv, OPTSTRING, longopts, &li)) != -1)
 		switch (ch) {
@@ -193,6 +281,10 @@ main(int argc, char *argv[])
 			/* check out 'li' to see what matched */
 			break;
 
+		case 1:		/* an input file */
+			inputs[ninputs++] = optarg;
+			break;
+
 		case 'A':	/* set machine arch */
 			break;
 
@@ -261,8 +353,19 @@ main(int argc, char *argv[])
 			libdir_add(optarg);
 			break;
 
-		case 'l':
-			/* end of options proceede with loading */
+		case 'l':	/* queue the library by its full option */
+			if (asprintf(&inputs[ninputs++], "-l%s", optarg) < 0)
+				err(1, "asprintf");
+			break;
+
+		case '(':
+		case LDOPT_SGROUP:
+			inputs[ninputs++] = "-(";
+			break;
+
+		case ')':
+		case LDOPT_EGROUP:
+			inputs[ninputs++] = "-)";
 			break;
 
 		case 'M':	/* print linking map to stdout/mapfile */
@@ -359,6 +462,74 @@ main(int argc, char *argv[])
 		case 'z':	/* special options */
 			break;
 
+		case LDOPT_THREADS: {
+			char *ep;
+			long l;
+
+			errno = 0;
+			l = strtol(optarg, &ep, 0);
+			if (optarg[0] == '\0' || *ep != '\0' ||
+			    l < 1 || l > LD_MAXTHREADS)
+				errx(1, "%s: invalid number of threads", optarg);
+			nthreads = l;
+			break;
+		}
+
+		case LDOPT_SYMORDER:
+			symordfile = optarg;
+			break;
+
+		case LDOPT_TRACE:
+			tracefile = optarg;
+			break;
+
+		case LDOPT_SORTSECT:
+			if (!strcmp(optarg, "none"))
+				sort_section = 0;
+			else if (!strcmp(optarg, "alignment"))
+				sort_section = LD_SORT_ALIGN;
+			else if (!strcmp(optarg, "name"))
+				sort_section = LD_SORT_NAME;
+			else if (!strcmp(optarg, "alignment,name"))
+				sort_section = LD_SORT_ALIGNNAME;
+			else if (!strcmp(optarg, "name,alignment"))
+				sort_section = LD_SORT_NAMEALIGN;
+			else
+				errx(1, "%s: invalid section sort", optarg);
+			break;
+
+		case LDOPT_BUILDID:
+			if (!optarg || !strcmp(optarg, "fast"))
+				build_id = LD_BUILDID_FAST;
+			else if (!strcmp(optarg, "sha1"))
+				build_id = LD_BUILDID_SHA1;
+			else if (!strcmp(optarg, "none"))
+				build_id = 0;
+			else
+				errx(1, "%s: invalid build-id style", optarg);
+			break;
+
+		case LDOPT_ZDEBUG:
+			if (!strcmp(optarg, "none"))
+				compress_debug = 0;
+			else if (!strcmp(optarg, "zlib") ||
+			    !strcmp(optarg, "zlib-gabi"))
+				compress_debug = LD_ZDEBUG_ZLIB;
+			else
+				errx(1, "%s: invalid debug compression", optarg);
+			break;
+
+		case LDOPT_ICF:
+			if (!strcmp(optarg, "none"))
+				icf = 0;
+			else if (!strcmp(optarg, "safe"))
+				icf = LD_ICF_SAFE;
+			else if (!strcmp(optarg, "all"))
+				icf = LD_ICF_ALL;
+			else
+				errx(1, "%s: invalid icf mode", optarg);
+			break;
+
 		case 'Z':	/* make ZMAGIC output */
 			magic = ZMAGIC;
 			break;
@@ -367,72 +538,145 @@ main(int argc, char *argv[])
 			usage();
 			break;
 		}
-	argc -= optind;
-	argv += optind;
+	/* anything past the "--" is the files */
+	for (; optind < argc; optind++)
+		inputs[ninputs++] = argv[optind];
+	stat_end();
 
-	if (argc < 1)
+	if (ninputs < 1)
 		errx(1, "no input files");
 
-	/* short cut for libraries building */
-	if (relocatable && argc == 1)
-		return uLD(*argv, output);
+	/* short cuts for libraries building */
+	if (batch) {
+		if (!relocatable)
+			errx(1, "--batch requires -r");
+		if (ninputs % 2)
+			errx(1, "--batch requires pairs of files");
+		return uld_batch(inputs, ninputs / 2);
+	}
+	if (relocatable && ninputs == 1 && *inputs[0] != '-') {
+		stat_begin("uLD");
+		rv = uLD(inputs[0], output);
+		stat_end();
+		stat_report();
+		return rv;
+	}
 
 	/* make a "system" object for our self-defined sections & syms */
 	sysobj.ol_path = output;
 	sysobj.ol_nsect = 1;	/* .bss */
 	TAILQ_INSERT_TAIL(&objlist, &sysobj, ol_entry);
 
-	for (; argc--; argv++) {
-		char armag[SARMAG];
-
-		if (**argv == '-')
-			switch (argv[0][1]) {
-			case 'L':
-				libdir_add(*argv + 2);
-				continue;
+	/* these rearrange the output too much to be patched in place */
+	if (relocatable || icf || gc_sections || eh_frame_hdr || printmap ||
+	    build_id)
+		incremental = 0;
+
+	/* these compare or record the relocations of all the sections */
+	if (icf || incremental)
+		lowmem = 0;
+
+	if (incremental) {
+		stat_begin("incr_relink");
+		rv = incr_relink(output);
+		stat_end();
+		if (!rv) {
+			stat_report();
+			return 0;
+		}
+	}
 
-			case 'l':	/* load the archive */
-				lib_add(*argv, NULL);
-				continue;
+	for (; ninputs--; inputs++) {
+		char armag[SARMAG];
 
-			case 'g':	/* compatibility */
-				continue;
+		if (!strcmp(*inputs, "-(")) {
+			if (ingroup)
+				errx(1, "groups may not be nested");
+			obj_flush();
+			ingroup = 1;
+			continue;
+		}
 
-			case 'R':	/* only symbols from this file(s) */
-				break;
+		if (!strcmp(*inputs, "-)")) {
+			if (!ingroup)
+				errx(1, "group ended before it began");
+			obj_flush();
+			lib_group();
+			continue;
+		}
 
-			default:
-				usage();
-				break;
-			}
+		if (!strncmp(*inputs, "-l", 2)) {	/* load the archive */
+			p = lib_find(*inputs + 2);
+			obj_flush();
+			stat_begin("lib_add");
+			lib_add(p, NULL);
+			stat_end();
+			continue;
+		}
 
-		if (!(fp = fopen(*argv, "r")))
-			err(1, "fopen: %s", *argv);
+		if (!(fp = fopen(*inputs, "r")))
+			err(1, "fopen: %s", *inputs);
 
 		if (fread(armag, sizeof armag, 1, fp) != 1) {
 			if (feof(fp))
-				errx(1, "%s: file is too short", *argv);
-			err(1, "fread: %s", *argv);
+				errx(1, "%s: file is too short", *inputs);
+			err(1, "fread: %s", *inputs);
 		}
 
 		fseek(fp, 0, SEEK_SET);
-		if (!strncmp(armag, ARMAG, SARMAG))
-			lib_add(*argv, fp);
-		else {
-			if (obj_add(*argv, NULL, fp, 0, NULL))
-				return 1;
+		if (!strncmp(armag, ARMAG, SARMAG)) {
+			obj_flush();
+			stat_begin("lib_add");
+			lib_add(*inputs, fp);
+			stat_end();
+		} else {
+			/* objects are loaded in batches until next library */
 			fclose(fp);
+			obj_queue(*inputs);
 		}
 	}
+	obj_flush();
 
-	if (errors)
+	if (ingroup) {
+		warnx("missing --end-group; added as the last option");
+		lib_group();
+	}
+
+	if (errors) {
+		stat_report();
 		return 1;
+	}
 
 	/* and now do the jobs */
+	stat_begin("ldorder");
+	headorder = ldorder(ldarch);
+	stat_end();
+
+	stat_begin("ldmap");
+	if (elfclass == ELFCLASS32)
+		order = ldmap32(headorder);
+	else
+		order = ldmap64(headorder);
+	stat_end();
+
+	stat_begin("ldload");
 	if (elfclass == ELFCLASS32)
-		return ldload32(output, ldmap32(ldorder(ldarch)));
+		rv = ldload32(output, order);
 	else
-		return ldload64(output, ldmap64(ldorder(ldarch)));
+		rv = ldload64(output, order);
+	stat_end();
+
+	if (!rv && incremental) {
+		stat_begin("incr_save");
+		if (elfclass == ELFCLASS32)
+			rv = elf32_incrsave(output, order);
+		else
+			rv = elf64_incrsave(output, order);
+		stat_end();
+	}
+
+	stat_report();
+	return rv;
 }
 
 /*
@@ -462,6 +706,9 @@ ldinit(void)
 		switch (order->ldo_order) {
 		/* these we do not care until later */
 		case ldo_section:
+			/* and its relocations for the relocatable output */
+			if (relocatable)
+				sysobj.ol_nsect++;
 		case ldo_interp:
 		case ldo_ehfrh:
 		case ldo_shstr:
@@ -469,6 +716,7 @@ ldinit(void)
 		case ldo_strtab:
 			sysobj.ol_nsect++;
 		case ldo_expr:
+		case ldo_reloc:
 		case ldo_kaput:
 			break;
 
@@ -477,6 +725,8 @@ ldinit(void)
 			break;
 
 		case ldo_symbol:
+			if (relocatable)
+				break;
 			if (order->ldo_flags & LD_ENTRY) {
 				if (!entry_name)
 					entry_name = order->ldo_name;
@@ -499,7 +749,7 @@ ldinit(void)
 	/* os_sect is set in ldmap() */
 	for (i = 0; i < sysobj.ol_nsect; i++) {
 		sysobj.ol_sections[i].os_obj = &sysobj;
-		TAILQ_INIT(&sysobj.ol_sections[i].os_syms);
+		SYMQ_INIT(&sysobj.ol_sections[i].os_syms);
 	}
 
 	return lda;
@@ -539,51 +789,260 @@ char *nametab;
 long namtablen;
 
 /*
- * search the library for objects resolving
- * currently undefined symbols;
- * if a library index (see ranlib(1)) is available
- * use that to pull needed objects and keep cycling
- * until no new symbols had been resolved;
- * otherwise scan whole library (once) checking
- * each member for symbols to resolve.
+ * an archive is only ever read and indexed once;
+ * the armap is hashed by the symbol name so that every
+ * search that follows (repeated libraries, groups) only
+ * looks up the currently undefined symbols in it.
+ */
+struct archive {
+	TAILQ_ENTRY(archive) ar_entry;
+	TAILQ_ENTRY(archive) ar_gentry;	/* in the current group */
+	char *ar_path;
+	char *ar_nametab;		/* long names */
+	long ar_namtablen;
+	char *ar_symdef;		/* the armap as read */
+	char **ar_names;		/* per index entry */
+	uint32_t *ar_offs;		/* ditto; member header offset */
+	uint32_t *ar_mmbr;		/* ditto; member number */
+	uint32_t *ar_next;		/* ditto; next in the hash chain */
+	uint32_t *ar_hash;		/* chain heads (entry + 1) */
+	char *ar_loaded;		/* per member; merged in already */
+	int *ar_slot;			/* per member; in the batch (+1) */
+	uint32_t ar_num;		/* index entries */
+	uint32_t ar_nmmbr;		/* members in the index */
+	uint32_t ar_hmask;
+	u_long ar_gen;			/* sym_undgen at the last scan */
+	int ar_ingroup;
+};
+
+TAILQ_HEAD(, archive) archives = TAILQ_HEAD_INITIALIZER(archives);
+TAILQ_HEAD(, archive) group = TAILQ_HEAD_INITIALIZER(group);
+
+/*
+ * the libraries seen in a path directory
  */
 int
-lib_add(const char *path, FILE *fp)
+libdir_read(struct pathlist *pl)
+{
+	struct dirent *dp;
+	DIR *dirp;
+	size_t len;
+	int n;
+
+	pl->pl_read = 1;
+	if (!(dirp = opendir(pl->pl_path)))
+		return -1;
+
+	n = 0;
+	while ((dp = readdir(dirp))) {
+		len = strlen(dp->d_name);
+		if (len <= 5 || strncmp(dp->d_name, "lib", 3) ||
+		    strcmp(dp->d_name + len - 2, ".a"))
+			continue;
+
+		if (pl->pl_nlibs == n) {
+			n = n? n * 2 : 32;
+			if (!(pl->pl_libs = reallocarray(pl->pl_libs, n,
+			    sizeof *pl->pl_libs)))
+				err(1, "reallocarray");
+		}
+		if (!(pl->pl_libs[pl->pl_nlibs++] = strdup(dp->d_name)))
+			err(1, "strdup");
+	}
+	closedir(dirp);
+
+	qsort(pl->pl_libs, pl->pl_nlibs, sizeof *pl->pl_libs, libdir_cmp);
+	return 0;
+}
+
+int
+libdir_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * find the library in the path;
+ * every directory is only read the first time it is searched
+ */
+char *
+lib_find(const char *name)
+{
+	char lib[MAXPATHLEN], *key, *p;
+	struct pathlist *pl;
+
+	if (snprintf(lib, sizeof lib, "lib%s.a", name) >= sizeof lib)
+		errx(1, "-l%s: name too long", name);
+
+	key = lib;
+	TAILQ_FOREACH(pl, &libdirs, pl_entry) {
+		if (!pl->pl_read)
+			libdir_read(pl);
+
+		if (!bsearch(&key, pl->pl_libs, pl->pl_nlibs,
+		    sizeof *pl->pl_libs, libdir_cmp))
+			continue;
+
+		if (asprintf(&p, "%s%s", pl->pl_path, lib) < 0)
+			err(1, "asprintf");
+		if (trace)
+			printf("-l%s (%s)\n", name, p);
+		return p;
+	}
+
+	errx(1, "-l%s: library not found", name);
+}
+
+uint32_t
+lib_hash(const char *name)
+{
+	const u_char *p;
+	uint32_t h;
+
+	for (h = 2166136261U, p = (const u_char *)name; *p; p++)
+		h = (h ^ *p) * 16777619U;
+
+	return h;
+}
+
+int
+lib_offcmp(const void *a, const void *b)
+{
+	const uint32_t *oa = *(uint32_t * const *)a;
+	const uint32_t *ob = *(uint32_t * const *)b;
+
+	if (*oa != *ob)
+		return *oa < *ob? -1 : 1;
+	return oa < ob? -1 : oa > ob;
+}
+
+/*
+ * read in and hash the (sysv/elf) library index
+ */
+int
+lib_index(struct archive *ar, FILE *fp, off_t symoff, u_long symlen)
+{
+	uint32_t **po, num, i, h;
+	char *p, *ep;
+
+	if (symlen < sizeof num)
+		errx(1, "%s: short symdef", ar->ar_path);
+
+	if (fseeko(fp, symoff, SEEK_SET) < 0)
+		err(1, "fseeko: %s", ar->ar_path);
+
+	if (!(ar->ar_symdef = malloc(symlen + 1)))
+		err(1, "symdef malloc");
+
+	if (fread(ar->ar_symdef, symlen, 1, fp) != 1)
+		err(1, "fread: %s", ar->ar_path);
+	stat_count(LD_ST_READ, symlen);
+	ar->ar_symdef[symlen] = '\0';
+
+	memcpy(&num, ar->ar_symdef, sizeof num);
+	num = betoh32(num);
+	if ((symlen - sizeof num) / sizeof num < num)
+		errx(1, "%s: short symdef", ar->ar_path);
+
+	if (!(ar->ar_offs = calloc(num + 1, sizeof *ar->ar_offs)) ||
+	    !(ar->ar_names = calloc(num + 1, sizeof *ar->ar_names)) ||
+	    !(ar->ar_mmbr = calloc(num + 1, sizeof *ar->ar_mmbr)) ||
+	    !(ar->ar_next = calloc(num + 1, sizeof *ar->ar_next)))
+		err(1, "calloc");
+
+	for (ar->ar_hmask = 15; ar->ar_hmask < num; ar->ar_hmask <<= 1)
+		ar->ar_hmask |= 1;
+	if (!(ar->ar_hash = calloc(ar->ar_hmask + 1, sizeof *ar->ar_hash)))
+		err(1, "calloc");
+
+	p = ar->ar_symdef + (num + 1) * sizeof num;
+	ep = ar->ar_symdef + symlen;
+	for (i = 0; i < num; i++, p += strlen(p) + 1) {
+		if (p >= ep)
+			errx(1, "%s: short symdef", ar->ar_path);
+
+		memcpy(&ar->ar_offs[i], ar->ar_symdef + (i + 1) * sizeof num,
+		    sizeof num);
+		ar->ar_offs[i] = betoh32(ar->ar_offs[i]);
+		ar->ar_names[i] = p;
+
+		/* keep the index order in the chains */
+		h = lib_hash(p) & ar->ar_hmask;
+		ar->ar_next[i] = ar->ar_hash[h];
+		ar->ar_hash[h] = i + 1;
+	}
+	ar->ar_num = num;
+
+	/* chains have been built backwards */
+	for (h = 0; h <= ar->ar_hmask; h++) {
+		uint32_t prev, next;
+
+		for (prev = 0, i = ar->ar_hash[h]; i; i = next) {
+			next = ar->ar_next[i - 1];
+			ar->ar_next[i - 1] = prev;
+			prev = i;
+		}
+		ar->ar_hash[h] = prev;
+	}
+
+	/* number the members */
+	if (!(po = calloc(num + 1, sizeof *po)))
+		err(1, "calloc");
+	for (i = 0; i < num; i++)
+		po[i] = &ar->ar_offs[i];
+	qsort(po, num, sizeof *po, lib_offcmp);
+	for (ar->ar_nmmbr = 0, i = 0; i < num; i++) {
+		if (i && *po[i] != *po[i - 1])
+			ar->ar_nmmbr++;
+		ar->ar_mmbr[po[i] - ar->ar_offs] = ar->ar_nmmbr;
+	}
+	if (num)
+		ar->ar_nmmbr++;
+	free(po);
+
+	if (!(ar->ar_loaded = calloc(ar->ar_nmmbr + 1, 1)) ||
+	    !(ar->ar_slot = calloc(ar->ar_nmmbr + 1, sizeof *ar->ar_slot)))
+		err(1, "calloc");
+
+	return 0;
+}
+
+/*
+ * read the archive in for the first time
+ */
+struct archive *
+lib_open(const char *path, FILE *fp)
 {
 	char armag[SARMAG];
+	struct archive *ar;
 	struct ar_hdr ah;
 	off_t off, symoff;
-	struct pathlist *pl;
 	char *p;
 	u_long len, symlen;
-	int i, nlen, ltrace = trace;
+	int i, nlen;
 
-	if (path[0] == '-' && path[1] == 'l')
-		TAILQ_FOREACH(pl, &libdirs, pl_entry) {
-			if (asprintf(&p, "%slib%s.a", pl->pl_path, path+2) < 0)
-				err(1, "asprintf");
-			if (ltrace)
-				printf("%s (%s)\n", path, p);
-			if (!access(p, F_OK)) {
-				path = p;
-				ltrace = 0;
-				break;
-			}
+	TAILQ_FOREACH(ar, &archives, ar_entry)
+		if (!strcmp(ar->ar_path, path)) {
+			if (fp)
+				fclose(fp);
+			return ar;
 		}
 
+	if (!(ar = calloc(1, sizeof *ar)))
+		err(1, "calloc");
+	if (!(ar->ar_path = strdup(path)))
+		err(1, "strdup");
+	ar->ar_gen = sym_undgen - 1;
+
 	if (!fp && !(fp = fopen(path, "r")))
 		err(1, "fopen: %s", path);
 
-	if (ltrace)
-		printf("%s\n", path);
-
 	if (fread(armag, sizeof armag, 1, fp) != 1 ||
 	    strncmp(armag, ARMAG, SARMAG))
 		errx(1, "%s: not an archive", path);
 
 	symoff = 0;
 	symlen = 0;
-	nametab = NULL;
 	while (fread(&ah, sizeof ah, 1, fp) == 1) {
 		if (memcmp(ah.ar_fmag, ARFMAG, sizeof ah.ar_fmag))
 			errx(1, "%s: invalid archive header", path);
@@ -599,22 +1058,21 @@ lib_add(const char *path, FILE *fp)
 			if (!symoff || !symlen)
 				continue;
 
-			if (!(nametab = malloc(len + 1)))
+			if (!(p = malloc(len + 1)))
 				err(1, "namtab malloc");
 
-			if (fread(nametab, len, 1, fp) != 1)
+			if (fread(p, len, 1, fp) != 1)
 				err(1, "%s: fread", path);
 
-			nametab[len] = '\0';
-			for (p = nametab, i = len; i--; p++)
+			p[len] = '\0';
+			ar->ar_nametab = p;
+			ar->ar_namtablen = len;
+			for (i = len; i--; p++)
 				if (*p == '\n')
 					*p = '\0';
 
-			namtablen = len;
-			if (lib_namtab(path, fp, len, symoff, symlen))
-				exit(1);
-			else
-				break;
+			lib_index(ar, fp, symoff, symlen);
+			break;
 		}
 
 		if (!strncmp(ah.ar_name, RANLIBMAG2, sizeof(RANLIBMAG2) - 1)) {
@@ -626,7 +1084,7 @@ lib_add(const char *path, FILE *fp)
 		}
 
 		if (!strncmp(ah.ar_name, RANLIBMAG, sizeof(RANLIBMAG) - 1)) {
-			if (lib_namtab(path, fp, len, symoff, symlen))
+			if (lib_symdef(path, fp, len))
 				exit(1);
 			else
 				break;
@@ -634,10 +1092,8 @@ lib_add(const char *path, FILE *fp)
 
 		/* see if we have a symdef but no namtab */
 		if (symoff) {
-			if (lib_namtab(path, fp, len, symoff, symlen))
-				exit(1);
-			else
-				break;
+			lib_index(ar, fp, symoff, symlen);
+			break;
 		}
 
 		/*
@@ -655,12 +1111,65 @@ lib_add(const char *path, FILE *fp)
 
 		errx(1, "%s: no symdef: not implemented", path);
 	}
+	fclose(fp);
+
+	TAILQ_INSERT_TAIL(&archives, ar, ar_entry);
+	return ar;
+}
+
+/*
+ * search the library for objects resolving
+ * currently undefined symbols;
+ * the library index (see ranlib(1)) is used to pull
+ * needed objects and keep cycling until no new symbols
+ * had been resolved.
+ * within a group the search is repeated once the
+ * whole group is in (see lib_group()).
+ */
+int
+lib_add(const char *path, FILE *fp)
+{
+	struct archive *ar;
+
+	if (trace)
+		printf("%s\n", path);
 
-	if (nametab) {
-		free(nametab);
-		nametab = NULL;
+	ar = lib_open(path, fp);
+	lib_scan(ar);
+
+	if (ingroup && !ar->ar_ingroup) {
+		ar->ar_ingroup = 1;
+		TAILQ_INSERT_TAIL(&group, ar, ar_gentry);
 	}
-	fclose(fp);
+
+	return 0;
+}
+
+/*
+ * keep searching the libraries in the group
+ * until none of them has anything else to offer
+ */
+int
+lib_group(void)
+{
+	struct archive *ar;
+	int more;
+
+	stat_begin("lib_group");
+	do {
+		more = 0;
+		TAILQ_FOREACH(ar, &group, ar_gentry)
+			if (lib_scan(ar))
+				more = 1;
+	} while (more);
+	stat_end();
+
+	while ((ar = TAILQ_FIRST(&group))) {
+		ar->ar_ingroup = 0;
+		TAILQ_REMOVE(&group, ar, ar_gentry);
+	}
+	ingroup = 0;
+
 	return 0;
 }
 
@@ -675,70 +1184,181 @@ lib_symdef(const char *path, FILE *fp, u_long len)
 }
 
 /*
- * scan the new (sysv/elf) library index
+ * archive member pulled in to resolve some undefined symbols;
+ * members are loaded in batches and only merged in if
+ * any of the symbols it's been pulled for is still undefined.
  */
+struct mmbrlist {
+	struct objlist *ml_obj;
+	const char **ml_syms;		/* symbols the member is needed for */
+	int ml_nsyms;
+};
+
+/*
+ * index entries matching the undefined symbols
+ */
+struct libhits {
+	struct archive *lh_ar;
+	uint32_t *lh_idx;
+	int lh_nidx, lh_maxidx;
+};
+
 int
-lib_namtab(const char *path, FILE *fp, u_long len, off_t symoff, u_long symlen)
+lib_lookup(struct symlist *sym, void *v)
+{
+	struct libhits *lh = v;
+	struct archive *ar = lh->lh_ar;
+	uint32_t i;
+
+	for (i = ar->ar_hash[lib_hash(sym->sl_name) & ar->ar_hmask]; i;
+	    i = ar->ar_next[i - 1]) {
+		if (ar->ar_loaded[ar->ar_mmbr[i - 1]] ||
+		    strcmp(ar->ar_names[i - 1], sym->sl_name))
+			continue;
+
+		if (lh->lh_nidx == lh->lh_maxidx) {
+			lh->lh_maxidx = lh->lh_maxidx? lh->lh_maxidx * 2 : 64;
+			if (!(lh->lh_idx = reallocarray(lh->lh_idx,
+			    lh->lh_maxidx, sizeof *lh->lh_idx)))
+				err(1, "reallocarray");
+		}
+		lh->lh_idx[lh->lh_nidx++] = i - 1;
+	}
+
+	return 0;
+}
+
+int
+lib_idxcmp(const void *a, const void *b)
+{
+	uint32_t ia = *(const uint32_t *)a, ib = *(const uint32_t *)b;
+
+	return ia < ib? -1 : ia > ib;
+}
+
+/*
+ * pull in the members for the undefined symbols;
+ * returns the number of members merged in.
+ * nothing could be found unless new undefined symbols
+ * appeared since the last time this library was searched.
+ */
+int
+lib_scan(struct archive *ar)
 {
 	struct objlist *sol = TAILQ_LAST(&objlist, objhead);
-	char *p, *pp;
-	uint32_t num, *offs;
-	int i, more;
+	struct objlist **mobjs;
+	struct mmbrlist *ml;
+	struct libhits lh;
+	FILE *fp;
+	int i, j, k, nml, merged;
 
-	if (fseeko(fp, symoff, SEEK_SET) < 0)
-		err(1, "fseeko: %s", path);
+	if (!ar->ar_num || ar->ar_gen == sym_undgen)
+		return 0;
 
-	if (!(pp = malloc(symlen)))
-		err(1, "symdef malloc");
+	if (!(fp = fopen(ar->ar_path, "r")))
+		err(1, "fopen: %s", ar->ar_path);
+	nametab = ar->ar_nametab;
+	namtablen = ar->ar_namtablen;
 
-	if (fread(pp, symlen, 1, fp) != 1)
-		err(1, "fread: %s", path);
+	if (!(ml = calloc(ar->ar_nmmbr, sizeof *ml)))
+		err(1, "calloc");
+	if (!(mobjs = calloc(ar->ar_nmmbr, sizeof *mobjs)))
+		err(1, "calloc");
 
-	offs = (uint32_t *)pp;
-	num = *offs++;
-	num = betoh32(num);
+	memset(&lh, 0, sizeof lh);
+	lh.lh_ar = ar;
+	merged = 0;
+	while (ar->ar_gen != sym_undgen) {
+		ar->ar_gen = sym_undgen;
 
-	more = 1;
-	while (more) {
-		more = 0;
-		for (i = 0, p = pp + (num + 1) * sizeof *offs;
-		    i < num; i++, p += strlen(p) + 1) {
+		/* go in the index order as the members would be found */
+		lh.lh_nidx = 0;
+		sym_undforeach(lib_lookup, &lh);
+		qsort(lh.lh_idx, lh.lh_nidx, sizeof *lh.lh_idx, lib_idxcmp);
+
+		for (nml = 0, i = 0; i < lh.lh_nidx; i++) {
 			struct ar_hdr mh;
 			off_t foff;
 			char *name;
-			int nlen;
+			int m, nlen;
 
-			if (!sym_isundef(p))
-				continue;
+			/* see if the member is already in this batch */
+			m = ar->ar_mmbr[lh.lh_idx[i]];
+			if (ar->ar_slot[m])
+				j = ar->ar_slot[m] - 1;
+			else {
+				foff = ar->ar_offs[lh.lh_idx[i]];
+				if (fseeko(fp, foff, SEEK_SET) < 0)
+					err(1, "fseeko: %s", ar->ar_path);
+				if (fread(&mh, sizeof mh, 1, fp) != 1)
+					err(1, "fread: %s", ar->ar_path);
+				if (memcmp(mh.ar_fmag, ARFMAG,
+				    sizeof mh.ar_fmag))
+					errx(1, "%s: invalid ar", ar->ar_path);
+				nlen = sizeof mh.ar_name;
+				if (!(name = malloc(nlen)))
+					err(1, "malloc");
+				*name = '\0';
+				if (mmbr_name(&mh, &name, 0, &nlen, fp))
+					exit(1);
+
+				j = nml++;
+				ar->ar_slot[m] = j + 1;
+				ml[j].ml_obj = obj_new(ar->ar_path, name,
+				    foff + sizeof mh);
+				ml[j].ml_nsyms = 0;
+				free(name);
+			}
 
-			foff = betoh32(offs[i]);
-			if (fseeko(fp, foff, SEEK_SET) < 0)
-				err(1, "fseeko: %s", path);
-			if (fread(&mh, sizeof mh, 1, fp) != 1)
-				err(1, "fread: %s", path);
-			if (memcmp(mh.ar_fmag, ARFMAG,
-			    sizeof mh.ar_fmag))
-				errx(1, "%s: invalid ar", path);
-			nlen = sizeof mh.ar_name;
-			if (!(name = malloc(nlen)))
-				err(1, "malloc");
-			*name = '\0';
-			if (mmbr_name(&mh, &name, 0, &nlen, fp))
-				return -1;
+			k = ml[j].ml_nsyms++;
+			if (!(ml[j].ml_syms = reallocarray(ml[j].ml_syms,
+			    ml[j].ml_nsyms, sizeof *ml[j].ml_syms)))
+				err(1, "reallocarray");
+			ml[j].ml_syms[k] = ar->ar_names[lh.lh_idx[i]];
+		}
 
-			/*
-			 * this can be optimised by checking
-			 * inside the obj_add if we added
-			 * any new undef syms
-			 */
-			more = 1;
-			obj_add(path, name, fp, foff + sizeof mh, sol);
-			free(name);
+		/* load the whole batch at once */
+		for (j = 0; j < nml; j++)
+			mobjs[j] = ml[j].ml_obj;
+		obj_loadv(mobjs, nml, 0);
+
+		/*
+		 * merge them in the index order skipping those that
+		 * became useless due to the earlier ones in the batch
+		 */
+		for (i = 0; i < lh.lh_nidx; i++) {
+			int m = ar->ar_mmbr[lh.lh_idx[i]];
+
+			if (!ar->ar_slot[m])
+				continue;
+			j = ar->ar_slot[m] - 1;
+			ar->ar_slot[m] = 0;
+
+			for (k = 0; k < ml[j].ml_nsyms; k++)
+				if (sym_isundef(ml[j].ml_syms[k]))
+					break;
+
+			if (k < ml[j].ml_nsyms) {
+				ar->ar_loaded[m] = 1;
+				obj_merge(ml[j].ml_obj, sol);
+				stat_count(LD_ST_MEMBERS, 1);
+				merged++;
+			} else
+				obj_free(ml[j].ml_obj);
+
+			free(ml[j].ml_syms);
+			ml[j].ml_syms = NULL;
 		}
 	}
-	free(pp);
+	free(lh.lh_idx);
+	free(mobjs);
+	free(ml);
 
-	return 0;
+	nametab = NULL;
+	namtablen = 0;
+	fclose(fp);
+
+	return merged;
 }
 
 /*
@@ -822,28 +1442,17 @@ obj_foreach(int (*func)(struct objlist *, void *), void *v)
 }
 
 /*
- * load an object from path (or path(name) for archive)
- * resolving undefined symbols an fetcing all info
- * needed for the second pass (mapping)
+ * allocate a new object from path (or path(name) for archive)
  */
-int
-obj_add(const char *path, const char *name, FILE *fp, off_t foff,
-    struct objlist *sol)
+struct objlist *
+obj_new(const char *path, const char *name, off_t foff)
 {
-	off_t ofoff;
 	struct objlist *ol;
 
 	if ((ol = calloc(1, sizeof *ol)) == NULL)
 		err(1, "calloc");
 	ol->ol_path = path;
-
-	ofoff = 0;
 	ol->ol_off = foff;
-	if (foff) {
-		ofoff = ftello(fp);
-		if (fseeko(fp, foff, SEEK_SET) < 0)
-			err(1, "fseeko: %s", path);
-	}
 
 	/* gotta be an ar member */
 	if (name) {
@@ -854,33 +1463,237 @@ obj_add(const char *path, const char *name, FILE *fp, off_t foff,
 	} else
 		ol->ol_name = ol->ol_path;
 
-	if (trace)
-		printf("%s\n", ol->ol_name);
+	return ol;
+}
+
+/*
+ * dispose of an object that has been loaded but never merged
+ */
+void
+obj_free(struct objlist *ol)
+{
+	int i;
+
+	for (i = 0; ol->ol_sections && i < ol->ol_nsect; i++)
+		free(ol->ol_sections[i].os_rels);
+	free(ol->ol_sections);
+	free(ol->ol_sects);
+	free(ol->ol_snames);
+	free(ol->ol_syms);
+	free(ol->ol_stab);
+	for (i = 0; i < ol->ol_ngroups; i++) {
+		free(ol->ol_groups[i].og_sig);
+		free(ol->ol_groups[i].og_sects);
+	}
+	free(ol->ol_groups);
+	if (ol->ol_name != ol->ol_path)
+		free((char *)ol->ol_name);
+	free(ol);
+}
+
+/*
+ * get the object's file for the worker
+ */
+FILE *
+obj_file(struct objload *ld, struct objlist *ol, int w)
+{
+	FILE *fp = ld->ld_fps[w];
+
+	if (ld->ld_paths[w] != ol->ol_path) {
+		if (fp)
+			fclose(fp);
+		if (!(fp = fopen(ol->ol_path, "r")))
+			err(1, "fopen: %s", ol->ol_path);
+		ld->ld_fps[w] = fp;
+		ld->ld_paths[w] = ol->ol_path;
+	}
+
+	return fp;
+}
+
+/*
+ * load the object headers and the section groups;
+ * called from the pool workers thus no global state here
+ */
+void
+obj_loadhead(void *v, int i, int w)
+{
+	struct objload *ld = v;
+	struct objlist *ol = ld->ld_objs[i];
+	FILE *fp;
+	int rv;
+
+	fp = obj_file(ld, ol, w);
+	if (fseeko(fp, ol->ol_off, SEEK_SET) < 0)
+		err(1, "fseeko: %s", ol->ol_path);
 
 	if (fread(&ol->ol_hdr, sizeof ol->ol_hdr, 1, fp) != 1)
 		err(1, "fread header: %s", ol->ol_name);
 
-	if (!elf32_chk_header(&ol->ol_hdr.elf32)) {
-		if (elf32_objadd(ol, fp, foff))
-			exit(1);
-	} else if (!elf64_chk_header(&ol->ol_hdr.elf64)) {
-		if (elf64_objadd(ol, fp, foff))
-			exit(1);
+	if (!elf32_chk_header(&ol->ol_hdr.elf32))
+		rv = elf32_objhead(ol, fp, ol->ol_off);
+	else if (!elf64_chk_header(&ol->ol_hdr.elf64))
+		rv = elf64_objhead(ol, fp, ol->ol_off);
 #if 0
-	} else if (!BAD_OBJECT(ol->ol_hdr.aout)) {
+	else if (!BAD_OBJECT(ol->ol_hdr.aout))
 		/* a.out goes here */
 #endif
-	} else
-		errx(1, "%s: bad format", path);
+	else
+		errx(1, "%s: bad format", ol->ol_path);
+
+	if (rv)
+		exit(1);
+}
+
+/*
+ * load the rest of the object fetching all info needed for the merge;
+ * called from the pool workers thus no global state here
+ */
+void
+obj_loadone(void *v, int i, int w)
+{
+	struct objload *ld = v;
+	struct objlist *ol = ld->ld_objs[i];
+	FILE *fp;
+	int rv;
+
+	fp = obj_file(ld, ol, w);
+	if (ol->ol_hdr.elf32.e_ident[EI_CLASS] == ELFCLASS32)
+		rv = elf32_objload(ol, fp, ol->ol_off);
+	else
+		rv = elf64_objload(ol, fp, ol->ol_off);
+
+	if (rv)
+		exit(1);
+}
+
+/*
+ * load a bunch of objects at once; merging is up to the caller;
+ * objects that are going to be merged all (in the order given)
+ * claim their groups right away, otherwise groups are only
+ * checked against the ones claimed already.
+ */
+void
+obj_loadv(struct objlist **objs, int n, int claim)
+{
+	struct objload ld;
+	int i;
+
+	if (!n)
+		return;
+
+	memset(&ld, 0, sizeof ld);
+	ld.ld_objs = objs;
+	pool_run(n, obj_loadhead, &ld);
+	for (i = 0; i < n; i++)
+		obj_groups(objs[i], claim);
+	pool_run(n, obj_loadone, &ld);
+
+	for (i = 0; i < LD_MAXTHREADS; i++)
+		if (ld.ld_fps[i])
+			fclose(ld.ld_fps[i]);
+}
+
+/*
+ * resolve the object's section groups against the ones
+ * from the objects linked in before; first one wins and
+ * the sections of the duplicate groups are discarded.
+ * returns the number of groups newly discarded.
+ */
+int
+obj_groups(struct objlist *ol, int claim)
+{
+	struct objgroup *og, *eog;
+	struct objlist *owner;
+	int i, n;
+
+	n = 0;
+	for (og = ol->ol_groups, eog = og + ol->ol_ngroups; og < eog; og++) {
+		if (og->og_discard)
+			continue;
+
+		owner = comdat_claim(og->og_sig, ol, claim);
+		if (!owner || owner == ol)
+			continue;
+
+		og->og_discard = 1;
+		for (i = 0; i < og->og_nsects; i++)
+			ol->ol_sections[og->og_sects[i]].os_flags |=
+			    SECTION_DISCARD;
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * merge a loaded object into the global list
+ * resolving undefined symbols and fetcing all info
+ * needed for the second pass (mapping)
+ */
+int
+obj_merge(struct objlist *ol, struct objlist *sol)
+{
+	int rv;
+
+	if (trace)
+		printf("%s\n", ol->ol_name);
+
+	stat_count(LD_ST_SYMS, ol->ol_nsyms);
+	if (ol->ol_hdr.elf32.e_ident[EI_CLASS] == ELFCLASS32)
+		rv = elf32_objmerge(ol);
+	else
+		rv = elf64_objmerge(ol);
+	if (rv)
+		exit(1);
 
 	if (sol && randomise && randombit())
 		TAILQ_INSERT_AFTER(&objlist, sol, ol, ol_entry);
 	else
 		TAILQ_INSERT_TAIL(&objlist, ol, ol_entry);
-	fseeko(fp, ofoff, SEEK_SET);
 	return 0;
 }
 
+/*
+ * objects from the command line waiting to be loaded
+ */
+struct objlist **objq;
+int nobjq, maxobjq;
+
+void
+obj_queue(const char *path)
+{
+	if (nobjq == maxobjq) {
+		maxobjq = maxobjq? maxobjq * 2 : 64;
+		if (!(objq = reallocarray(objq, maxobjq, sizeof *objq)))
+			err(1, "reallocarray");
+	}
+
+	objq[nobjq++] = obj_new(path, NULL, 0);
+}
+
+/*
+ * load all the queued objects in parallel and merge
+ * them in the command line order so symbol resolution
+ * stays the same as if loaded one by one
+ */
+void
+obj_flush(void)
+{
+	int i;
+
+	if (!nobjq)
+		return;
+
+	stat_begin("obj_flush");
+	obj_loadv(objq, nobjq, 1);
+	for (i = 0; i < nobjq; i++)
+		obj_merge(objq[i], NULL);
+	stat_count(LD_ST_OBJS, nobjq);
+	nobjq = 0;
+	stat_end();
+}
+
 /*
  * produce a loading order for the later mapping stage
  * this matches each template order for a given arch
@@ -894,11 +1707,14 @@ ldorder(const struct ldarch *lda)
 {
 	const struct ldorder *order;
 	struct ldorder *neworder, *ssorder;
+	struct ordindex oi;
 	struct symlist *sym;
 	size_t n;
 	int i;
 
 	ssorder = 0;
+	memset(&oi, 0, sizeof oi);
+	strtab_init(&oi.oi_link1);
 	TAILQ_INIT(&headorder);
 	for (i = 0, order = lda->la_order;
 	    order->ldo_order != ldo_kaput; order++, i++) {
@@ -919,6 +1735,13 @@ ldorder(const struct ldarch *lda)
 		if (magic == ZMAGIC && (order->ldo_flags & LD_NOZMAGIC))
 			continue;
 
+		/* only the sections and the tables make a relocatable */
+		if (relocatable && (order->ldo_order == ldo_expr ||
+		    order->ldo_order == ldo_symbol ||
+		    order->ldo_order == ldo_interp ||
+		    order->ldo_order == ldo_ehfrh))
+			continue;
+
 		switch (order->ldo_order) {
 		/* these are handled in ldinit */
 		case ldo_option:
@@ -930,12 +1753,9 @@ ldorder(const struct ldarch *lda)
 			break;
 
 		case ldo_section:
+			/* sections are pulled in all at once below */
 			neworder = order_clone(lda, order);
-			if (obj_foreach(elfclass == ELFCLASS32?
-			    ld32order_obj : ld64order_obj, neworder)) {
-				free(neworder);
-				break;
-			}
+			order_index(&oi, neworder);
 			TAILQ_INSERT_TAIL(&headorder, neworder, ldo_entry);
 			break;
 
@@ -965,13 +1785,13 @@ ldorder(const struct ldarch *lda)
 			break;
 
 		case ldo_ehfrh:
+			/* the search table is made in ldmap() if asked for */
 			neworder = order_clone(lda, order);
 			neworder->ldo_wurst = calloc(1, 4);
 			neworder->ldo_wsize = 4;
 			{
 				uint8_t *p = neworder->ldo_wurst;
 				p[0] = 1;	/* version */
-#define	DW_EH_PE_omit	0xff
 				p[1] = DW_EH_PE_omit;
 				p[2] = DW_EH_PE_omit;
 				p[3] = DW_EH_PE_omit;
@@ -988,20 +1808,31 @@ ldorder(const struct ldarch *lda)
 			TAILQ_INSERT_TAIL(&headorder, neworder, ldo_entry);
 			break;
 
+		case ldo_reloc:
 		case ldo_kaput:
 			break;
 		}
 	}
 
+	obj_foreach(elfclass == ELFCLASS32? ld32order_obj : ld64order_obj, &oi);
+	free(oi.oi_trie);
+	strtab_free(&oi.oi_link1);
+
 	/* check for disordered sections */
 	obj_foreach(order_check, NULL);
 
+	if (symordfile)
+		order_symbols(&headorder, symordfile);
+
+	if (relocatable)
+		order_relocs(&headorder, lda);
+
 	n = 1;
 	TAILQ_FOREACH(order, &headorder, ldo_entry)
 		n += strlen(order->ldo_name) + 1;
 	ssorder->ldo_wsize = SHALIGN(n);
-	if (!(ssorder->ldo_wurst = malloc(ssorder->ldo_wsize)))
-		err(1, "malloc");
+	if (!(ssorder->ldo_wurst = calloc(1, ssorder->ldo_wsize)))
+		err(1, "calloc");
 	sysobj.ol_snames = ssorder->ldo_wurst;
 
 	return &headorder;
@@ -1015,7 +1846,7 @@ order_check(struct objlist *ol, void *v)
 
         n = ol->ol_nsect;
 	for (i = 1, os++; i < n; i++, os++) {
-		if (os->os_flags & SECTION_ORDER)
+		if (os->os_flags & (SECTION_ORDER | SECTION_DISCARD))
 			continue;
 
 		if (os->os_flags & SHF_ALLOC)
@@ -1026,6 +1857,123 @@ order_check(struct objlist *ol, void *v)
 	return 0;
 }
 
+/*
+ * move the sections defining symbols listed in the file
+ * (one per line) to the front of their orders in the order listed;
+ * all other sections stay where they were.
+ */
+void
+order_symbols(struct headorder *headorder, const char *path)
+{
+	struct {
+		struct ldorder *ord;
+		struct section *last;	/* last one moved to the front */
+	} *fronts;
+	struct ldorder *ord;
+	struct section *os;
+	struct symlist *sym;
+	FILE *fp;
+	char *line, *p;
+	size_t linesize;
+	ssize_t len;
+	int i, n;
+
+	if (!(fp = fopen(path, "r")))
+		err(1, "fopen: %s", path);
+
+	n = 0;
+	TAILQ_FOREACH(ord, headorder, ldo_entry)
+		n++;
+	if (!(fronts = calloc(n, sizeof *fronts)))
+		err(1, "calloc");
+
+	line = NULL;
+	linesize = 0;
+	while ((len = getline(&line, &linesize, fp)) != -1) {
+		/* trim the spaces around and skip comments */
+		for (p = line + len; p > line && isspace((u_char)p[-1]); p--)
+			;
+		*p = '\0';
+		for (p = line; isspace((u_char)*p); p++)
+			;
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		if (!(sym = sym_isdefined(p, NULL)) || !(os = sym->sl_sect)) {
+			warnx("%s: symbol \"%s\" is not defined", path, p);
+			continue;
+		}
+
+		if (!(ord = os->os_order) || (os->os_flags & SECTION_SORTED))
+			continue;
+		os->os_flags |= SECTION_SORTED;
+
+		for (i = 0; i < n && fronts[i].ord && fronts[i].ord != ord; i++)
+			;
+		if (i == n)
+			errx(1, "order_symbols: botch");
+
+		TAILQ_REMOVE(&ord->ldo_seclst, os, os_entry);
+		if (!fronts[i].ord) {
+			fronts[i].ord = ord;
+			TAILQ_INSERT_HEAD(&ord->ldo_seclst, os, os_entry);
+		} else
+			TAILQ_INSERT_AFTER(&ord->ldo_seclst, fronts[i].last,
+			    os, os_entry);
+		fronts[i].last = os;
+	}
+	if (ferror(fp))
+		err(1, "getline: %s", path);
+
+	free(line);
+	free(fronts);
+	fclose(fp);
+}
+
+/*
+ * the relocatable output keeps the relocations;
+ * add a relocation section right after every section order
+ * that has any (where the loaders expect them to be).
+ * these are sized and filled in ldmap() and ldload().
+ */
+void
+order_relocs(struct headorder *headorder, const struct ldarch *lda)
+{
+	struct ldorder *ord, *rord;
+	struct section *os;
+	char *name;
+
+	TAILQ_FOREACH(ord, headorder, ldo_entry) {
+		if (ord->ldo_order != ldo_section)
+			continue;
+
+		TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry)
+			if (os->os_nrls)
+				break;
+		if (!os)
+			continue;
+
+		if ((rord = calloc(1, sizeof *rord)) == NULL)
+			err(1, "calloc");
+		TAILQ_INIT(&rord->ldo_seclst);
+		rord->ldo_order = ldo_reloc;
+		if (os->os_flags & SECTION_RELA) {
+			rord->ldo_type = SHT_RELA;
+			if (asprintf(&name, ".rela%s", ord->ldo_name) < 0)
+				err(1, "asprintf");
+		} else {
+			rord->ldo_type = SHT_REL;
+			if (asprintf(&name, ".rel%s", ord->ldo_name) < 0)
+				err(1, "asprintf");
+		}
+		rord->ldo_name = name;
+		rord->ldo_shflags = SHF_INFO_LINK;
+		rord->ldo_arch = lda;
+		rord->ldo_wurst = ord;	/* the one being relocated */
+		TAILQ_INSERT_AFTER(headorder, ord, rord, ldo_entry);
+	}
+}
+
 /*
  * remove unreferenced sections from the order;
  * only called if --gc-sections was specified
@@ -1034,58 +1982,110 @@ struct headorder *
 elf_gcs(struct headorder *headorder)
 {
 	struct ldorder *ord;
-	struct section *os, *next;
-	int changed;
+	struct section *os, *next, *rs, **wl;
+	struct symlist *sym;
+	size_t nwl, maxwl, lo, hi, i, j;
 
 	if (!sentry || !sentry->sl_sect)
 		errx(1, "entry point not defined");
-	sentry->sl_sect->os_flags |= SECTION_USED;
 
-	/* pass 1: roll thru the order marking sections as used */
-	changed = 1;
+	/*
+	 * pass 1: mark the sections reachable from the entry point
+	 * and the ones that must be kept anyway;
+	 * every marked section is put on the worklist exactly once
+	 * thus every relocation is only looked at once.
+	 * the worklist is taken in rounds reading the relocations
+	 * for the whole round at once and only for the sections
+	 * found reachable so far.
+	 */
+	maxwl = 256;
+	if (!(wl = reallocarray(NULL, maxwl, sizeof *wl)))
+		err(1, "reallocarray");
+	nwl = 0;
+	wl[nwl++] = sentry->sl_sect;
+	sentry->sl_sect->os_flags |= SECTION_USED;
 	TAILQ_FOREACH(ord, headorder, ldo_entry) {
-		if (changed) {
-			ord = TAILQ_FIRST(headorder);
-			changed = 0;
-		}
-
 		if (ord->ldo_order != ldo_section)
 			continue;
 
 		TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry) {
-			struct relist *rp, *er;
-			if (!(os->os_flags & SECTION_USED))
+			if (!(os->os_flags & SECTION_USED) ||
+			    os == sentry->sl_sect)
 				continue;
 
-			for (rp = os->os_rels, er = &os->os_rels[os->os_nrls];
-			    rp < er; rp++)
-				if (rp->rl_sym->sl_sect &&
-				    !(rp->rl_sym->sl_sect->os_flags &
-				    SECTION_USED)) {
-					changed = 1;
-					rp->rl_sym->sl_sect->os_flags |=
-					    SECTION_USED;
+			if (nwl == maxwl) {
+				maxwl *= 2;
+				if (!(wl = reallocarray(wl, maxwl, sizeof *wl)))
+					err(1, "reallocarray");
+			}
+			wl[nwl++] = os;
+		}
+	}
+
+	for (lo = 0; lo < nwl; lo = hi) {
+		hi = nwl;
+		if (elfclass == ELFCLASS32)
+			elf32_relload(wl + lo, hi - lo);
+		else
+			elf64_relload(wl + lo, hi - lo);
+
+		for (j = lo; j < hi; j++) {
+			os = wl[j];
+			for (i = 0; os->os_rels && i < os->os_nrls; i++) {
+				sym = RL_SYM(os, &os->os_rels[i]);
+				if (!sym || !(rs = sym->sl_sect) ||
+				    (rs->os_flags & SECTION_USED))
+					continue;
+
+				rs->os_flags |= SECTION_USED;
+				if (nwl == maxwl) {
+					maxwl *= 2;
+					if (!(wl = reallocarray(wl, maxwl,
+					    sizeof *wl)))
+						err(1, "reallocarray");
 				}
+				wl[nwl++] = rs;
+			}
+
+			/* lowmem reads them again for the output */
+			if (lowmem) {
+				free(os->os_rels);
+				os->os_rels = NULL;
+			}
 		}
 	}
+	free(wl);
 
 	/* pass 2: roll thru the order removing unused sections */
 	TAILQ_FOREACH(ord, headorder, ldo_entry) {
 		if (ord->ldo_order != ldo_section)
 			continue;
 
+		/* the debugging info is kept for whatever is left */
+		if (ord->ldo_flags & LD_DEBUG) {
+			TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry)
+				os->os_flags |= SECTION_USED;
+			continue;
+		}
+
 		for(os = TAILQ_FIRST(&ord->ldo_seclst);
 		    os != TAILQ_END(&ord->ldo_seclst); os = next) {
 			next = TAILQ_NEXT(os, os_entry);
 
+			if (os->os_flags & SECTION_USED)
+				continue;
+
+			if (print_gc_sections)
+				warnx("removing unused section \"%s\" in %s",
+				    os->os_name, os->os_obj->ol_name);
+
 			/*
 			 * simply drop the section from the list
 			 * and avoid the free(3) hustle as we are
 			 * unlikely to need more memory and exit(1)
 			 * brings freedom to everyone
 			 */
-			if (!(os->os_flags & SECTION_USED))
-				TAILQ_REMOVE(&ord->ldo_seclst, os, os_entry);
+			TAILQ_REMOVE(&ord->ldo_seclst, os, os_entry);
 		}
 	}
 
@@ -1094,9 +2094,9 @@ elf_gcs(struct headorder *headorder)
 
 /*
  * a wrapper for the micro-linker (ld2.c)
- * read the whole object into memory and
+ * map a private copy of the object and
  * call appropriate worker (32/64)
- * upon success ump out the result
+ * upon success write out the ranges left
  */
 int
 uLD(const char *name, const char *output)
@@ -1106,48 +2106,107 @@ uLD(const char *name, const char *output)
 		Elf32_Ehdr elf32;
 		Elf64_Ehdr elf64;
 	} *h;
+	struct iovec iov[LD_ULD_NIOV], *iv;
 	struct stat sb;
-	FILE *fp, *ofp;
+	ssize_t n;
+	size_t size;
 	char *v;
-	int rv, size;
+	int fd, ofd, niov, rv;
 
-	if (!(fp = fopen(name, "r")))
-		err(1, "fopen: %s", name);
+	if ((fd = open(name, O_RDONLY)) < 0)
+		err(1, "open: %s", name);
 
-	if (fstat(fileno(fp), &sb) < 0)
+	if (fstat(fd, &sb) < 0)
 		err(1, "fstat: %s", name);
 
-	if (sb.st_size > INT_MAX)
+	if ((uint64_t)sb.st_size > SIZE_MAX)
 		errx(1, "%s: file is too big", name);
 
-	if (!(v = malloc(sb.st_size)))
-		err(1, "malloc %d bytes", (int)sb.st_size);
-
-	if (fread(v, sb.st_size, 1, fp) != 1) {
-		if (feof(fp))
-			errx(1, "%s: shrinkage", name);
-		else
-			err(1, "fread: %s", name);
+	size = sb.st_size;
+	if (size < sizeof *h) {
+		close(fd);
+		return 1;
 	}
 
-	if (!(ofp = fopen(output, "w")))
-		err(1, "fopen: %s", output);
+	if ((v = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+	    fd, 0)) == MAP_FAILED)
+		err(1, "mmap: %s", name);
+	close(fd);
 
-	size = sb.st_size;
 	h = (union banners *)v;
 	if (IS_ELF(h->elf32) &&
 	    h->elf32.e_ident[EI_CLASS] == ELFCLASS32 &&
 	    h->elf32.e_ident[EI_VERSION] == ELF_TARG_VER)
-		rv = uLD32(name, v, &size, Xflag);
+		rv = uLD32(name, v, size, iov, &niov, Xflag);
 	else if (IS_ELF(h->elf64) &&
 	    h->elf64.e_ident[EI_CLASS] == ELFCLASS64 &&
 	    h->elf64.e_ident[EI_VERSION] == ELF_TARG_VER)
-		rv = uLD64(name, v, &size, Xflag);
+		rv = uLD64(name, v, size, iov, &niov, Xflag);
 	else
-		return 1;
+		rv = 1;
+
+	if (!rv) {
+		if ((ofd = open(output, O_WRONLY | O_CREAT | O_TRUNC,
+		    0666)) < 0)
+			err(1, "open: %s", output);
+
+		/* writes over the SSIZE_MAX may come out short */
+		for (iv = iov; niov; ) {
+			if ((n = writev(ofd, iv, niov)) < 0)
+				err(1, "writev: %s", output);
+			for (; niov && (size_t)n >= iv->iov_len; niov--)
+				n -= iv++->iov_len;
+			if (niov) {
+				iv->iov_base = (char *)iv->iov_base + n;
+				iv->iov_len -= n;
+			}
+		}
 
-	if (!rv && fwrite(v, size, 1, ofp) != 1)
-		err(1, "fwrite: %s", name);
+		if (close(ofd) < 0)
+			err(1, "close: %s", output);
+	}
 
-	return 0;
+	munmap(v, size);
+	return rv;
+}
+
+struct uldbatch {
+	char **ub_files;	/* input, output, ... */
+	int *ub_rv;
+};
+
+void
+uld_one(void *v, int i, int w)
+{
+	struct uldbatch *ub = v;
+
+	ub->ub_rv[i] = uLD(ub->ub_files[2 * i], ub->ub_files[2 * i + 1]);
+}
+
+/*
+ * run the micro-linker over the n pairs of files on the pool
+ */
+int
+uld_batch(char **files, int n)
+{
+	struct uldbatch ub;
+	int i, rv;
+
+	ub.ub_files = files;
+	if (!(ub.ub_rv = calloc(n, sizeof *ub.ub_rv)))
+		err(1, "calloc");
+
+	stat_begin("uLD");
+	pool_run(n, uld_one, &ub);
+	stat_end();
+
+	for (rv = i = 0; i < n; i++)
+		if (ub.ub_rv[i]) {
+			warnx("%s: not an elf object", files[2 * i]);
+			rv = 1;
+		}
+
+	free(ub.ub_rv);
+	stat_report();
+	return rv;
 }
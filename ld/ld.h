@@ -20,6 +20,7 @@
 
 /* section names not yet in exec_elf.h */
 #define	ELF_NOTE	".note.aeriebsd.ident"
+#define	ELF_NOTE_BUILDID ".note.gnu.build-id"
 #define	ELF_EH_FRAME	".eh_frame"
 #define	ELF_EH_FRAME_H	".eh_frame_hdr"
 #define	ELF_GCC_EXCEPT	".gcc_except_table"
@@ -37,16 +38,35 @@
 
 #define	LD_INTERP	"/usr/libexec/ld.so"
 
+/* section group bits not yet in exec_elf.h either */
+#ifndef SHT_GROUP
+#define	SHT_GROUP	17
+#endif
+#ifndef GRP_COMDAT
+#define	GRP_COMDAT	0x1
+#endif
+#ifndef SHT_SYMTAB_SHNDX
+#define	SHT_SYMTAB_SHNDX	18
+#endif
+#ifndef SHF_INFO_LINK
+#define	SHF_INFO_LINK	0x40
+#endif
+
 #define	ELF_IBUFSZ	0x10000
 #define	ELF_OBUFSZ	0x10000
 #define	ELF_SBUFSZ	0x200	/* XXX make bigger later */
 
 #define	SHALIGN(a)	(((a) + 15) & ~15)
 
+#define	LD_MAXTHREADS	64	/* upper limit on the worker threads */
+
 /* this is used for library path and -L */
 struct pathlist {
 	TAILQ_ENTRY(pathlist) pl_entry;
 	const char *pl_path;
+	char **pl_libs;		/* lib*.a in there; sorted */
+	int pl_nlibs;
+	int pl_read;
 };
 
 struct ldorder;
@@ -54,6 +74,7 @@ struct objlist;
 struct section;
 struct symlist;
 struct xreflist;
+struct iovec;
 TAILQ_HEAD(headorder, ldorder);
 
 typedef int (*ordprint_t)(const struct ldorder *, void *);
@@ -61,43 +82,86 @@ typedef int (*symprint_t)(const struct ldorder *, const struct section *,
     struct symlist *, void *);
 
 /*
- * this describes one symbol and links it to both
- * global symbol table and per-object list.
- * used for both defined and undefined symbols.
- * once symbol is defined sl_obj is filled;
- * until then sl_obj points to the first referer object;
- * it's important to keep the pointer as it is already
- * used for reference in relocs and possibly other places.
+ * the symbols of a section linked by the symbol numbers;
+ * the number zero is never given out and ends the list.
+ */
+struct symq {
+	uint32_t sq_first, sq_last;
+};
+#define	SYMQ_INIT(q)	((q)->sq_first = (q)->sq_last = 0)
+#define	SYMQ_EMPTY(q)	((q)->sq_first == 0)
+#define	SYMQ_FIRST(q)	sym_get((q)->sq_first)
+#define	SYMQ_NEXT(sym)	sym_get((sym)->sl_snext)
+#define	SYMQ_FOREACH(sym, q)	\
+	for ((sym) = SYMQ_FIRST(q); (sym); (sym) = SYMQ_NEXT(sym))
+
+/*
+ * this describes one symbol, both defined and undefined;
+ * kept in the numbered slabs (see sym_get()) and found by the name
+ * in the hash of the symbol numbers.  the cross-references and
+ * the indices in the relocatable output are in the side arrays
+ * by the number and only exist when asked for.
+ * until the symbol is defined sl_sect points to the first referer;
+ * the pointer is kept for good as the relocs refer to it.
  */
 struct symlist {
-	TAILQ_HEAD(, xreflist) sl_xref;	/* xref list */
-	RB_ENTRY(symlist) sl_node;	/* global symbol table */
-	TAILQ_ENTRY(symlist) sl_entry;	/* list per section */
 	union {
 		Elf32_Sym sym32;
 		Elf64_Sym sym64;
 	} sl_elfsym;
 	struct section *sl_sect;	/* section where defined */
-	const char *sl_name;
-	long sl_next;			/* uniq local name counter */
+	const char *sl_name;		/* in the name pool */
+	uint32_t sl_no;			/* number (see sym_get()) */
+	uint32_t sl_next;		/* uniq local name counter */
+	uint32_t sl_snext, sl_sprev;	/* in the section list */
 };
 extern struct symlist *sentry;
 
+/*
+ * output string table under construction (see strtab_add())
+ */
+#define	STRTAB_CHUNK	0x10000	/* strings per parallel write job */
+
+struct strent;
+struct strtab {
+	struct strent *st_ents;		/* unique strings */
+	size_t st_nents, st_maxents;
+	u_int *st_hash;			/* string index + 1 */
+	size_t st_hsize;
+	size_t st_size;			/* table size once finished */
+};
+
 struct xreflist {
 	TAILQ_ENTRY(xreflist) xl_entry;	/* xref list for each symbol */
 	struct objlist *xl_obj;
 };
+TAILQ_HEAD(xrefhead, xreflist);
+
+#define	SYM_SLAB	4096		/* symbols per allocation */
+#define	SYM_NAMEPOOL	0x10000		/* name pool chunk */
 
 /*
  * relocation description;
  * created for both rel and rela types.
- * links to the symbol once the symbol table has been loaded.
+ * refers to the symbol by the index in the object's symbol table
+ * that links to the symbol once the symbol table has been loaded.
  */
 struct relist {
 	uint64_t rl_addr;
 	int64_t rl_addend;
-	struct symlist *rl_sym;		/* referene symbol */
-	u_char rl_type;			/* relocation type */
+	u_int rl_si;			/* symbol index in the object */
+	u_int rl_type;			/* relocation type */
+};
+#define	RL_SYM(os, rp)	((os)->os_obj->ol_sidx[(rp)->rl_si])
+
+/*
+ * a piece of a mergeable (SHF_MERGE) section;
+ * maps the input offset into the merged contents
+ */
+struct mergefrag {
+	uint64_t mf_off;		/* offset in the input section */
+	uint64_t mf_out;		/* offset in the merged section */
+	uint64_t mf_hash;		/* contents hash */
 };
 
 /*
@@ -107,23 +171,46 @@ struct relist {
  */
 struct section {
 	TAILQ_ENTRY(section) os_entry;	/* list in the order */
-	TAILQ_HEAD(, symlist) os_syms;	/* all defined syms in the section */
+	struct symq os_syms;		/* all defined syms in the section */
 
 	off_t os_off;			/* source section offset */
 	struct objlist *os_obj;		/* back-ref to the object */
 	const char *os_name;		/* section name */
+	struct ldorder *os_order;	/* order the section is pulled into */
 	void *os_sect;			/* elf section descriptor */
 	struct relist *os_rels;		/* array of relocations */
 	struct relist *os_rp;		/* current rel pointer */
 	int os_nrls;			/* number of relocations */
+	struct section *os_merged;	/* merged into this section */
+	struct section *os_folded;	/* folded by icf into this one */
+	struct mergefrag *os_frags;	/* pieces of a merged section */
+	size_t os_nfrags;		/* number of pieces */
+	void *os_data;			/* contents generated in memory */
+	int os_icf;			/* icf candidate number + 1 */
 	int os_no;			/* elf section number */
 	int os_flags;
+#define	SECTION_RELA	0x00800000	/* relocations come with addends */
+#define	SECTION_INCR	0x01000000	/* recorded in the incremental state */
+#define	SECTION_ADDRSIG	0x02000000	/* address is taken (for icf) */
+#define	SECTION_DISCARD	0x04000000	/* member of a duplicate group */
+#define	SECTION_SORTED	0x08000000	/* placed by the symbol order */
 #define	SECTION_ORDER	0x10000000	/* pulled into some order */
 #define	SECTION_LOADED	0x20000000	/* been loaded */
 #define	SECTION_USED	0x40000000	/* syms in this section's been refed */
 #define	SECTION_64	0x80000000
 };
 
+/*
+ * a COMDAT section group from one object;
+ * only the first group with the signature gets linked
+ */
+struct objgroup {
+	char *og_sig;			/* group signature */
+	int *og_sects;			/* member section numbers */
+	int og_nsects;
+	int og_discard;			/* lost to an earlier one */
+};
+
 /*
  * an object either a file or a library member;
  * contains an array of sections and needed elf headers;
@@ -145,9 +232,17 @@ struct objlist {
 	struct section *ol_sections;	/* array of section descriptors */
 	void *ol_aux;			/* aux data (such as phdrs/stab/etc) */
 	int ol_naux;			/* items in the aux data */
+	struct symlist **ol_sidx;	/* symbols by the index in the object */
+	void *ol_syms;			/* symbols staged until merged */
+	u_long ol_nsyms;		/* number of staged symbols */
+	char *ol_stab;			/* staged symbols' names */
+	size_t ol_stabsz;		/* size of the names */
 	int ol_nsect;			/* number of sections */
+	struct objgroup *ol_groups;	/* comdat groups */
+	int ol_ngroups;
 	int ol_flags;
 #define	OBJ_SYSTEM	0x0001
+	int ol_no;			/* number in the incremental state */
 
 	/* sparc v9 ABI */
 	struct symlist *ol_g2;
@@ -164,6 +259,10 @@ struct ldarch {
 	int	la_class;
 	const struct ldorder *la_order;
 	int	(*la_fix)(off_t, struct section *, char *, int);
+	int	(*la_fixone)(char *, uint64_t, int64_t, uint);
+	int	(*la_dbgrel)(u_int);	/* absolute reloc size for debug */
+	int	(*la_branch)(u_int, const u_char *, uint64_t);
+	int	(*la_additive)(u_int);	/* patchable by a delta */
 };
 extern const struct ldarch ldarchs[];
 extern const int ldnarch;
@@ -179,7 +278,8 @@ extern const struct ldarch *ldarch;
 struct ldorder {
 	enum  {
 		ldo_kaput, ldo_option, ldo_expr, ldo_section, ldo_symbol,
-		ldo_interp, ldo_ehfrh, ldo_shstr, ldo_symtab, ldo_strtab
+		ldo_interp, ldo_ehfrh, ldo_shstr, ldo_symtab, ldo_strtab,
+		ldo_reloc
 	}	ldo_order;
 	const char *ldo_name;	/* name of the section or global */
 	int ldo_type;		/* type of the section or global */
@@ -192,7 +292,9 @@ struct ldorder {
 #define	LD_PIE		0x0010	/* for position-independant executables */
 #define	LD_DYNAMIC	0x0020	/* for dynamic executables */
 #define	LD_EXCTBL	0x0040	/* gcc exception table */
+#define	LD_SORTED	0x0080	/* sections sorted (--sort-section) */
 #define	LD_DEBUG	0x0100	/* debugging info (strip w/ -S) */
+#define	LD_ZDEBUG	0x0800	/* debugging info compressed on output */
 #define	LD_CONTAINS	0x0200	/* contents is generated in ldo_wurst */
 #define	LD_SYMTAB	0x0400	/* this is a symtab or relevant section */
 #define	LD_ENTRY	0x1000	/* entry point */
@@ -200,6 +302,9 @@ struct ldorder {
 #define	LD_IGNORE	0x4000	/* ignore this entry and whatever matches */
 #define	LD_USED		0x8000	/* mark all collected sections as used */
 	uint64_t ldo_filler;	/* gap filler */
+	const char * const *ldo_subord;	/* sub-order by the name prefix */
+#define	LD_MAXSUB	8
+	struct section *ldo_sublast[LD_MAXSUB];	/* last in the sub-order */
 
 	TAILQ_HEAD(, section) ldo_seclst;	/* all sections */
 	TAILQ_ENTRY(ldorder) ldo_entry;		/* list of the order */
@@ -212,46 +317,179 @@ struct ldorder {
 	int ldo_sno;		/* section number for this order */
 };
 
+/*
+ * index of the section orders by the name prefix (a trie)
+ * used to pull the input sections into the orders in one pass
+ */
+struct ordtrie {
+	struct ldorder *ot_order;	/* order named up to this node */
+	int ot_child;			/* first child node */
+	int ot_next;			/* next sibling node */
+	u_char ot_c;
+};
+
+struct ordindex {
+	struct ordtrie *oi_trie;	/* root is the first node */
+	int oi_ntrie, oi_maxtrie;
+	struct strtab oi_link1;		/* link-once names pulled in */
+};
+
+/*
+ * incremental link state kept next to the output;
+ * a header followed by the arrays in the order below
+ * and the strings all names are offsets into.
+ * host byte order as it's only ever read back by the same ld.
+ */
+#define	LD_INCR_MAGIC	"LDINCR01"
+#define	LD_INCR_SUFFIX	".ldstate"
+#define	LD_INCR_SLACK(sz)	(((sz) / 16 + 1024 + 15) & ~15ULL)
+
+struct incrhdr {
+	char ih_magic[8];
+	uint64_t ih_args;		/* command line hash */
+	int64_t ih_osize, ih_omtime;	/* output as it was written */
+	uint64_t ih_symoff;		/* output symbol table offset */
+	uint32_t ih_class, ih_mach;
+	uint32_t ih_nobjs, ih_nords, ih_nslots, ih_nsyms, ih_nents, ih_nrels;
+	uint64_t ih_strsz;
+};
+
+/* input object fingerprint */
+struct incrobj {
+	uint32_t io_path, io_name;
+	uint64_t io_off;		/* offset in the archive */
+	int64_t io_size, io_mtime, io_ino;
+};
+
+/* output section with the room left at the end */
+struct incrord {
+	uint32_t ir_name, ir_type;
+	uint64_t ir_off;		/* file offset of the start */
+	uint64_t ir_start, ir_end;	/* addresses used */
+	uint64_t ir_max;		/* end of the room */
+	uint64_t ir_filler;
+};
+
+/* input section placement */
+struct incrslot {
+	uint32_t ic_obj, ic_no, ic_ord, ic_type;
+	uint64_t ic_addr, ic_off, ic_size, ic_align;
+};
+
+/* global symbol; sorted by the name */
+struct incrsym {
+	uint32_t ig_name;
+	int32_t ig_obj;			/* -1 if not from an input */
+	uint64_t ig_value, ig_size;
+	uint32_t ig_info, ig_pad;
+};
+
+/* output symbol table entry */
+struct incrent {
+	uint32_t ie_name, ie_sidx;
+	int32_t ie_obj;
+	uint32_t ie_sect, ie_rank;	/* n-th symbol in the section */
+	uint32_t ie_pad;
+};
+
+/* relocation against a global symbol */
+struct increl {
+	uint64_t il_off;		/* output file offset */
+	uint32_t il_sym, il_type;
+	int32_t il_obj;
+	uint32_t il_pad;
+};
+
+struct incr {
+	struct incrhdr in_hdr;
+	struct incrobj *in_objs;
+	struct incrord *in_ords;
+	struct incrslot *in_slots;
+	struct incrsym *in_syms;
+	struct incrent *in_ents;
+	struct increl *in_rels;
+	char *in_strs;
+	char *in_changed;		/* objects changed since */
+};
+
 extern struct objlist sysobj;
 extern const char *entry_name;
 extern const char *trace_names[];
 extern char *mapfile;
+extern char *symordfile;
 extern struct ldorder *bsorder;
-extern int Xflag, errors, printmap, cref, relocatable, strip, warncomm;
+extern int Xflag, dflag, errors, printmap, cref, relocatable, strip,
+    warncomm;
 extern int machine, endian, elfclass, magic, pie, Bflag, gc_sections;
+extern int print_gc_sections, icf, print_icf_sections, incremental;
+extern int lowmem, eh_frame_hdr;
+extern uint64_t incr_args;
+#define	LD_ICF_SAFE	1	/* fold only if the address is not taken */
+#define	LD_ICF_ALL	2
+extern int sort_section;
+extern uint64_t sort_before, sort_after;
+#define	LD_SORT_ALIGN	1	/* the most aligned first */
+#define	LD_SORT_NAME	2
+#define	LD_SORT_ALIGNNAME 3	/* by the alignment then by the name */
+#define	LD_SORT_NAMEALIGN 4
 extern u_int64_t start_text, start_data, start_bss;
+extern const char * const ld_textsub[], * const ld_datasub[];
 extern const struct ldorder
     alpha_order[], amd64_order[], arm_order[], hppa_order[],
     i386_order[], m68k_order[], mips_order[], ppc_order[],
     sh_order[], sparc_order[], sparc64_order[], vax_order[];
 int amd64_fix(off_t, struct section *, char *, int);
 int amd64_fixone(char *, uint64_t, int64_t, uint);
+int amd64_dbgrel(u_int);
+int amd64_branch(u_int, const u_char *, uint64_t);
+int amd64_additive(u_int);
 int arm_fix(off_t, struct section *, char *, int);
 int arm_fixone(char *, uint64_t, int64_t, uint);
+int arm_dbgrel(u_int);
+int arm_branch(u_int, const u_char *, uint64_t);
+int arm_additive(u_int);
 int hppa_fix(off_t, struct section *, char *, int);
 int hppa_fixone(char *, uint64_t, int64_t, uint);
+int hppa_dbgrel(u_int);
+int hppa_branch(u_int, const u_char *, uint64_t);
+int hppa_additive(u_int);
 int i386_fix(off_t, struct section *, char *, int);
 int i386_fixone(char *, uint64_t, int64_t, uint);
+int i386_dbgrel(u_int);
+int i386_branch(u_int, const u_char *, uint64_t);
+int i386_additive(u_int);
 int sparc64_fix(off_t, struct section *, char *, int);
 int sparc64_fixone(char *, uint64_t, int64_t, uint);
+int sparc64_dbgrel(u_int);
+int sparc64_branch(u_int, const u_char *, uint64_t);
+int sparc64_additive(u_int);
 
 const struct ldarch *ldinit(void);
 int obj_foreach(int (*)(struct objlist *, void *), void *);
+int obj_groups(struct objlist *, int);
+struct objlist *obj_new(const char *, const char *, off_t);
+void obj_loadv(struct objlist **, int, int);
+int obj_merge(struct objlist *, struct objlist *);
 struct headorder *elf_gcs(struct headorder *);
 
 /* ld2.c */
-int uLD32(const char *, char *, int *, int);
-int uLD64(const char *, char *, int *, int);
+#define	LD_ULD_NIOV	3	/* ranges of the uLD output */
+int uLD32(const char *, char *, size_t, struct iovec *, int *, int);
+int uLD64(const char *, char *, size_t, struct iovec *, int *, int);
 struct symlist *elf32_absadd(const char *, int);
 struct symlist *elf64_absadd(const char *, int);
 int elf32_symadd(struct elf_symtab *, int, void *, void *);
 int elf64_symadd(struct elf_symtab *, int, void *, void *);
-int elf32_loadrelocs(struct objlist *, struct section *, Elf32_Shdr *,
-    FILE *, off_t);
-int elf64_loadrelocs(struct objlist *, struct section *, Elf64_Shdr *,
-    FILE *, off_t);
-int elf32_objadd(struct objlist *, FILE *, off_t);
-int elf64_objadd(struct objlist *, FILE *, off_t);
+int elf32_loadrelocs(struct objlist *, struct section *, Elf32_Shdr *);
+int elf64_loadrelocs(struct objlist *, struct section *, Elf64_Shdr *);
+int elf32_objhead(struct objlist *, FILE *, off_t);
+int elf64_objhead(struct objlist *, FILE *, off_t);
+int elf32_objload(struct objlist *, FILE *, off_t);
+int elf64_objload(struct objlist *, FILE *, off_t);
+void elf32_relload(struct section **, size_t);
+void elf64_relload(struct section **, size_t);
+int elf32_objmerge(struct objlist *);
+int elf64_objmerge(struct objlist *);
 int ld32order_obj(struct objlist *, void *);
 int ld64order_obj(struct objlist *, void *);
 struct ldorder *ldmap32(struct headorder *);
@@ -265,18 +503,91 @@ int ldloadasect64(FILE *, FILE *, const char *, const struct ldorder *, struct s
 int elf32_ld_chkhdr(const char *, Elf32_Ehdr *, int, int *, int *, int *);
 int elf64_ld_chkhdr(const char *, Elf64_Ehdr *, int, int *, int *, int *);
 
+int elf32_incrsave(const char *, struct ldorder *);
+int elf64_incrsave(const char *, struct ldorder *);
+int elf32_incrlink(const char *, struct incr *);
+int elf64_incrlink(const char *, struct incr *);
+
+/* buildid.c */
+#define	LD_BUILDID_FAST	1
+#define	LD_BUILDID_SHA1	2
+#define	LD_BUILDID_CHUNK 0x100000	/* hashed by a worker at a time */
+#define	LD_BUILDID_MAX	20	/* longest id (sha1) */
+extern int build_id;
+size_t buildid_len(void);
+void buildid_hash(const char *, int, uint64_t, u_char *);
+
+/* incr.c */
+uint64_t incr_hash(int, char **);
+int incr_relink(const char *);
+int incr_write(const char *, struct incr *);
+void incr_free(struct incr *);
+int incr_stat(const char *, int64_t *, int64_t *, int64_t *);
+int incr_samename(const char *, const char *);
+
+/* zdebug.c */
+#define	LD_ZDEBUG_ZLIB	1
+#define	LD_ZDEBUG_CHUNK	0x40000	/* deflated by a worker at a time */
+extern int compress_debug;
+u_char *zdebug_deflate(const u_char *, size_t, size_t, size_t *);
+
+/* pool.c */
+extern int nthreads;
+int pool_size(void);
+void pool_run(int, void (*)(void *, int, int), void *);
+
+/* stats.c */
+#define	LD_ST_OBJS	0	/* objects loaded */
+#define	LD_ST_MEMBERS	1	/* archive members pulled in */
+#define	LD_ST_SYMS	2	/* input symbols */
+#define	LD_ST_RELS	3	/* input relocations */
+#define	LD_ST_READ	4	/* bytes read from the input */
+#define	LD_ST_WRITTEN	5	/* bytes written to the output */
+#define	LD_ST_NCOUNT	6
+#define	LD_ST_DEPTH	16	/* phases nesting limit */
+extern int stats;
+extern char *tracefile;
+void stat_init(void);
+void stat_begin(const char *);
+void stat_end(void);
+void stat_count(int, uint64_t);
+void stat_report(void);
+
 /* syms.c */
+extern u_long sym_undgen;
+struct symlist *sym_new(const char *);
+struct symlist *sym_get(uint32_t);
+const char *sym_name(const char *);
+struct xrefhead *sym_xref(struct symlist *);
+uint32_t *sym_idx(struct symlist *);
+void sym_qadd(struct symq *, struct symlist *);
+void sym_qdel(struct symq *, struct symlist *);
+void sym_rename(struct symlist *, const char *);
 struct symlist *sym_undef(const char *);
 struct symlist *sym_isundef(const char *);
 struct symlist *sym_define(struct symlist *, struct section *, void *);
 struct symlist *sym_redef(struct symlist *, struct section *, void *);
 struct symlist *sym_add(const char *, struct section *, void *);
 struct symlist *sym_isdefined(const char *, struct section *);
+int sym_foreach(int (*)(struct symlist *, void *), void *);
+int sym_undforeach(int (*)(struct symlist *, void *), void *);
 void sym_remove(struct symlist *);
 void sym_scan(const struct ldorder *, ordprint_t, symprint_t, void *);
 int sym_undcheck(void);
-int rel_addrcmp(const void *, const void *);
+void rel_sort(struct relist *, size_t);
+void strtab_init(struct strtab *);
+uint32_t strtab_hash(const char *, size_t *);
+u_int strtab_add(struct strtab *, const char *);
+u_int strtab_addh(struct strtab *, const char *, uint32_t, size_t);
+size_t strtab_finish(struct strtab *);
+size_t strtab_off(const struct strtab *, u_int);
+void strtab_write(const struct strtab *, char *);
+void strtab_free(struct strtab *);
 struct ldorder *order_clone(const struct ldarch *, const struct ldorder *);
+int order_subrank(const struct ldorder *, const char *);
+struct objlist *comdat_claim(const char *, struct objlist *, int);
+void order_index(struct ordindex *, struct ldorder *);
+struct ldorder *order_find(const struct ordindex *, const char *);
 void sym_printmap(struct headorder *, ordprint_t, symprint_t);
 int order_printmap(const struct ldorder *, void *);
 int randombit(void);
@@ -22,10 +22,14 @@ static const char rcsid[] =
 
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <elf_abi.h>
+#include <dwarf.h>
 #include <elfuncs.h>
 #include <a.out.h>
 #include <nlist.h>
@@ -52,6 +56,8 @@ static const char rcsid[] =
 #define	elf_fix_sym	elf32_fix_sym
 #define	elf_fix_rel	elf32_fix_rel
 #define	elf_fix_rela	elf32_fix_rela
+#define	elf_fix_rels	elf32_fix_rels
+#define	elf_fix_relas	elf32_fix_relas
 #define	elf2nlist	elf32_2nlist
 #define	elf_load_shdrs	elf32_load_shdrs
 #define	elf_save_shdrs	elf32_save_shdrs
@@ -59,17 +65,63 @@ static const char rcsid[] =
 #define	elf_fix_shdrs	elf32_fix_shdrs
 #define	elf_symload	elf32_symload
 #define	elf_loadrelocs	elf32_loadrelocs
-#define	elf_addreloc	elf32_addreloc
+#define	elf_readrelocs	elf32_readrelocs
+#define	elf_relload	elf32_relload
+#define	elf_relloadone	elf32_relloadone
+#define	elf_relloadcmp	elf32_relloadcmp
+#define	elf_relorder	elf32_relorder
+#define	elf_relget	elf32_relget
+#define	elf_relput	elf32_relput
 #define	elf_absadd	elf32_absadd
 #define	elf_symadd	elf32_symadd
-#define	elf_objadd	elf32_objadd
+#define	elf_objhead	elf32_objhead
+#define	elf_objgroup	elf32_objgroup
+#define	elf_objload	elf32_objload
+#define	elf_objmerge	elf32_objmerge
+#define	elf_symstage	elf32_symstage
 #define	elf_commons	elf32_commons
+#define	elf_merge	elf32_merge
+#define	elf_mergeload	elf32_mergeload
+#define	elf_mergeoff	elf32_mergeoff
+#define	elf_mergefix	elf32_mergefix
+#define	elf_mergerel	elf32_mergerel
+#define	elf_icf		elf32_icf
+#define	elf_icfaddr	elf32_icfaddr
+#define	elf_icfload	elf32_icfload
+#define	elf_icfhash	elf32_icfhash
+#define	elf_icffix	elf32_icffix
+#define	elf_sortpad	elf32_sortpad
+#define	elf_sortcmp	elf32_sortcmp
+#define	elf_sortsect	elf32_sortsect
+#define	elf_ehfrscan	elf32_ehfrscan
+#define	elf_ehfrsect	elf32_ehfrsect
+#define	elf_ehfrcmp	elf32_ehfrcmp
+#define	elf_ehfrfill	elf32_ehfrfill
+#define	elf_buildidnote	elf32_buildidnote
+#define	elf_zdebug	elf32_zdebug
+#define	elf_dbgfix	elf32_dbgfix
 #define	elf_symprintmap	elf32_symprintmap
-#define	elf_symrec	elf32_symrec
-#define	elf_symwrite	elf32_symwrite
-#define	elf_names	elf32_names
+#define	elf_symlayout	elf32_symlayout
+#define	elf_symcount	elf32_symcount
+#define	elf_symhash	elf32_symhash
+#define	elf_symnames	elf32_symnames
+#define	elf_symfill	elf32_symfill
+#define	elf_symout	elf32_symout
+#define	elf_relsym	elf32_relsym
+#define	elf_relscan	elf32_relscan
+#define	elf_relabs	elf32_relabs
+#define	elf_relund	elf32_relund
+#define	elf_relsyms	elf32_relsyms
+#define	elf_relsymwrite	elf32_relsymwrite
+#define	elf_relwrite	elf32_relwrite
 #define	elf_prefer	elf32_prefer
 #define	elf_seek	elf32_seek
+#define	elf_fill	elf32_fill
+#define	elf_incrobj	elf32_incrobj
+#define	elf_incrglob	elf32_incrglob
+#define	elf_incrent	elf32_incrent
+#define	elf_incrsave	elf32_incrsave
+#define	elf_incrlink	elf32_incrlink
 #elif ELFSIZE == 64
 #define	ELF_ADDRALIGN	8
 #define	ELF_HDR(h)	((h).elf64)
@@ -87,6 +139,8 @@ static const char rcsid[] =
 #define	elf_fix_sym	elf64_fix_sym
 #define	elf_fix_rel	elf64_fix_rel
 #define	elf_fix_rela	elf64_fix_rela
+#define	elf_fix_rels	elf64_fix_rels
+#define	elf_fix_relas	elf64_fix_relas
 #define	elf2nlist	elf64_2nlist
 #define	elf_load_shdrs	elf64_load_shdrs
 #define	elf_save_shdrs	elf64_save_shdrs
@@ -94,35 +148,173 @@ static const char rcsid[] =
 #define	elf_fix_shdrs	elf64_fix_shdrs
 #define	elf_symload	elf64_symload
 #define	elf_loadrelocs	elf64_loadrelocs
-#define	elf_addreloc	elf64_addreloc
+#define	elf_readrelocs	elf64_readrelocs
+#define	elf_relload	elf64_relload
+#define	elf_relloadone	elf64_relloadone
+#define	elf_relloadcmp	elf64_relloadcmp
+#define	elf_relorder	elf64_relorder
+#define	elf_relget	elf64_relget
+#define	elf_relput	elf64_relput
 #define	elf_absadd	elf64_absadd
 #define	elf_symadd	elf64_symadd
-#define	elf_objadd	elf64_objadd
+#define	elf_objhead	elf64_objhead
+#define	elf_objgroup	elf64_objgroup
+#define	elf_objload	elf64_objload
+#define	elf_objmerge	elf64_objmerge
+#define	elf_symstage	elf64_symstage
 #define	elf_commons	elf64_commons
+#define	elf_merge	elf64_merge
+#define	elf_mergeload	elf64_mergeload
+#define	elf_mergeoff	elf64_mergeoff
+#define	elf_mergefix	elf64_mergefix
+#define	elf_mergerel	elf64_mergerel
+#define	elf_icf		elf64_icf
+#define	elf_icfaddr	elf64_icfaddr
+#define	elf_icfload	elf64_icfload
+#define	elf_icfhash	elf64_icfhash
+#define	elf_icffix	elf64_icffix
+#define	elf_sortpad	elf64_sortpad
+#define	elf_sortcmp	elf64_sortcmp
+#define	elf_sortsect	elf64_sortsect
+#define	elf_ehfrscan	elf64_ehfrscan
+#define	elf_ehfrsect	elf64_ehfrsect
+#define	elf_ehfrcmp	elf64_ehfrcmp
+#define	elf_ehfrfill	elf64_ehfrfill
+#define	elf_buildidnote	elf64_buildidnote
+#define	elf_zdebug	elf64_zdebug
+#define	elf_dbgfix	elf64_dbgfix
 #define	elf_symprintmap	elf64_symprintmap
-#define	elf_symrec	elf64_symrec
-#define	elf_symwrite	elf64_symwrite
-#define	elf_names	elf64_names
+#define	elf_symlayout	elf64_symlayout
+#define	elf_symcount	elf64_symcount
+#define	elf_symhash	elf64_symhash
+#define	elf_symnames	elf64_symnames
+#define	elf_symfill	elf64_symfill
+#define	elf_symout	elf64_symout
+#define	elf_relsym	elf64_relsym
+#define	elf_relscan	elf64_relscan
+#define	elf_relabs	elf64_relabs
+#define	elf_relund	elf64_relund
+#define	elf_relsyms	elf64_relsyms
+#define	elf_relsymwrite	elf64_relsymwrite
+#define	elf_relwrite	elf64_relwrite
 #define	elf_prefer	elf64_prefer
 #define	elf_seek	elf64_seek
+#define	elf_fill	elf64_fill
+#define	elf_incrobj	elf64_incrobj
+#define	elf_incrglob	elf64_incrglob
+#define	elf_incrent	elf64_incrent
+#define	elf_incrsave	elf64_incrsave
+#define	elf_incrlink	elf64_incrlink
 #else
 #error "Unsupported ELF class"
 #endif
 
-int elf_commons(struct objlist *, void *);
+/* the output symbol table; see elf_symlayout() */
+struct symsect {
+	const struct ldorder *ss_order;
+	struct section *ss_os;
+	size_t ss_first;		/* first symbol index less the null one */
+	size_t ss_nsyms;
+};
+
+struct symout {
+	struct symsect *so_sects;	/* sections having any symbols */
+	size_t so_nsects;
+	struct symlist **so_syms;	/* in the output order */
+	uint32_t *so_hash;		/* name hashes */
+	size_t *so_len;			/* name lengths */
+	size_t so_nsyms;
+	struct strtab so_names;
+	char *so_buf;			/* the table being filled in */
+};
 
-int elf_symrec(const struct ldorder *, const struct section *,
-    struct symlist *, void *);
-int elf_names(const struct ldorder *, const struct section *,
+/*
+ * a section being sorted; the rank keeps the sub-orders apart
+ * and the number keeps the sort stable
+ */
+struct sortkey {
+	struct section *sk_os;
+	int sk_rank;
+	size_t sk_no;
+};
+
+/*
+ * the fdes from .eh_frame for the .eh_frame_hdr search table
+ */
+struct ehfde {
+	struct section *ef_os;		/* the .eh_frame it is in */
+	uint64_t ef_off;		/* offset in there */
+	struct symlist *ef_sym;		/* the code it describes */
+	int64_t ef_addend;
+	uint64_t ef_pc;			/* initial location once mapped */
+	uint64_t ef_addr;		/* fde address once mapped */
+};
+
+struct ehframe {
+	struct ldorder *ehf_hdr;	/* .eh_frame_hdr */
+	struct ldorder *ehf_frame;	/* .eh_frame */
+	struct ehfde *ehf_fdes;
+	size_t ehf_nfdes, ehf_maxfdes;
+};
+
+int elf_commons(struct objlist *, void *);
+void elf_merge(struct headorder *);
+void elf_mergeload(void *, int, int);
+uint64_t elf_mergeoff(struct section *, int64_t);
+int elf_mergefix(struct objlist *, void *);
+int64_t elf_mergerel(struct section *, const struct relist *,
+    struct section *, int, uint8_t **);
+void elf_icf(struct headorder *);
+int elf_icfaddr(struct objlist *, void *);
+void elf_icfload(void *, int, int);
+void elf_icfhash(void *, int, int);
+int elf_icffix(struct objlist *, void *);
+uint64_t elf_sortpad(struct sortkey *, size_t);
+int elf_sortcmp(const void *, const void *);
+void elf_sortsect(struct headorder *);
+struct ehframe *elf_ehfrscan(struct headorder *);
+int elf_ehfrsect(struct ehframe *, struct section *, const uint8_t *);
+int elf_ehfrcmp(const void *, const void *);
+void elf_ehfrfill(struct ehframe *);
+void elf_buildidnote(struct headorder *);
+int elf_zdebug(const char *, struct ldorder *);
+int elf_dbgfix(const struct ldorder *, off_t, struct section *, char *, int);
+int elf_incrobj(struct objlist *, void *);
+int elf_incrglob(struct symlist *, void *);
+int elf_incrent(const struct ldorder *, const struct section *,
     struct symlist *, void *);
+
+int elf_symlayout(struct headorder *, struct symout *);
+void elf_symcount(void *, int, int);
+void elf_symhash(void *, int, int);
+void elf_symnames(void *, int, int);
+void elf_symfill(void *, int, int);
+void elf_symout(FILE *, const char *, const struct ldorder *);
 int elf_symprintmap(const struct ldorder *, const struct section *,
     struct symlist *, void *);
-int elf_symwrite(const struct ldorder *, const struct section *,
+struct relsyms;
+void elf_relsym(struct relsyms *, struct symlist *);
+int elf_relscan(const struct ldorder *, const struct section *,
     struct symlist *, void *);
+int elf_relabs(struct symlist *, void *);
+int elf_relund(struct symlist *, void *);
+void elf_relsyms(struct headorder *, struct ldorder *, struct ldorder *);
+void elf_relsymwrite(FILE *, const char *, const struct ldorder *);
+void elf_relwrite(FILE *, const char *, const struct ldorder *);
+struct relist *elf_readrelocs(struct objlist *, struct section *, Elf_Shdr *,
+    int, off_t, size_t *);
+int elf_loadrelocs(struct objlist *, struct section *, Elf_Shdr *);
+int elf_relloadcmp(const void *, const void *);
+void elf_relloadone(void *, int, int);
+void elf_relorder(struct headorder *);
+struct relist *elf_relget(struct section *, int);
+void elf_relput(struct section *);
 Elf_Off elf_prefer(Elf_Off, struct ldorder *, uint64_t);
 int elf_seek(FILE *, off_t, uint64_t);
-int elf_addreloc(struct objlist *, struct section *, struct relist *,
-    Elf_Rel *, uint64_t);
+int elf_fill(FILE *, off_t, uint64_t, uint64_t);
+int elf_symstage(struct elf_symtab *, int, void *, void *);
+int elf_objgroup(struct objlist *, struct objgroup *, Elf_Shdr *, FILE *,
+    off_t);
 
 /*
  * map all the objects into the loading order;
@@ -139,9 +331,13 @@ ldmap(struct headorder *headorder)
 	Elf_Phdr *phdr;
 	Elf_Shdr *shdr;
 	Elf_Sym *esym;
-	uint64_t point, align;
-	Elf_Off off;
-	int nsect, nphdr, nnames[2];
+	uint64_t point, zpoint = 0, align;
+	Elf_Off off, zoff = 0;
+	struct symout *so = NULL;
+	struct ldorder *symord, *strord;
+	struct ehframe *ehf;
+	size_t nrels;
+	int nsect, nphdr;
 
 	eh = &ELF_HDR(sysobj.ol_hdr);
 	eh->e_ident[EI_MAG0] = ELFMAG0;
@@ -157,17 +353,57 @@ ldmap(struct headorder *headorder)
 	eh->e_machine = machine;
 	eh->e_version = EV_CURRENT;
 
-	/* assign commons */
-	obj_foreach(elf_commons, NULL);
+	/* assign commons; the relocatable output leaves them be */
+	if (!relocatable || dflag)
+		obj_foreach(elf_commons, NULL);
 
-	if (gc_sections)
+	if (gc_sections) {
+		stat_begin("elf_gcs");
 		headorder = elf_gcs(headorder);
+		stat_end();
+	}
+
+	/* the relocations for what is left; lowmem reads them late */
+	if (!lowmem) {
+		stat_begin("elf_relload");
+		elf_relorder(headorder);
+		stat_end();
+	}
+
+	/* fold the mergeable sections; only the final link can */
+	if (!relocatable) {
+		stat_begin("elf_merge");
+		elf_merge(headorder);
+		stat_end();
+	}
+
+	/* fold the identical functions */
+	if (icf && !relocatable) {
+		stat_begin("elf_icf");
+		elf_icf(headorder);
+		stat_end();
+	}
+
+	if (sort_section)
+		elf_sortsect(headorder);
+
+	/* the unwinders search the fdes thru the .eh_frame_hdr */
+	ehf = NULL;
+	if (eh_frame_hdr && !relocatable) {
+		stat_begin("eh_frame_hdr");
+		ehf = elf_ehfrscan(headorder);
+		stat_end();
+	}
+
+	if (!relocatable)
+		elf_buildidnote(headorder);
 
 	/*
 	 * stroll through the order counting {e,p,s}hdrs;
 	 */
 	shdr = sysobj.ol_sects;
 	sysobj.ol_sections[0].os_sect = shdr++;
+	symord = strord = NULL;
 	for (nsect = 1, nphdr = 0, ord = TAILQ_FIRST(headorder);
 	    ord != TAILQ_END(headorder); ord = next) {
 
@@ -176,31 +412,52 @@ ldmap(struct headorder *headorder)
 		    ord->ldo_order == ldo_expr)
 			continue;
 
-		if (ord->ldo_order == ldo_symtab) {
+		if (relocatable && ord->ldo_order == ldo_symtab) {
+			/* sized in elf_relsyms() once all are numbered */
+			symord = ord;
+			ord->ldo_wsize = sizeof *esym;
+		} else if (relocatable && ord->ldo_order == ldo_strtab) {
+			strord = ord;
+			ord->ldo_wsize = 1;
+		} else if (ord->ldo_order == ldo_symtab) {
 			/*
 			 * at this point we cannot have any more
 			 * symbols defined and thus can generate the strtab
 			 */
-			/* count names and assign st_names */
-			nnames[0] = 0;
-			nnames[1] = 1;
-			sym_scan(TAILQ_FIRST(headorder), NULL, elf_symrec,
-			    nnames);
-			ord->ldo_wsize = nnames[0] + sizeof *esym;
+			/* count symbols and collect the names */
+			stat_begin("symtab");
+			if (!(so = calloc(1, sizeof *so)))
+				err(1, "calloc");
+			elf_symlayout(headorder, so);
+			ord->ldo_wsize = (so->so_nsyms + 1) * sizeof *esym;
+			ord->ldo_wurst = so;
+			stat_end();
 		} else if (ord->ldo_order == ldo_strtab) {
+			/* lay out the merged strings and assign st_names */
+			stat_begin("strtab");
 			ord->ldo_start = 0;
-			ord->ldo_addr = 1;
-			ord->ldo_wsize = ALIGN(nnames[1]);
-			if (!(ord->ldo_wurst = malloc(ord->ldo_wsize)))
-				err(1, "malloc");
-			*(char *)ord->ldo_wurst = '\0';
-			sym_scan(TAILQ_FIRST(headorder), NULL, elf_names, ord);
+			ord->ldo_addr = strtab_finish(&so->so_names);
+			ord->ldo_wsize = ALIGN(ord->ldo_addr);
+			if (!(ord->ldo_wurst = calloc(1, ord->ldo_wsize)))
+				err(1, "calloc");
+			strtab_write(&so->so_names, ord->ldo_wurst);
+			pool_run(so->so_nsects, elf_symnames, so);
+			strtab_free(&so->so_names);
+			stat_end();
+		} else if (ord->ldo_order == ldo_reloc) {
+			nrels = 0;
+			TAILQ_FOREACH(os, &((struct ldorder *)ord->ldo_wurst)->
+			    ldo_seclst, os_entry)
+				nrels += os->os_nrls;
+			ord->ldo_wsize = nrels * (ord->ldo_type == SHT_RELA?
+			    sizeof(Elf_RelA) : sizeof(Elf_Rel));
 		} else if (ord->ldo_order == ldo_expr)
 			continue;
 
 		/* skip empty sections */
 		if (TAILQ_EMPTY(&ord->ldo_seclst) &&
-		    !((ord->ldo_flags & LD_CONTAINS) && ord->ldo_wsize)) {
+		    !((ord->ldo_flags & LD_CONTAINS ||
+		     ord->ldo_order == ldo_reloc) && ord->ldo_wsize)) {
 			TAILQ_REMOVE(headorder, ord, ldo_entry);
 			continue;
 		}
@@ -212,11 +469,21 @@ ldmap(struct headorder *headorder)
 		shdr->sh_type = ord->ldo_type;
 		shdr->sh_flags = ord->ldo_shflags;
 		shdr->sh_addralign = ELF_ADDRALIGN;
+		/* notes are packed by four in either class */
+		if (ord->ldo_type == SHT_NOTE)
+			shdr->sh_addralign = 4;
 		if (ord->ldo_type == SHT_SYMTAB ||
 		    ord->ldo_type == SHT_DYNSYM) {
 			shdr->sh_link = nsect;
 			shdr->sh_entsize = sizeof *esym;
 		}
+		if (ord->ldo_order == ldo_reloc) {
+			/* sh_link is set once the symtab is numbered */
+			shdr->sh_info =
+			    ((struct ldorder *)ord->ldo_wurst)->ldo_sno;
+			shdr->sh_entsize = ord->ldo_type == SHT_RELA?
+			    sizeof(Elf_RelA) : sizeof(Elf_Rel);
+		}
 
 		if (shdr->sh_flags & SHF_ALLOC &&
 		    (shdr->sh_type != shdr[-1].sh_type ||
@@ -226,15 +493,37 @@ ldmap(struct headorder *headorder)
 		shdr++;
 	}
 
-	if (nsect == 1 || !nphdr)
+	/* relocatable output is not to be loaded */
+	if (relocatable)
+		nphdr = 0;
+	else if (!nphdr)
+		errx(1, "output headers botch");
+	else if (ehf)
+		nphdr++;	/* PT_GNU_EH_FRAME */
+	if (nsect == 1)
 		errx(1, "output headers botch");
 	sysobj.ol_nsect = nsect;
 
-	if (!(phdr = calloc(nphdr, sizeof *phdr)))
+	if (relocatable) {
+		if (!symord || !strord)
+			errx(1, "relocatable output needs the symbol table");
+
+		stat_begin("symtab");
+		elf_relsyms(headorder, symord, strord);
+		stat_end();
+
+		TAILQ_FOREACH(ord, headorder, ldo_entry)
+			if (ord->ldo_order == ldo_reloc)
+				((Elf_Shdr *)ord->ldo_sect->os_sect)->sh_link =
+				    symord->ldo_sno;
+	}
+
+	phdr = NULL;
+	if (nphdr && !(phdr = calloc(nphdr, sizeof *phdr)))
 		err(1, "calloc");
 	sysobj.ol_aux = phdr;
 
-	eh->e_phoff = sizeof *eh;
+	eh->e_phoff = nphdr? sizeof *eh : 0;
 	eh->e_flags = 0;
 	eh->e_ehsize = sizeof *eh;
 	eh->e_phentsize = sizeof *phdr;
@@ -263,7 +552,38 @@ ldmap(struct headorder *headorder)
 		case ldo_section:
 			/* this is the output section header */
 			shdr = ord->ldo_sect->os_sect;
-			shdr->sh_offset = off = elf_prefer(off, ord, point);
+			if (compress_debug && !relocatable &&
+			    (ord->ldo_flags & LD_DEBUG))
+				ord->ldo_flags |= LD_ZDEBUG;
+			if (relocatable ||
+			    (ord->ldo_flags & (LD_SORTED | LD_DEBUG))) {
+				/* start at the largest alignment inside */
+				align = relocatable? 1 : shdr->sh_addralign;
+				TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry)
+					if (align < ((Elf_Shdr *)
+					    os->os_sect)->sh_addralign)
+						align = ((Elf_Shdr *)
+						    os->os_sect)->sh_addralign;
+				shdr->sh_addralign = align;
+			}
+			if (relocatable) {
+				/* sections start at zero and align as needed */
+				shdr->sh_offset = off = roundup(off, align);
+				ord->ldo_addr = 0;
+			} else if (ord->ldo_flags & LD_ZDEBUG) {
+				/* laid out in memory and placed once compressed */
+				zoff = off;
+				zpoint = point;
+				shdr->sh_offset = off = 0;
+				ord->ldo_addr = 0;
+			} else if (ord->ldo_flags & LD_DEBUG) {
+				/* not loaded; addresses are the offsets inside */
+				zpoint = point;
+				shdr->sh_offset = off = roundup(off, align);
+				ord->ldo_addr = 0;
+			} else
+				shdr->sh_offset =
+				    off = elf_prefer(off, ord, point);
 
 			ord->ldo_start = ord->ldo_addr;
 			/* roll thru all sections and map the symbols */
@@ -280,16 +600,24 @@ ldmap(struct headorder *headorder)
 					    ord->ldo_addr - ord->ldo_start;
 
 				/* assign addrs to all syms in this section */
-				TAILQ_FOREACH(sym, &os->os_syms, sl_entry) {
+				SYMQ_FOREACH(sym, &os->os_syms) {
 					esym = &ELF_SYM(sym->sl_elfsym);
 					esym->st_value += shdr->sh_addr;
 				}
 				ord->ldo_addr += shdr->sh_size;
 			}
+			/* leave room for the sections to grow */
+			if (incremental)
+				ord->ldo_addr +=
+				    LD_INCR_SLACK(ord->ldo_addr - ord->ldo_start);
 			point = ord->ldo_addr;
 			shdr = ord->ldo_sect->os_sect;
 			if (shdr->sh_type != SHT_NOBITS)
 				off += ord->ldo_addr - ord->ldo_start;
+			if (ord->ldo_flags & LD_ZDEBUG)
+				off = zoff;
+			if (!relocatable && (ord->ldo_flags & LD_DEBUG))
+				point = zpoint;
 			break;
 
 		case ldo_symbol:
@@ -300,12 +628,23 @@ ldmap(struct headorder *headorder)
 			ord->ldo_addr = point;
 			break;
 
+		case ldo_reloc:
+		case ldo_symtab:
+			if (relocatable)
+				off = roundup(off, ELF_ADDRALIGN);
+			/* FALLTHROUGH */
 		case ldo_interp:
 		case ldo_ehfrh:
-		case ldo_symtab:
 		case ldo_strtab:
 			/* this is the output section header */
 			shdr = ord->ldo_sect->os_sect;
+			/* the unwinders read the table in place */
+			if (ord->ldo_order == ldo_ehfrh) {
+				shdr->sh_addralign = 4;
+				align = roundup(point, 4) - point;
+				point += align;
+				off += align;
+			}
 			ord->ldo_start =
 			ord->ldo_addr = point;
 			point =
@@ -342,7 +681,7 @@ ldmap(struct headorder *headorder)
 
 				shdr = sord->ldo_sect->os_sect;
 				shdr->sh_name = p - q;
-				n = sord->ldo_wsize - (p - q);
+				n = ord->ldo_wsize - (p - q);
 				p += strlcpy(p, sord->ldo_name, n) + 1;
 			}
 			shdr = ord->ldo_sect->os_sect;
@@ -353,7 +692,7 @@ ldmap(struct headorder *headorder)
 			err(1, "kaputziener");
 		}
 
-		if (shdr && (shdr->sh_flags & SHF_ALLOC)) {
+		if (nphdr && shdr && (shdr->sh_flags & SHF_ALLOC)) {
 			if (shdr->sh_type != shdr[-1].sh_type ||
 			    shdr->sh_flags != shdr[-1].sh_flags) {
 				if (shdr[-1].sh_type != SHT_NULL) {
@@ -385,9 +724,28 @@ ldmap(struct headorder *headorder)
 		}
 	}
 
+	if (ehf) {
+		ord = ehf->ehf_hdr;
+		shdr = ord->ldo_sect->os_sect;
+		phdr++;
+		phdr->p_type = PT_GNU_EH_FRAME;
+		phdr->p_flags = PF_R;
+		phdr->p_offset = shdr->sh_offset;
+		phdr->p_vaddr = ord->ldo_start;
+		phdr->p_paddr = ord->ldo_start;
+		phdr->p_filesz =
+		phdr->p_memsz = ord->ldo_addr - ord->ldo_start;
+		phdr->p_align = 4;
+		elf_ehfrfill(ehf);
+	}
+
 	if (printmap)
 		sym_printmap(headorder, order_printmap, elf_symprintmap);
 
+	/* undefined are left for the final link */
+	if (relocatable)
+		return TAILQ_FIRST(headorder);
+
 	if (sym_undcheck())
 		return NULL;
 
@@ -459,12 +817,13 @@ elf_absadd(const char *name, int bind)
 }
 
 /*
- * select needed section from the object for this order
+ * pull the sections of the object into their orders
  */
 int
 ldorder_obj(struct objlist *ol, void *v)
 {
-	struct ldorder *neworder = v;
+	struct ordindex *oi = v;
+	struct ldorder *neworder;
 	Elf_Shdr *shdr = ol->ol_sects;
 	struct section *os = ol->ol_sections;
 	int i, n;
@@ -475,7 +834,8 @@ ldorder_obj(struct objlist *ol, void *v)
 
 	n = ol->ol_nsect;
 	for (i = 0; i < n; i++, os++, shdr++) {
-		if (shdr->sh_type == SHT_NULL)
+		if (shdr->sh_type == SHT_NULL ||
+		    (os->os_flags & SECTION_DISCARD))
 			continue;
 
 		/*
@@ -483,8 +843,7 @@ ldorder_obj(struct objlist *ol, void *v)
 		 * this means .rodata will also pull .rodata.str
 		 * and .bss will pull .bss.emergency_buffer ...
 		 */
-		if (strncmp(os->os_name, neworder->ldo_name,
-		    strlen(neworder->ldo_name)))
+		if (!(neworder = order_find(oi, os->os_name)))
 			continue;
 
 		/*
@@ -498,15 +857,31 @@ TODO
 		os->os_flags |= SECTION_ORDER;
 		/* check if we already got one of these */
 		if (neworder->ldo_flags & LD_LINK1) {
-			struct section *ss;
-			/* TODO optimise linear search */
-			TAILQ_FOREACH(ss, &neworder->ldo_seclst, os_entry)
-				if (!strcmp(os->os_name, ss->os_name))
-					break;
-			if (ss != TAILQ_END(&neworder->ldo_seclst))
+			u_long nnames = oi->oi_link1.st_nents;
+
+			/* the string table is the set of names seen */
+			strtab_add(&oi->oi_link1, os->os_name);
+			if (oi->oi_link1.st_nents == nnames)
 				continue;
 		}
-		TAILQ_INSERT_TAIL(&neworder->ldo_seclst, os, os_entry);
+		if (neworder->ldo_subord) {
+			struct section *ss;
+			int r, k;
+
+			/* follow the last one in this or earlier sub-order */
+			r = order_subrank(neworder, os->os_name);
+			for (k = r, ss = NULL; k >= 0 && !ss; k--)
+				ss = neworder->ldo_sublast[k];
+			if (ss)
+				TAILQ_INSERT_AFTER(&neworder->ldo_seclst, ss,
+				    os, os_entry);
+			else
+				TAILQ_INSERT_HEAD(&neworder->ldo_seclst, os,
+				    os_entry);
+			neworder->ldo_sublast[r] = os;
+		} else
+			TAILQ_INSERT_TAIL(&neworder->ldo_seclst, os, os_entry);
+		os->os_order = neworder;
 		if (neworder->ldo_flags & LD_USED)
 			os->os_flags |= SECTION_USED;
 	}
@@ -515,64 +890,394 @@ TODO
 }
 
 /*
- * called upon every symbol in order to determine
- * the needs in the string table; calculate the sym name pointers
+ * the output symbol table follows the sections the symbols are
+ * defined in; a prefix sum over the per-section symbol counts gives
+ * every section its range in the table and the workers fill those
+ * in without any locking.  only adding the names to the string
+ * table (merging the duplicates) is left serial.
  */
 int
-elf_symrec(const struct ldorder *order, const struct section *os,
-    struct symlist *sym, void *v)
+elf_symlayout(struct headorder *headorder, struct symout *so)
 {
-	Elf_Sym *esym;
-	int *pnn = v;
+	struct ldorder *ord;
+	struct symsect *ss;
+	struct section *os;
+	size_t i, n, max;
+
+	memset(so, 0, sizeof *so);
+	max = 0;
+	TAILQ_FOREACH(ord, headorder, ldo_entry)
+		TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry) {
+			if (SYMQ_EMPTY(&os->os_syms))
+				continue;
+
+			if (so->so_nsects == max) {
+				max = max? max * 2 : 256;
+				if (!(so->so_sects = reallocarray(so->so_sects,
+				    max, sizeof *so->so_sects)))
+					err(1, "reallocarray");
+			}
+			ss = &so->so_sects[so->so_nsects++];
+			ss->ss_order = ord;
+			ss->ss_os = os;
+			ss->ss_first = ss->ss_nsyms = 0;
+		}
+
+	pool_run(so->so_nsects, elf_symcount, so);
+
+	for (n = 0, i = 0; i < so->so_nsects; i++) {
+		so->so_sects[i].ss_first = n;
+		n += so->so_sects[i].ss_nsyms;
+	}
+	so->so_nsyms = n;
+
+	if (n && (!(so->so_syms = reallocarray(NULL, n,
+	    sizeof *so->so_syms)) ||
+	    !(so->so_hash = reallocarray(NULL, n, sizeof *so->so_hash)) ||
+	    !(so->so_len = reallocarray(NULL, n, sizeof *so->so_len))))
+		err(1, "reallocarray");
 
-	esym = &ELF_SYM(sym->sl_elfsym);
-	pnn[0] += sizeof *esym;
-	esym->st_name = pnn[1];
-	pnn[1] += strlen(sym->sl_name) + 1;
+	pool_run(so->so_nsects, elf_symhash, so);
+
+	/* keep the name index in the st_name until elf_symnames() */
+	strtab_init(&so->so_names);
+	for (i = 0; i < n; i++)
+		ELF_SYM(so->so_syms[i]->sl_elfsym).st_name =
+		    strtab_addh(&so->so_names, so->so_syms[i]->sl_name,
+		    so->so_hash[i], so->so_len[i]);
+
+	free(so->so_hash);
+	free(so->so_len);
+	so->so_hash = NULL;
+	so->so_len = NULL;
 
 	return 0;
 }
 
+void
+elf_symcount(void *v, int i, int w)
+{
+	struct symsect *ss = &((struct symout *)v)->so_sects[i];
+	struct symlist *sym;
+
+	SYMQ_FOREACH(sym, &ss->ss_os->os_syms)
+		ss->ss_nsyms++;
+}
+
+void
+elf_symhash(void *v, int i, int w)
+{
+	struct symout *so = v;
+	struct symsect *ss = &so->so_sects[i];
+	struct symlist *sym;
+	size_t n, len;
+
+	n = ss->ss_first;
+	SYMQ_FOREACH(sym, &ss->ss_os->os_syms) {
+		so->so_syms[n] = sym;
+		so->so_hash[n] = strtab_hash(sym->sl_name, &len);
+		so->so_len[n++] = len;
+	}
+}
+
+/*
+ * convert the name index into the string table offset
+ */
+void
+elf_symnames(void *v, int i, int w)
+{
+	struct symout *so = v;
+	struct symsect *ss = &so->so_sects[i];
+	Elf_Sym *esym;
+	size_t n;
+
+	for (n = ss->ss_first; n < ss->ss_first + ss->ss_nsyms; n++) {
+		esym = &ELF_SYM(so->so_syms[n]->sl_elfsym);
+		esym->st_name = strtab_off(&so->so_names, esym->st_name);
+	}
+}
+
+void
+elf_symfill(void *v, int i, int w)
+{
+	Elf_Ehdr *eh = &ELF_HDR(sysobj.ol_hdr);
+	struct symout *so = v;
+	struct symsect *ss = &so->so_sects[i];
+	Elf_Sym *osym;
+	size_t n;
+
+	osym = (Elf_Sym *)so->so_buf + 1 + ss->ss_first;
+	for (n = ss->ss_first; n < ss->ss_first + ss->ss_nsyms; n++) {
+		*osym = ELF_SYM(so->so_syms[n]->sl_elfsym);
+		osym->st_shndx = ss->ss_order->ldo_sno;
+		elf_fix_sym(eh, osym++);
+	}
+}
+
+/*
+ * produce the whole table in memory and write it out at once
+ */
+void
+elf_symout(FILE *fp, const char *name, const struct ldorder *ord)
+{
+	struct symout *so = ord->ldo_wurst;
+
+	if (!(so->so_buf = calloc(1, ord->ldo_wsize)))
+		err(1, "calloc");
+
+	pool_run(so->so_nsects, elf_symfill, so);
+
+	if (fwrite(so->so_buf, ord->ldo_wsize, 1, fp) != 1)
+		err(1, "fwrite: %s", name);
+
+	free(so->so_buf);
+	so->so_buf = NULL;
+}
+
 /*
- * called upon every symbol in order to write out each one of them
+ * the symbol table of the relocatable output lists the locals first
+ * (along with a section symbol for every output section) followed
+ * by the globals, the commons and the undefined ones;
+ * the indices are assigned once here for the relocations to refer to.
  */
+struct relsyms {
+	struct strtab rs_names;
+	struct symlist **rs_syms;	/* in the output order */
+	u_long rs_nsyms, rs_maxsyms;
+	int rs_global;			/* collecting the globals */
+};
+
+void
+elf_relsym(struct relsyms *rs, struct symlist *sym)
+{
+	if (rs->rs_nsyms == rs->rs_maxsyms) {
+		rs->rs_maxsyms = rs->rs_maxsyms? rs->rs_maxsyms * 2 : 256;
+		if (!(rs->rs_syms = reallocarray(rs->rs_syms, rs->rs_maxsyms,
+		    sizeof *rs->rs_syms)))
+			err(1, "reallocarray");
+	}
+
+	rs->rs_syms[rs->rs_nsyms++] = sym;
+	*sym_idx(sym) = rs->rs_nsyms;	/* the first one is null */
+	if (sym->sl_name)
+		ELF_SYM(sym->sl_elfsym).st_name =
+		    strtab_add(&rs->rs_names, sym->sl_name);
+}
+
 int
-elf_symwrite(const struct ldorder *order, const struct section *os,
+elf_relscan(const struct ldorder *order, const struct section *os,
     struct symlist *sym, void *v)
 {
-	Elf_Ehdr *eh = &ELF_HDR(sysobj.ol_hdr);
-	FILE *fp = v;
-	Elf_Sym osym;
+	struct relsyms *rs = v;
 
-	osym = ELF_SYM(sym->sl_elfsym);
-	osym.st_shndx = order->ldo_sno;
-	elf_fix_sym(eh, &osym);
-	if (fwrite(&osym, sizeof osym, 1, fp) != 1)
-		err(1, "fwrite: symbol table");
+	if ((ELF_ST_BIND(ELF_SYM(sym->sl_elfsym).st_info) != STB_LOCAL) ==
+	    rs->rs_global)
+		elf_relsym(rs, sym);
 
 	return 0;
 }
 
 /*
- * called upon every output symbol in order to write out the strings
- *
- * TODO merge equal strings (make string hash in syms.c)
+ * absolute and common symbols are not in any section loaded
  */
 int
-elf_names(const struct ldorder *order, const struct section *os,
-    struct symlist *sym, void *v)
+elf_relabs(struct symlist *sym, void *v)
 {
-	struct ldorder *neworder = v;
-	char *p = neworder->ldo_wurst;
-	size_t n;
+	struct relsyms *rs = v;
+	Elf_Sym *esym = &ELF_SYM(sym->sl_elfsym);
+
+	if ((sym->sl_sect && esym->st_shndx != SHN_COMMON) ||
+	    (ELF_ST_BIND(esym->st_info) != STB_LOCAL) != rs->rs_global)
+		return 0;
+
+	elf_relsym(rs, sym);
+	return 0;
+}
 
-	p += neworder->ldo_addr;
-	n = neworder->ldo_wsize - neworder->ldo_addr;
-	neworder->ldo_addr += strlcpy(p, sym->sl_name, n) + 1;
+int
+elf_relund(struct symlist *sym, void *v)
+{
+	if (sym->sl_name)
+		elf_relsym(v, sym);
 
 	return 0;
 }
 
+void
+elf_relsyms(struct headorder *headorder, struct ldorder *symord,
+    struct ldorder *strord)
+{
+	struct relsyms rs;
+	struct ldorder *ord;
+	struct symlist *sym;
+	Elf_Shdr *shdr;
+	Elf_Sym *esym;
+	u_long i;
+
+	memset(&rs, 0, sizeof rs);
+	strtab_init(&rs.rs_names);
+
+	/* output section symbols */
+	TAILQ_FOREACH(ord, headorder, ldo_entry) {
+		if (ord->ldo_order != ldo_section || !ord->ldo_sect)
+			continue;
+
+		sym = sym_new(NULL);
+		esym = &ELF_SYM(sym->sl_elfsym);
+		esym->st_info = ELF_ST_INFO(STB_LOCAL, STT_SECTION);
+		esym->st_shndx = ord->ldo_sno;
+		sym->sl_sect = ord->ldo_sect;
+		sym_qadd(&ord->ldo_sect->os_syms, sym);
+		elf_relsym(&rs, sym);
+	}
+
+	sym_scan(TAILQ_FIRST(headorder), NULL, elf_relscan, &rs);
+	sym_foreach(elf_relabs, &rs);
+
+	shdr = symord->ldo_sect->os_sect;
+	shdr->sh_info = rs.rs_nsyms + 1;
+	rs.rs_global = 1;
+	sym_scan(TAILQ_FIRST(headorder), NULL, elf_relscan, &rs);
+	sym_foreach(elf_relabs, &rs);
+	sym_undforeach(elf_relund, &rs);
+
+	symord->ldo_wsize = (rs.rs_nsyms + 1) * sizeof *esym;
+	symord->ldo_wurst = rs.rs_syms;
+
+	strord->ldo_start = 0;
+	strord->ldo_addr = strtab_finish(&rs.rs_names);
+	strord->ldo_wsize = ALIGN(strord->ldo_addr);
+	if (!(strord->ldo_wurst = calloc(1, strord->ldo_wsize)))
+		err(1, "calloc");
+	strtab_write(&rs.rs_names, strord->ldo_wurst);
+	for (i = 0; i < rs.rs_nsyms; i++) {
+		sym = rs.rs_syms[i];
+		if (sym->sl_name)
+			ELF_SYM(sym->sl_elfsym).st_name = strtab_off(
+			    &rs.rs_names, ELF_SYM(sym->sl_elfsym).st_name);
+	}
+	strtab_free(&rs.rs_names);
+}
+
+/*
+ * write out the symbol table collected in elf_relsyms()
+ */
+void
+elf_relsymwrite(FILE *fp, const char *name, const struct ldorder *ord)
+{
+	Elf_Ehdr *eh = &ELF_HDR(sysobj.ol_hdr);
+	struct symlist **syms = ord->ldo_wurst, *sym;
+	Elf_Sym osym;
+	u_long i, n;
+
+	n = ord->ldo_wsize / sizeof osym - 1;
+	for (i = 0; i < n; i++) {
+		sym = syms[i];
+		osym = ELF_SYM(sym->sl_elfsym);
+		if (!sym->sl_name)
+			;	/* section symbol */
+		else if (sym->sl_sect && sym->sl_sect->os_order &&
+		    osym.st_shndx != SHN_COMMON)
+			osym.st_shndx = sym->sl_sect->os_order->ldo_sno;
+		else if (osym.st_shndx == SHN_UNDEF &&
+		    ELF_ST_BIND(osym.st_info) == STB_LOCAL)
+			osym.st_info = ELF_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+
+		elf_fix_sym(eh, &osym);
+		if (fwrite(&osym, sizeof osym, 1, fp) != 1)
+			err(1, "fwrite: %s", name);
+	}
+}
+
+/*
+ * write out the relocations for the relocatable output;
+ * the ones against the input sections are moved onto
+ * the output section symbols with the addends adjusted
+ * (the implicit ones are patched in the contents written).
+ */
+void
+elf_relwrite(FILE *fp, const char *name, const struct ldorder *ord)
+{
+	const struct ldorder *tord = ord->ldo_wurst;
+	Elf_Ehdr *eh = &ELF_HDR(sysobj.ol_hdr);
+	struct section *os, *ts;
+	struct relist *rp, *erp;
+	struct symlist *sym;
+	Elf_Shdr *shdr;
+	Elf_RelA rela;
+	Elf_Rel rel;
+	uint64_t add;
+	off_t off;
+	u_long si;
+	const char *inname = NULL;
+	char buf[8];
+	ssize_t n;
+	int fd = -1;
+
+	if (ord->ldo_type == SHT_REL && fflush(fp) == EOF)
+		err(1, "fflush: %s", name);
+
+	TAILQ_FOREACH(os, &tord->ldo_seclst, os_entry) {
+		if (!os->os_nrls)
+			continue;
+
+		/* lowmem reads them again one section at a time */
+		if (!os->os_rels && inname != os->os_obj->ol_path) {
+			if (fd >= 0)
+				close(fd);
+			inname = os->os_obj->ol_path;
+			if ((fd = open(inname, O_RDONLY)) < 0)
+				err(1, "open: %s", inname);
+		}
+
+		shdr = os->os_sect;
+		for (rp = elf_relget(os, fd), erp = rp + os->os_nrls;
+		    rp < erp; rp++) {
+			si = 0;
+			add = 0;
+			if (!(sym = RL_SYM(os, rp)))
+				;
+			else if (sym->sl_name)
+				si = *sym_idx(sym);
+			else if ((ts = sym->sl_sect)->os_order) {
+				si = *sym_idx(SYMQ_FIRST(&ts->os_order->
+				    ldo_sect->os_syms));
+				add = ((Elf_Shdr *)ts->os_sect)->sh_addr;
+			}
+
+			if (ord->ldo_type == SHT_RELA) {
+				rela.r_offset = shdr->sh_addr + rp->rl_addr;
+				rela.r_info = ELF_R_INFO(si, rp->rl_type);
+				rela.r_addend = rp->rl_addend + add;
+				elf_fix_rela(eh, &rela);
+				if (fwrite(&rela, sizeof rela, 1, fp) != 1)
+					err(1, "fwrite: %s", name);
+				continue;
+			}
+
+			if (add) {
+				off = shdr->sh_offset + rp->rl_addr;
+				if ((n = pread(fileno(fp), buf, sizeof buf,
+				    off)) < 4)
+					err(1, "pread: %s", name);
+				ord->ldo_arch->la_fixone(buf, add, 0,
+				    rp->rl_type);
+				if (pwrite(fileno(fp), buf, n, off) != n)
+					err(1, "pwrite: %s", name);
+			}
+			rel.r_offset = shdr->sh_addr + rp->rl_addr;
+			rel.r_info = ELF_R_INFO(si, rp->rl_type);
+			elf_fix_rel(eh, &rel);
+			if (fwrite(&rel, sizeof rel, 1, fp) != 1)
+				err(1, "fwrite: %s", name);
+		}
+		elf_relput(os);
+	}
+
+	if (fd >= 0)
+		close(fd);
+}
+
 /*
  * called upon every output symbol in order to produce
  * the a.out file map
@@ -617,13 +1322,13 @@ elf_commons(struct objlist *ol, void *v)
 	Elf_Sym *esym;
 
 	if (!ol->ol_bss) {
-		if (TAILQ_EMPTY(&ol->ol_sections[0].os_syms))
+		if (SYMQ_EMPTY(&ol->ol_sections[0].os_syms))
 			return 0;
 		errx(1, "%s: no .bss", ol->ol_name);
 	}
 
 	shdr = ol->ol_bss->os_sect;
-	while ((sym = TAILQ_FIRST(&ol->ol_sections[0].os_syms))) {
+	while ((sym = SYMQ_FIRST(&ol->ol_sections[0].os_syms))) {
 		esym = &ELF_SYM(sym->sl_elfsym);
 		esym->st_value = shdr->sh_size;
 		shdr->sh_size += ALIGN(esym->st_size);
@@ -634,69 +1339,1456 @@ elf_commons(struct objlist *ol, void *v)
 }
 
 /*
- * produce actual a.out
- * scan through the orders and sections messing the bits
- * and the headers; give special treatment to the symtab
+ * mergeable sections (SHF_MERGE) are split into pieces
+ * (strings or constants of sh_entsize) that are only kept once
+ * per output order; all the sections of the same kind are folded
+ * into the first one of them (the leader) and the symbols and
+ * relocations referring to the others are moved onto the leader.
  */
-int
-ldload(const char *name, struct ldorder *order)
+struct mergejob {
+	struct section *mj_os;
+	char *mj_data;			/* input contents */
+	int mj_grp;			/* merge group number */
+};
+
+struct mergegrp {
+	struct section *mg_lead;	/* section to merge into */
+	uint64_t mg_flags;
+	uint64_t mg_entsize;
+	uint64_t mg_align;
+	struct mergejob **mg_hash;	/* first job with the piece */
+	struct mergefrag **mg_hfrag;	/* and the piece itself */
+	size_t mg_hsize;
+	size_t mg_nuniq;
+	char *mg_buf;			/* merged contents */
+	size_t mg_size, mg_max;
+};
+
+struct mergeload {
+	struct mergejob *ml_jobs;
+	int ml_fds[LD_MAXTHREADS];	/* per worker cache */
+	const char *ml_paths[LD_MAXTHREADS];
+};
+
+/*
+ * tell if the section can be merged
+ */
+static int
+elf_mergeable(struct section *os)
 {
-	struct stat sb;
-	char obuf[ELF_OBUFSZ];
-	struct ldorder *ord;
-	struct section *os;
-	Elf_Ehdr *eh;
-	Elf_Phdr *phdr;
-	Elf_Shdr *shdr;
-	FILE *fp;
+	Elf_Shdr *shdr = os->os_sect;
 
-	if (!order || errors)
-		return 1;
+	return (shdr->sh_flags & SHF_MERGE) &&
+	    shdr->sh_type == SHT_PROGBITS && shdr->sh_size &&
+	    shdr->sh_entsize && !(shdr->sh_size % shdr->sh_entsize) &&
+	    !os->os_nrls;
+}
 
-	eh = &ELF_HDR(sysobj.ol_hdr);
+/*
+ * read the section and split it into the pieces;
+ * called through the pool as hashing is done right here
+ */
+void
+elf_mergeload(void *v, int i, int w)
+{
+	struct mergeload *ml = v;
+	struct mergejob *mj = &ml->ml_jobs[i];
+	struct section *os = mj->mj_os;
+	Elf_Shdr *shdr = os->os_sect;
+	struct mergefrag *mf;
+	const u_char *p, *ep, *q;
+	size_t es, n, k;
+	uint64_t h;
+
+	if (ml->ml_paths[w] != os->os_obj->ol_path) {
+		if (ml->ml_paths[w])
+			close(ml->ml_fds[w]);
+		ml->ml_paths[w] = os->os_obj->ol_path;
+		if ((ml->ml_fds[w] = open(ml->ml_paths[w], O_RDONLY)) < 0)
+			err(1, "open: %s", ml->ml_paths[w]);
+	}
 
-	if (!(fp = fopen(name, "w+")))
-		err(1, "fopen: %s", name);
-	setvbuf(fp, obuf, _IOFBF, sizeof obuf);
+	if (!(mj->mj_data = malloc(shdr->sh_size)))
+		err(1, "malloc");
+	if (pread(ml->ml_fds[w], mj->mj_data, shdr->sh_size, os->os_off) !=
+	    (ssize_t)shdr->sh_size)
+		err(1, "pread: %s", os->os_obj->ol_name);
+	stat_count(LD_ST_READ, shdr->sh_size);
+
+	es = shdr->sh_entsize;
+	n = shdr->sh_size / es;
+	if (!(shdr->sh_flags & SHF_STRINGS))
+		os->os_nfrags = n;
+	else {
+		/* count the strings */
+		p = (u_char *)mj->mj_data;
+		ep = p + shdr->sh_size;
+		for (n = 0; p < ep; n++) {
+			for (; p < ep; p += es) {
+				for (k = 0; k < es && !p[k]; k++)
+					;
+				if (k == es)
+					break;
+			}
+			p += es;
+		}
+		os->os_nfrags = n;
+	}
 
-	/* dump out sections */
-	for (ord = order; ord != TAILQ_END(ord);
-	    ord = TAILQ_NEXT(ord, ldo_entry)) {
-		const char *inname = NULL;
-		FILE *sfp = NULL;
+	if (!(os->os_frags = reallocarray(NULL, n, sizeof *os->os_frags)))
+		err(1, "reallocarray");
 
-		if (ord->ldo_order == ldo_symbol ||
-		    ord->ldo_order == ldo_expr)
-			continue;
+	p = (u_char *)mj->mj_data;
+	ep = p + shdr->sh_size;
+	for (mf = os->os_frags; p < ep; mf++) {
+		mf->mf_off = p - (u_char *)mj->mj_data;
+		q = p;
+		if (!(shdr->sh_flags & SHF_STRINGS))
+			p += es;
+		else {
+			for (; p < ep; p += es) {
+				for (k = 0; k < es && !p[k]; k++)
+					;
+				if (k == es)
+					break;
+			}
+			if ((p += es) > ep)
+				p = ep;
+		}
 
-		shdr = ord->ldo_sect->os_sect;
-		if (shdr->sh_flags & SHF_ALLOC)
-			shdr->sh_addr = ord->ldo_start;
-		shdr->sh_size = ord->ldo_addr - ord->ldo_start;
+		for (h = 14695981039346656037ULL; q < p; q++)
+			h = (h ^ *q) * 1099511628211ULL;
+		mf->mf_hash = h;
+	}
+}
 
-		/* nothing to write */
-		if (ord->ldo_type == SHT_NOBITS)
-			continue;
+/*
+ * the loaded sections of SHT_REL have the addends in place;
+ * the debugging ones are done right there by elf_dbgfix()
+ */
+#define	elf_relinplace(os)						\
+	(((Elf_Shdr *)(os)->os_sect + 1)->sh_type == SHT_REL &&		\
+	    (((Elf_Shdr *)(os)->os_sect)->sh_flags & SHF_ALLOC))
 
-		if (elf_seek(fp, shdr->sh_offset, ord->ldo_filler) < 0)
-			err(1, "elf_seek: %s", name);
+/*
+ * find the offset in the merged section for the input section offset
+ */
+uint64_t
+elf_mergeoff(struct section *os, int64_t off)
+{
+	struct mergefrag *mf;
+	size_t l, h, m;
+
+	l = 0;
+	h = os->os_nfrags;
+	while (h - l > 1) {
+		m = (l + h) / 2;
+		if ((int64_t)os->os_frags[m].mf_off <= off)
+			l = m;
+		else
+			h = m;
+	}
 
-		/* done w/ meat -- generate symbols */
-		if (ord->ldo_type == SHT_SYMTAB) {
-			if (fseek(fp, sizeof(Elf_Sym), SEEK_CUR) < 0)
-				err(1, "fseek: %s", name);
-			sym_scan(order, NULL, elf_symwrite, fp);
-			continue;
-		}
+	mf = &os->os_frags[l];
+	return mf->mf_out + (off - (int64_t)mf->mf_off);
+}
 
-		if (ord->ldo_flags & LD_CONTAINS) {
-			if (fwrite(ord->ldo_wurst, ord->ldo_wsize, 1, fp) != 1)
-				err(1, "fwrite: %s", name);
+/*
+ * move the relocations against the section symbols
+ * of the merged sections onto the merged pieces
+ */
+int
+elf_mergefix(struct objlist *ol, void *v)
+{
+	struct section *os, *eos;
+	struct relist *rp, *erp;
+	struct symlist *sym;
+	uint8_t *data;
+	u_long i;
+	int fd = -1;
 
-			continue;
+	if (!ol->ol_sidx)
+		return 0;
+
+	/* lowmem does it in elf_relget() */
+	for (os = ol->ol_sections, eos = os + ol->ol_nsect; os < eos; os++) {
+		data = NULL;
+		for (rp = os->os_rels, erp = rp? rp + os->os_nrls : rp;
+		    rp < erp; rp++) {
+			sym = RL_SYM(os, rp);
+			if (!sym || sym->sl_name || !sym->sl_sect ||
+			    !sym->sl_sect->os_merged)
+				continue;
+			if (!elf_relinplace(os))
+				rp->rl_addend =
+				    elf_mergeoff(sym->sl_sect, rp->rl_addend);
+			else {
+				if (fd < 0 &&
+				    (fd = open(ol->ol_path, O_RDONLY)) < 0)
+					err(1, "open: %s", ol->ol_path);
+				rp->rl_addend = elf_mergerel(os, rp,
+				    sym->sl_sect, fd, &data);
+			}
 		}
+		free(data);
+	}
+	if (fd >= 0)
+		close(fd);
+
+	for (i = 0; i < ol->ol_nsyms; i++) {
+		sym = ol->ol_sidx[i];
+		if (sym && !sym->sl_name && sym->sl_sect &&
+		    sym->sl_sect->os_merged)
+			sym->sl_sect = sym->sl_sect->os_merged;
+	}
 
-		/*
+	return 0;
+}
+
+/*
+ * fold all the mergeable sections in the orders
+ */
+void
+elf_merge(struct headorder *headorder)
+{
+	struct mergeload ml;
+	struct mergejob *mj, *mjs, *hj;
+	struct mergegrp *mg, *mgs;
+	struct mergefrag *mf, *emf, *hf;
+	struct ldorder *ord;
+	struct section *os, *next;
+	struct symlist *sym;
+	Elf_Shdr *shdr;
+	size_t nj, maxj, ng, maxg, g, i, h, len, hlen;
+	int j;
+
+	nj = maxj = 0;
+	ng = maxg = 0;
+	mjs = NULL;
+	mgs = NULL;
+	TAILQ_FOREACH(ord, headorder, ldo_entry) {
+		if (ord->ldo_order != ldo_section)
+			continue;
+
+		/* groups are per order */
+		g = ng;
+		TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry) {
+			if (!elf_mergeable(os))
+				continue;
+
+			shdr = os->os_sect;
+			for (i = g; i < ng; i++)
+				if (mgs[i].mg_flags == shdr->sh_flags &&
+				    mgs[i].mg_entsize == shdr->sh_entsize)
+					break;
+			if (i == ng) {
+				if (ng == maxg) {
+					maxg = maxg? maxg * 2 : 16;
+					if (!(mgs = reallocarray(mgs, maxg,
+					    sizeof *mgs)))
+						err(1, "reallocarray");
+				}
+				mg = &mgs[ng++];
+				memset(mg, 0, sizeof *mg);
+				mg->mg_lead = os;
+				mg->mg_flags = shdr->sh_flags;
+				mg->mg_entsize = shdr->sh_entsize;
+				mg->mg_align = 1;
+			}
+			mg = &mgs[i];
+			if (mg->mg_align < shdr->sh_addralign)
+				mg->mg_align = shdr->sh_addralign;
+
+			if (nj == maxj) {
+				maxj = maxj? maxj * 2 : 64;
+				if (!(mjs = reallocarray(mjs, maxj, sizeof *mjs)))
+					err(1, "reallocarray");
+			}
+			mj = &mjs[nj++];
+			mj->mj_os = os;
+			mj->mj_data = NULL;
+			mj->mj_grp = i;
+			os->os_merged = mg->mg_lead;
+		}
+	}
+
+	if (!nj)
+		return;
+
+	/* read and hash all the pieces */
+	memset(&ml, 0, sizeof ml);
+	ml.ml_jobs = mjs;
+	pool_run(nj, elf_mergeload, &ml);
+	for (j = 0; j < LD_MAXTHREADS; j++)
+		if (ml.ml_paths[j])
+			close(ml.ml_fds[j]);
+
+	for (mg = mgs; mg < mgs + ng; mg++) {
+		mg->mg_hsize = 1024;
+		if (!(mg->mg_hash = calloc(mg->mg_hsize,
+		    sizeof *mg->mg_hash)) ||
+		    !(mg->mg_hfrag = calloc(mg->mg_hsize,
+		    sizeof *mg->mg_hfrag)))
+			err(1, "calloc");
+	}
+
+	/* pick the first copy of every piece in the order */
+	for (mj = mjs; mj < mjs + nj; mj++) {
+		mg = &mgs[mj->mj_grp];
+		shdr = mj->mj_os->os_sect;
+		for (mf = mj->mj_os->os_frags,
+		    emf = mf + mj->mj_os->os_nfrags; mf < emf; mf++) {
+			len = (mf + 1 < emf? mf[1].mf_off : shdr->sh_size) -
+			    mf->mf_off;
+			for (h = mf->mf_hash & (mg->mg_hsize - 1);
+			    (hj = mg->mg_hash[h]); h = (h + 1) &
+			    (mg->mg_hsize - 1)) {
+				hf = mg->mg_hfrag[h];
+				hlen = (hf + 1 < hj->mj_os->os_frags +
+				    hj->mj_os->os_nfrags? hf[1].mf_off :
+				    ((Elf_Shdr *)hj->mj_os->os_sect)->sh_size) -
+				    hf->mf_off;
+				if (hf->mf_hash == mf->mf_hash && hlen == len &&
+				    !memcmp(hj->mj_data + hf->mf_off,
+				    mj->mj_data + mf->mf_off, len))
+					break;
+			}
+
+			if (hj) {
+				mf->mf_out = hf->mf_out;
+				continue;
+			}
+
+			/* a new one; pieces keep the section alignment */
+			mg->mg_size = roundup(mg->mg_size, mg->mg_align);
+			if (mg->mg_size + len > mg->mg_max) {
+				mg->mg_max = MAX(mg->mg_max * 2,
+				    mg->mg_size + len);
+				if (!(mg->mg_buf = realloc(mg->mg_buf,
+				    mg->mg_max)))
+					err(1, "realloc");
+			}
+			mf->mf_out = mg->mg_size;
+			memcpy(mg->mg_buf + mg->mg_size,
+			    mj->mj_data + mf->mf_off, len);
+			mg->mg_size += len;
+			mg->mg_hash[h] = mj;
+			mg->mg_hfrag[h] = mf;
+
+			/* keep the hash at most half full */
+			if (++mg->mg_nuniq * 2 > mg->mg_hsize) {
+				struct mergejob **nh;
+				struct mergefrag **nf;
+				size_t k;
+
+				if (!(nh = calloc(mg->mg_hsize * 2,
+				    sizeof *nh)) ||
+				    !(nf = calloc(mg->mg_hsize * 2,
+				    sizeof *nf)))
+					err(1, "calloc");
+				for (k = 0; k < mg->mg_hsize; k++) {
+					if (!mg->mg_hash[k])
+						continue;
+					for (h = mg->mg_hfrag[k]->mf_hash &
+					    (mg->mg_hsize * 2 - 1); nh[h];
+					    h = (h + 1) & (mg->mg_hsize * 2 - 1))
+						;
+					nh[h] = mg->mg_hash[k];
+					nf[h] = mg->mg_hfrag[k];
+				}
+				free(mg->mg_hash);
+				free(mg->mg_hfrag);
+				mg->mg_hash = nh;
+				mg->mg_hfrag = nf;
+				mg->mg_hsize *= 2;
+			}
+		}
+	}
+
+	/* relocations against the section symbols */
+	obj_foreach(elf_mergefix, NULL);
+
+	/* named symbols move onto the leader */
+	for (mj = mjs; mj < mjs + nj; mj++) {
+		struct symlist *nsym;
+
+		os = mj->mj_os;
+		for (sym = SYMQ_FIRST(&os->os_syms); sym; sym = nsym) {
+			nsym = SYMQ_NEXT(sym);
+			ELF_SYM(sym->sl_elfsym).st_value = elf_mergeoff(os,
+			    ELF_SYM(sym->sl_elfsym).st_value);
+			if (os != os->os_merged)
+				sym_redef(sym, os->os_merged, NULL);
+		}
+		free(mj->mj_data);
+	}
+
+	for (mg = mgs; mg < mgs + ng; mg++) {
+		shdr = mg->mg_lead->os_sect;
+		shdr->sh_size = mg->mg_size;
+		shdr->sh_addralign = mg->mg_align;
+		mg->mg_lead->os_data = mg->mg_buf;
+		free(mg->mg_hash);
+		free(mg->mg_hfrag);
+	}
+
+	/* drop the folded sections from the orders */
+	TAILQ_FOREACH(ord, headorder, ldo_entry) {
+		if (ord->ldo_order != ldo_section)
+			continue;
+
+		for (os = TAILQ_FIRST(&ord->ldo_seclst);
+		    os != TAILQ_END(&ord->ldo_seclst); os = next) {
+			next = TAILQ_NEXT(os, os_entry);
+			if (os->os_merged && os->os_merged != os)
+				TAILQ_REMOVE(&ord->ldo_seclst, os, os_entry);
+		}
+	}
+
+	free(mjs);
+	free(mgs);
+}
+
+/*
+ * identical code folding: .text.* sections with the same contents
+ * and relocations against the same targets are folded into the first
+ * one of them in the order.  sections are split into classes by the
+ * contents hash first and then the classes are refined by the classes
+ * of the sections the relocations refer to until nothing changes.
+ */
+struct icfsect {
+	struct section *is_os;
+	char *is_data;			/* input contents */
+	uint64_t is_hash0;		/* contents and relocations hash */
+	uint64_t is_hash;		/* hash for the current round */
+	int is_class;			/* number of the first in the class */
+};
+
+struct icfload {
+	struct icfsect *il_sects;
+	int il_fds[LD_MAXTHREADS];	/* per worker cache */
+	const char *il_paths[LD_MAXTHREADS];
+};
+
+static uint64_t
+icf_mix(uint64_t h, uint64_t v)
+{
+	h = (h ^ v) * 0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 32);
+}
+
+/*
+ * tell if the section can be folded
+ */
+static int
+elf_icfable(struct section *os)
+{
+	Elf_Shdr *shdr = os->os_sect;
+
+	return !strncmp(os->os_name, ".text.", 6) &&
+	    shdr->sh_type == SHT_PROGBITS &&
+	    (shdr->sh_flags & SHF_EXECINSTR) && shdr->sh_size &&
+	    !os->os_data && !(os->os_flags & SECTION_ADDRSIG);
+}
+
+/*
+ * the section is a relocation target a class stands for
+ */
+static struct icfsect *
+icf_target(struct icfsect *sects, struct symlist *sym)
+{
+	if (!sym || !sym->sl_sect || !sym->sl_sect->os_icf)
+		return NULL;
+
+	return &sects[sym->sl_sect->os_icf - 1];
+}
+
+/*
+ * tell if two sections of the same class are really the same
+ */
+static int
+elf_icfsame(struct icfsect *sects, struct icfsect *a, struct icfsect *b)
+{
+	struct section *oa = a->is_os, *ob = b->is_os;
+	Elf_Shdr *sa = oa->os_sect, *sb = ob->os_sect;
+	struct relist *ra, *rb;
+	struct symlist *ta, *tb;
+	struct icfsect *ia, *ib;
+	int i;
+
+	if (sa->sh_size != sb->sh_size || sa->sh_flags != sb->sh_flags ||
+	    sa->sh_addralign != sb->sh_addralign ||
+	    oa->os_nrls != ob->os_nrls ||
+	    memcmp(a->is_data, b->is_data, sa->sh_size))
+		return 0;
+
+	for (i = 0, ra = oa->os_rels, rb = ob->os_rels; i < oa->os_nrls;
+	    i++, ra++, rb++) {
+		if (ra->rl_addr != rb->rl_addr ||
+		    ra->rl_type != rb->rl_type ||
+		    ra->rl_addend != rb->rl_addend)
+			return 0;
+
+		ta = RL_SYM(oa, ra);
+		tb = RL_SYM(ob, rb);
+		if (ta == tb)
+			continue;
+		if (!ta || !tb)
+			return 0;
+
+		ia = icf_target(sects, ta);
+		ib = icf_target(sects, tb);
+		if (ia && ib) {
+			if (ia->is_class != ib->is_class ||
+			    (ta->sl_name? ELF_SYM(ta->sl_elfsym).st_value : 0) !=
+			    (tb->sl_name? ELF_SYM(tb->sl_elfsym).st_value : 0))
+				return 0;
+		} else if (ia || ib || ta->sl_name || tb->sl_name ||
+		    ta->sl_sect != tb->sl_sect)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int
+icf_cmp(const void *a, const void *b)
+{
+	const struct icfsect *ia = *(const struct icfsect **)a;
+	const struct icfsect *ib = *(const struct icfsect **)b;
+
+	if (ia->is_class != ib->is_class)
+		return ia->is_class < ib->is_class? -1 : 1;
+	if (ia->is_hash != ib->is_hash)
+		return ia->is_hash < ib->is_hash? -1 : 1;
+	return ia < ib? -1 : ia > ib;
+}
+
+/*
+ * mark the sections which address is taken by the data
+ * (such as tables of function pointers) or by the code
+ * with anything but a jump to it; unwinding info
+ * and exception tables do not count as those are only
+ * used to find the code.
+ */
+int
+elf_icfaddr(struct objlist *ol, void *v)
+{
+	struct section *os, *eos, *ts;
+	struct relist *rp, *erp;
+	struct symlist *sym;
+	Elf_Shdr *shdr;
+	u_char *data;
+	int fd = -1;
+
+	if (!ol->ol_sidx)
+		return 0;
+
+	for (os = ol->ol_sections, eos = os + ol->ol_nsect; os < eos; os++) {
+		shdr = os->os_sect;
+		if (!(shdr->sh_flags & SHF_ALLOC) || !os->os_nrls ||
+		    !strcmp(os->os_name, ELF_EH_FRAME) ||
+		    !strncmp(os->os_name, ELF_GCC_EXCEPT,
+		    sizeof(ELF_GCC_EXCEPT) - 1))
+			continue;
+
+		/* the instructions tell the calls from the rest */
+		data = NULL;
+		if (shdr->sh_flags & SHF_EXECINSTR) {
+			if (fd < 0 && (fd = open(ol->ol_path, O_RDONLY)) < 0)
+				err(1, "open: %s", ol->ol_path);
+			if (!(data = malloc(shdr->sh_size)))
+				err(1, "malloc");
+			if (pread(fd, data, shdr->sh_size, os->os_off) !=
+			    (ssize_t)shdr->sh_size)
+				err(1, "pread: %s", ol->ol_path);
+			stat_count(LD_ST_READ, shdr->sh_size);
+		}
+
+		for (rp = os->os_rels, erp = rp + os->os_nrls; rp < erp; rp++) {
+			if (!(sym = RL_SYM(os, rp)) || !(ts = sym->sl_sect))
+				continue;
+			if (data && rp->rl_addr < shdr->sh_size &&
+			    ldarch->la_branch(rp->rl_type, data, rp->rl_addr))
+				continue;
+			ts->os_flags |= SECTION_ADDRSIG;
+		}
+		free(data);
+	}
+	if (fd >= 0)
+		close(fd);
+
+	return 0;
+}
+
+/*
+ * read the section and hash it together with the relocations;
+ * the targets that are folding candidates themselves
+ * are accounted for by elf_icfhash() later.
+ */
+void
+elf_icfload(void *v, int i, int w)
+{
+	struct icfload *il = v;
+	struct icfsect *is = &il->il_sects[i];
+	struct section *os = is->is_os;
+	Elf_Shdr *shdr = os->os_sect;
+	struct relist *rp, *erp;
+	struct symlist *sym;
+	const u_char *p, *ep;
+	uint64_t h;
+
+	if (il->il_paths[w] != os->os_obj->ol_path) {
+		if (il->il_paths[w])
+			close(il->il_fds[w]);
+		il->il_paths[w] = os->os_obj->ol_path;
+		if ((il->il_fds[w] = open(il->il_paths[w], O_RDONLY)) < 0)
+			err(1, "open: %s", il->il_paths[w]);
+	}
+
+	if (!(is->is_data = malloc(shdr->sh_size)))
+		err(1, "malloc");
+	if (pread(il->il_fds[w], is->is_data, shdr->sh_size, os->os_off) !=
+	    (ssize_t)shdr->sh_size)
+		err(1, "pread: %s", os->os_obj->ol_name);
+	stat_count(LD_ST_READ, shdr->sh_size);
+
+	h = icf_mix(0, shdr->sh_size);
+	h = icf_mix(h, shdr->sh_flags);
+	h = icf_mix(h, shdr->sh_addralign);
+	h = icf_mix(h, os->os_nrls);
+	for (p = (u_char *)is->is_data, ep = p + shdr->sh_size; p < ep; p++)
+		h = (h ^ *p) * 1099511628211ULL;
+
+	for (rp = os->os_rels, erp = rp + os->os_nrls; rp < erp; rp++) {
+		h = icf_mix(h, rp->rl_addr);
+		h = icf_mix(h, rp->rl_type);
+		h = icf_mix(h, rp->rl_addend);
+		sym = RL_SYM(os, rp);
+		if (icf_target(il->il_sects, sym))
+			h = icf_mix(h, sym->sl_name?
+			    ELF_SYM(sym->sl_elfsym).st_value : 0);
+		else if (sym)
+			h = icf_mix(h, sym->sl_name? (uintptr_t)sym :
+			    (uintptr_t)sym->sl_sect);
+	}
+
+	is->is_hash0 = h;
+}
+
+/*
+ * hash the section for the next round adding the current
+ * classes of the candidates the relocations refer to
+ */
+void
+elf_icfhash(void *v, int i, int w)
+{
+	struct icfsect *sects = v, *is = &sects[i], *ts;
+	struct section *os = is->is_os;
+	struct relist *rp, *erp;
+	uint64_t h;
+
+	h = is->is_hash0;
+	for (rp = os->os_rels, erp = rp + os->os_nrls; rp < erp; rp++)
+		if ((ts = icf_target(sects, RL_SYM(os, rp))))
+			h = icf_mix(h, ts->is_class);
+	is->is_hash = h;
+}
+
+/*
+ * move the section symbols of the folded sections
+ */
+int
+elf_icffix(struct objlist *ol, void *v)
+{
+	struct symlist *sym;
+	u_long i;
+
+	if (!ol->ol_sidx)
+		return 0;
+
+	for (i = 0; i < ol->ol_nsyms; i++) {
+		sym = ol->ol_sidx[i];
+		if (sym && !sym->sl_name && sym->sl_sect &&
+		    sym->sl_sect->os_folded)
+			sym->sl_sect = sym->sl_sect->os_folded;
+	}
+
+	return 0;
+}
+
+/*
+ * fold the identical code sections in the orders
+ */
+void
+elf_icf(struct headorder *headorder)
+{
+	struct icfload il;
+	struct icfsect *is, *sects, **ip;
+	struct ldorder *ord;
+	struct section *os, *next;
+	struct symlist *sym, *nsym;
+	size_t n, maxn, i, j, nclass, k;
+	int nfold;
+
+	if (icf == LD_ICF_SAFE)
+		obj_foreach(elf_icfaddr, NULL);
+
+	n = maxn = 0;
+	sects = NULL;
+	TAILQ_FOREACH(ord, headorder, ldo_entry) {
+		if (ord->ldo_order != ldo_section)
+			continue;
+
+		TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry) {
+			if (!elf_icfable(os))
+				continue;
+
+			if (n == maxn) {
+				maxn = maxn? maxn * 2 : 256;
+				if (!(sects = reallocarray(sects, maxn,
+				    sizeof *sects)))
+					err(1, "reallocarray");
+			}
+			is = &sects[n++];
+			memset(is, 0, sizeof *is);
+			is->is_os = os;
+			os->os_icf = n;
+		}
+	}
+
+	if (n < 2) {
+		for (i = 0; i < n; i++)
+			sects[i].is_os->os_icf = 0;
+		free(sects);
+		return;
+	}
+
+	/* read and hash all the sections */
+	memset(&il, 0, sizeof il);
+	il.il_sects = sects;
+	pool_run(n, elf_icfload, &il);
+	for (i = 0; i < LD_MAXTHREADS; i++)
+		if (il.il_paths[i])
+			close(il.il_fds[i]);
+
+	if (!(ip = reallocarray(NULL, n, sizeof *ip)))
+		err(1, "reallocarray");
+	for (i = 0; i < n; i++)
+		ip[i] = &sects[i];
+
+	/* refine the classes until they stop splitting */
+	for (nclass = 0;;) {
+		pool_run(n, elf_icfhash, sects);
+		qsort(ip, n, sizeof *ip, icf_cmp);
+		for (k = i = 0; i < n; k++) {
+			for (j = i + 1; j < n &&
+			    ip[j]->is_class == ip[i]->is_class &&
+			    ip[j]->is_hash == ip[i]->is_hash; j++)
+				;
+			for (is = ip[i]; i < j; i++)
+				ip[i]->is_class = is - sects;
+		}
+		if (k == nclass || k == n)
+			break;
+		nclass = k;
+	}
+	free(ip);
+
+	/* fold everything the same as the first one in the class */
+	for (nfold = 0, is = sects; is < sects + n; is++) {
+		if (is->is_class == is - sects ||
+		    !elf_icfsame(sects, is, &sects[is->is_class]))
+			continue;
+
+		os = is->is_os;
+		os->os_folded = sects[is->is_class].is_os;
+		if (print_icf_sections)
+			warnx("folding section \"%s\" in %s into \"%s\" in %s",
+			    os->os_name, os->os_obj->ol_name,
+			    os->os_folded->os_name,
+			    os->os_folded->os_obj->ol_name);
+
+		for (sym = SYMQ_FIRST(&os->os_syms); sym; sym = nsym) {
+			nsym = SYMQ_NEXT(sym);
+			sym_redef(sym, os->os_folded, NULL);
+		}
+		nfold++;
+	}
+
+	if (nfold) {
+		obj_foreach(elf_icffix, NULL);
+
+		TAILQ_FOREACH(ord, headorder, ldo_entry) {
+			if (ord->ldo_order != ldo_section)
+				continue;
+
+			for (os = TAILQ_FIRST(&ord->ldo_seclst);
+			    os != TAILQ_END(&ord->ldo_seclst); os = next) {
+				next = TAILQ_NEXT(os, os_entry);
+				if (os->os_folded)
+					TAILQ_REMOVE(&ord->ldo_seclst, os,
+					    os_entry);
+			}
+		}
+	}
+
+	for (is = sects; is < sects + n; is++) {
+		is->is_os->os_icf = 0;
+		free(is->is_data);
+	}
+	free(sects);
+}
+
+/*
+ * the padding the sections take laid out in this order
+ */
+uint64_t
+elf_sortpad(struct sortkey *sk, size_t n)
+{
+	Elf_Shdr *shdr;
+	uint64_t addr, pad, align;
+	size_t i;
+
+	for (addr = pad = 0, i = 0; i < n; i++) {
+		shdr = sk[i].sk_os->os_sect;
+		if ((align = shdr->sh_addralign) > 1 && addr % align) {
+			pad += align - addr % align;
+			addr += align - addr % align;
+		}
+		addr += shdr->sh_size;
+	}
+
+	return pad;
+}
+
+int
+elf_sortcmp(const void *a, const void *b)
+{
+	const struct sortkey *ka = a, *kb = b;
+	const Elf_Shdr *sa = ka->sk_os->os_sect, *sb = kb->sk_os->os_sect;
+	int rv;
+
+	if (ka->sk_rank != kb->sk_rank)
+		return ka->sk_rank - kb->sk_rank;
+
+	switch (sort_section) {
+	case LD_SORT_ALIGN:
+	case LD_SORT_ALIGNNAME:
+		/* the most aligned go first */
+		if (sa->sh_addralign != sb->sh_addralign)
+			return sa->sh_addralign > sb->sh_addralign? -1 : 1;
+		if (sort_section == LD_SORT_ALIGNNAME &&
+		    (rv = strcmp(ka->sk_os->os_name, kb->sk_os->os_name)))
+			return rv;
+		break;
+
+	case LD_SORT_NAME:
+	case LD_SORT_NAMEALIGN:
+		if ((rv = strcmp(ka->sk_os->os_name, kb->sk_os->os_name)))
+			return rv;
+		if (sort_section == LD_SORT_NAMEALIGN &&
+		    sa->sh_addralign != sb->sh_addralign)
+			return sa->sh_addralign > sb->sh_addralign? -1 : 1;
+		break;
+	}
+
+	return ka->sk_no < kb->sk_no? -1 : ka->sk_no > kb->sk_no;
+}
+
+/*
+ * reorder the sections within every order as requested;
+ * those placed by the symbol order stay in front as they are
+ * and the ones which order matters (init, ctors and alike are
+ * all kept as used) or is shared with another order (debug)
+ * are left alone.  the padding before and after is kept
+ * for the map; the sorted orders start at their largest
+ * alignment (see ldmap()) as the padding is counted from there.
+ */
+void
+elf_sortsect(struct headorder *headorder)
+{
+	struct ldorder *ord;
+	struct section *os, *last;
+	struct sortkey *sk;
+	size_t n, maxn, i;
+
+	sk = NULL;
+	maxn = 0;
+	TAILQ_FOREACH(ord, headorder, ldo_entry) {
+		if (ord->ldo_order != ldo_section ||
+		    (ord->ldo_flags & (LD_USED | LD_DEBUG | LD_CONTAINS)))
+			continue;
+
+		last = NULL;
+		n = 0;
+		TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry) {
+			if (os->os_flags & SECTION_SORTED) {
+				last = os;
+				continue;
+			}
+
+			if (n == maxn) {
+				maxn = maxn? maxn * 2 : 256;
+				if (!(sk = reallocarray(sk, maxn, sizeof *sk)))
+					err(1, "reallocarray");
+			}
+			sk[n].sk_os = os;
+			sk[n].sk_rank = ord->ldo_subord?
+			    order_subrank(ord, os->os_name) : 0;
+			sk[n].sk_no = n;
+			n++;
+		}
+		if (n < 2)
+			continue;
+
+		ord->ldo_flags |= LD_SORTED;
+		sort_before += elf_sortpad(sk, n);
+		qsort(sk, n, sizeof *sk, elf_sortcmp);
+		sort_after += elf_sortpad(sk, n);
+
+		for (i = 0; i < n; i++) {
+			os = sk[i].sk_os;
+			TAILQ_REMOVE(&ord->ldo_seclst, os, os_entry);
+			if (last)
+				TAILQ_INSERT_AFTER(&ord->ldo_seclst, last,
+				    os, os_entry);
+			else
+				TAILQ_INSERT_HEAD(&ord->ldo_seclst, os,
+				    os_entry);
+			last = os;
+		}
+	}
+	free(sk);
+}
+
+static uint64_t
+elf_ehget(const uint8_t *p, int n)
+{
+	uint64_t v;
+	int i;
+
+	for (v = 0, i = 0; i < n; i++)
+		if (endian == ELFDATA2LSB)
+			v |= (uint64_t)p[i] << (8 * i);
+		else
+			v = v << 8 | p[i];
+
+	return v;
+}
+
+static void
+elf_ehput(uint8_t *p, uint32_t v)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		p[endian == ELFDATA2LSB? i : 3 - i] = v >> (8 * i);
+}
+
+static void
+elf_putn(uint8_t *p, uint64_t v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		p[endian == ELFDATA2LSB? i : n - 1 - i] = v >> (8 * i);
+}
+
+/*
+ * the SHT_REL relocations keep the addend in place thus it is
+ * the one to map onto the merged pieces; the difference goes into
+ * the addend for the arch engine to add up.  the section contents
+ * are read in on the first call into *data for the caller to free.
+ */
+int64_t
+elf_mergerel(struct section *os, const struct relist *rp,
+    struct section *ms, int fd, uint8_t **data)
+{
+	Elf_Shdr *shdr = os->os_sect;
+	uint64_t a;
+	int n;
+
+	if (!(n = ldarch->la_dbgrel(rp->rl_type)) ||
+	    rp->rl_addr + n > shdr->sh_size)
+		errx(1, "%s: unsupported reloc type %d against merged %s",
+		    os->os_obj->ol_name, rp->rl_type, ms->os_name);
+
+	if (!*data) {
+		if (!(*data = malloc(shdr->sh_size)))
+			err(1, "malloc");
+		if (pread(fd, *data, shdr->sh_size, os->os_off) !=
+		    (ssize_t)shdr->sh_size)
+			err(1, "pread: %s", os->os_obj->ol_name);
+		stat_count(LD_ST_READ, shdr->sh_size);
+	}
+
+	a = elf_ehget(*data + rp->rl_addr, n);
+	return elf_mergeoff(ms, a) - a;
+}
+
+/*
+ * size of the pointer in the encoding;
+ * only the ones we can find the relocation for will do
+ */
+static int
+elf_ehsize(int enc)
+{
+	if ((enc & 0x70) != DW_EH_PE_absptr && (enc & 0x70) != DW_EH_PE_pcrel)
+		return 0;
+
+	switch (enc & 0x0f) {
+	case DW_EH_PE_absptr:
+		return ELFSIZE / 8;
+	case DW_EH_PE_udata2:
+	case DW_EH_PE_sdata2:
+		return 2;
+	case DW_EH_PE_udata4:
+	case DW_EH_PE_sdata4:
+		return 4;
+	case DW_EH_PE_udata8:
+	case DW_EH_PE_sdata8:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * collect the fdes for the table and size the .eh_frame_hdr;
+ * if there is no .eh_frame or it cannot be made sense of
+ * the header is left empty and there is no search table.
+ */
+struct ehframe *
+elf_ehfrscan(struct headorder *headorder)
+{
+	struct ehframe *ehf;
+	struct ldorder *ord;
+	struct section *os;
+	Elf_Shdr *shdr;
+	const char *path;
+	uint8_t *data;
+	int fd;
+
+	if (!(ehf = calloc(1, sizeof *ehf)))
+		err(1, "calloc");
+
+	TAILQ_FOREACH(ord, headorder, ldo_entry)
+		if (ord->ldo_order == ldo_ehfrh)
+			ehf->ehf_hdr = ord;
+		else if (ord->ldo_order == ldo_section &&
+		    !strcmp(ord->ldo_name, ELF_EH_FRAME))
+			ehf->ehf_frame = ord;
+
+	if (!ehf->ehf_hdr || !ehf->ehf_frame ||
+	    TAILQ_EMPTY(&ehf->ehf_frame->ldo_seclst)) {
+		free(ehf);
+		return NULL;
+	}
+
+	fd = -1;
+	path = NULL;
+	TAILQ_FOREACH(os, &ehf->ehf_frame->ldo_seclst, os_entry) {
+		shdr = os->os_sect;
+		if (shdr->sh_type == SHT_NOBITS || !shdr->sh_size)
+			continue;
+
+		if (path != os->os_obj->ol_path) {
+			if (fd >= 0)
+				close(fd);
+			path = os->os_obj->ol_path;
+			if ((fd = open(path, O_RDONLY)) < 0)
+				err(1, "open: %s", path);
+		}
+
+		if (!(data = malloc(shdr->sh_size)))
+			err(1, "malloc");
+		if (pread(fd, data, shdr->sh_size, os->os_off) !=
+		    (ssize_t)shdr->sh_size)
+			err(1, "pread: %s", os->os_obj->ol_name);
+		stat_count(LD_ST_READ, shdr->sh_size);
+
+		elf_relget(os, fd);
+		if (elf_ehfrsect(ehf, os, data)) {
+			warnx("%s: %s: cannot parse, no search table",
+			    os->os_obj->ol_name, os->os_name);
+			free(data);
+			free(ehf->ehf_fdes);
+			free(ehf);
+			close(fd);
+			return NULL;
+		}
+		elf_relput(os);
+		free(data);
+	}
+	if (fd >= 0)
+		close(fd);
+
+	/* version, encodings, .eh_frame pointer, count and the table */
+	ord = ehf->ehf_hdr;
+	free(ord->ldo_wurst);
+	ord->ldo_wsize = 12 + 8 * ehf->ehf_nfdes;
+	if (!(ord->ldo_wurst = calloc(1, ord->ldo_wsize)))
+		err(1, "calloc");
+
+	return ehf;
+}
+
+/*
+ * walk the cies and fdes in the section;
+ * the initial location of every fde is taken from the relocation
+ * against it as S + A is what both the absolute and pc-relative
+ * encodings decode to.  fdes for the code not in the output
+ * (dropped by the gc or lost to a group) are left out.
+ */
+int
+elf_ehfrsect(struct ehframe *ehf, struct section *os, const uint8_t *data)
+{
+	Elf_Shdr *shdr = os->os_sect;
+	const uint8_t *p, *q, *body, *end, *aug;
+	struct { uint64_t off; int enc; } *cies;
+	struct relist *rp, *erp;
+	struct symlist *sym;
+	struct section *ts;
+	struct ehfde *ef;
+	uint64_t len, id, v;
+	ssize_t left;
+	size_t ncies, maxcies, i;
+	int enc, sz;
+
+	cies = NULL;
+	ncies = maxcies = 0;
+	end = data + shdr->sh_size;
+	for (p = data; end - p >= 4; p = body + len) {
+		body = p + 4;
+		if (!(len = elf_ehget(p, 4)))
+			break;
+		if (len == 0xffffffff || len < 4 || len > end - body)
+			goto bad;
+
+		if (!(id = elf_ehget(body, 4))) {
+			/* cie: find the fde pointer encoding */
+			q = body + 5;
+			aug = q;
+			if (!(q = memchr(q, '\0', body + len - q)))
+				goto bad;
+			q++;
+			left = body + len - q;
+			if (dwarf_leb128(&v, &q, &left, 0) ||
+			    dwarf_leb128(&v, &q, &left, 1))
+				goto bad;
+			if (body[4] == 1) {
+				q++;
+				left--;
+			} else if (dwarf_leb128(&v, &q, &left, 0))
+				goto bad;
+
+			enc = DW_EH_PE_absptr;
+			if (*aug == 'z') {
+				if (dwarf_leb128(&v, &q, &left, 0))
+					goto bad;
+				for (aug++; *aug && left > 0; aug++)
+					if (*aug == 'R') {
+						enc = *q;
+						break;
+					} else if (*aug == 'P') {
+						if (!(sz = elf_ehsize(*q)))
+							goto bad;
+						q += 1 + sz;
+						left -= 1 + sz;
+					} else if (*aug == 'L') {
+						q++;
+						left--;
+					} else if (*aug != 'S' && *aug != 'B')
+						goto bad;
+			} else if (*aug)
+				goto bad;
+
+			if (ncies == maxcies) {
+				maxcies = maxcies? maxcies * 2 : 8;
+				if (!(cies = reallocarray(cies, maxcies,
+				    sizeof *cies)))
+					err(1, "reallocarray");
+			}
+			cies[ncies].off = p - data;
+			cies[ncies++].enc = enc;
+			continue;
+		}
+
+		/* fde: the cie pointer is relative to itself */
+		for (i = 0; i < ncies; i++)
+			if (cies[i].off == (uint64_t)(body - data) - id)
+				break;
+		if (i == ncies || !(sz = elf_ehsize(cies[i].enc)) ||
+		    len < 4 + (uint64_t)sz)
+			goto bad;
+
+		/* the relocation for the initial location */
+		for (rp = os->os_rels, erp = rp? rp + os->os_nrls : rp;
+		    rp < erp && rp->rl_addr < (uint64_t)(body + 4 - data);
+		    rp++)
+			;
+		if (rp == erp || rp->rl_addr != (uint64_t)(body + 4 - data))
+			continue;
+
+		if (!(sym = RL_SYM(os, rp)) || !(ts = sym->sl_sect) ||
+		    (ts->os_flags & SECTION_DISCARD) || !ts->os_order ||
+		    (gc_sections && !(ts->os_flags & SECTION_USED)))
+			continue;
+
+		if (ehf->ehf_nfdes == ehf->ehf_maxfdes) {
+			ehf->ehf_maxfdes = ehf->ehf_maxfdes?
+			    ehf->ehf_maxfdes * 2 : 256;
+			if (!(ehf->ehf_fdes = reallocarray(ehf->ehf_fdes,
+			    ehf->ehf_maxfdes, sizeof *ehf->ehf_fdes)))
+				err(1, "reallocarray");
+		}
+		ef = &ehf->ehf_fdes[ehf->ehf_nfdes++];
+		ef->ef_os = os;
+		ef->ef_off = p - data;
+		ef->ef_sym = sym;
+		if (os->os_flags & SECTION_RELA)
+			ef->ef_addend = rp->rl_addend;
+		else {
+			/* the addend is in place */
+			v = elf_ehget(body + 4, sz);
+			if ((cies[i].enc & DW_EH_PE_signed) && sz < 8 &&
+			    (v & (1ULL << (8 * sz - 1))))
+				v |= ~0ULL << (8 * sz);
+			ef->ef_addend = v;
+		}
+	}
+	free(cies);
+	return 0;
+bad:
+	free(cies);
+	return -1;
+}
+
+int
+elf_ehfrcmp(const void *a, const void *b)
+{
+	const struct ehfde *ea = a, *eb = b;
+
+	if (ea->ef_pc != eb->ef_pc)
+		return ea->ef_pc < eb->ef_pc? -1 : 1;
+
+	return ea->ef_addr < eb->ef_addr? -1 : ea->ef_addr > eb->ef_addr;
+}
+
+/*
+ * now that everything is mapped fill in the .eh_frame_hdr
+ */
+void
+elf_ehfrfill(struct ehframe *ehf)
+{
+	struct ldorder *ord = ehf->ehf_hdr;
+	struct ehfde *ef;
+	struct symlist *sym;
+	uint64_t hdr;
+	int64_t pc, fde;
+	uint8_t *p;
+
+	hdr = ord->ldo_start;
+	for (ef = ehf->ehf_fdes; ef < ehf->ehf_fdes + ehf->ehf_nfdes; ef++) {
+		sym = ef->ef_sym;
+		if (sym->sl_name)
+			ef->ef_pc = ELF_SYM(sym->sl_elfsym).st_value;
+		else
+			ef->ef_pc = ((Elf_Shdr *)sym->sl_sect->os_sect)->sh_addr;
+		ef->ef_pc += ef->ef_addend;
+		ef->ef_addr = ((Elf_Shdr *)ef->ef_os->os_sect)->sh_addr +
+		    ef->ef_off;
+	}
+	qsort(ehf->ehf_fdes, ehf->ehf_nfdes, sizeof *ehf->ehf_fdes,
+	    elf_ehfrcmp);
+
+	p = ord->ldo_wurst;
+	p[0] = 1;	/* version */
+	p[1] = DW_EH_PE_pcrel | DW_EH_PE_sdata4;
+	p[2] = DW_EH_PE_udata4;
+	p[3] = DW_EH_PE_datarel | DW_EH_PE_sdata4;
+	elf_ehput(p + 4, ehf->ehf_frame->ldo_start - (hdr + 4));
+	elf_ehput(p + 8, ehf->ehf_nfdes);
+	for (p += 12, ef = ehf->ehf_fdes; ef < ehf->ehf_fdes + ehf->ehf_nfdes;
+	    ef++, p += 8) {
+		pc = ef->ef_pc - hdr;
+		fde = ef->ef_addr - hdr;
+		if (pc != (int32_t)pc || fde != (int32_t)fde)
+			errx(1, "%s: out of range", ELF_EH_FRAME_H);
+		elf_ehput(p, pc);
+		elf_ehput(p + 4, fde);
+	}
+
+	free(ehf->ehf_fdes);
+	free(ehf);
+}
+
+/*
+ * replace whatever build-id notes came with the objects with our own;
+ * the id is left zeroed until the output is written and hashed.
+ */
+void
+elf_buildidnote(struct headorder *headorder)
+{
+	static struct section bidsect;
+	static Elf_Shdr bidshdr;
+	struct ldorder *ord;
+	uint8_t *p;
+	size_t len;
+
+	TAILQ_FOREACH(ord, headorder, ldo_entry)
+		if (ord->ldo_order == ldo_section &&
+		    !strcmp(ord->ldo_name, ELF_NOTE_BUILDID))
+			break;
+
+	if (!ord) {
+		if (build_id)
+			warnx("%s: no place for the note", ELF_NOTE_BUILDID);
+		return;
+	}
+
+	TAILQ_INIT(&ord->ldo_seclst);
+	if (!build_id)
+		return;
+
+	len = buildid_len();
+	if (!(p = calloc(1, 16 + len)))
+		err(1, "calloc");
+	elf_ehput(p, 4);
+	elf_ehput(p + 4, len);
+	elf_ehput(p + 8, NT_GNU_BUILD_ID);
+	memcpy(p + 12, "GNU", 4);
+
+	bidshdr.sh_type = SHT_NOTE;
+	bidshdr.sh_flags = SHF_ALLOC;
+	bidshdr.sh_size = 16 + len;
+	bidshdr.sh_addralign = 4;
+	bidsect.os_obj = &sysobj;
+	bidsect.os_name = ELF_NOTE_BUILDID;
+	bidsect.os_order = ord;
+	bidsect.os_sect = &bidshdr;
+	bidsect.os_data = p;
+	bidsect.os_flags = SECTION_ORDER | SECTION_USED;
+	SYMQ_INIT(&bidsect.os_syms);
+	TAILQ_INSERT_TAIL(&ord->ldo_seclst, &bidsect, os_entry);
+}
+
+/*
+ * produce actual a.out
+ * scan through the orders and sections messing the bits
+ * and the headers; give special treatment to the symtab
+ */
+int
+ldload(const char *name, struct ldorder *order)
+{
+	struct stat sb;
+	char obuf[ELF_OBUFSZ];
+	struct ldorder *ord;
+	struct section *os;
+	Elf_Ehdr *eh;
+	Elf_Phdr *phdr;
+	Elf_Shdr *shdr;
+	off_t bidoff = 0, size;
+	FILE *fp;
+
+	if (!order || errors)
+		return 1;
+
+	eh = &ELF_HDR(sysobj.ol_hdr);
+
+	if (!(fp = fopen(name, "w+")))
+		err(1, "fopen: %s", name);
+	setvbuf(fp, obuf, _IOFBF, sizeof obuf);
+
+	/*
+	 * the size is known by now thus have the output in one piece;
+	 * where the filesystem would not the zero gaps are left as holes.
+	 */
+	size = eh->e_shoff + sysobj.ol_nsect * sizeof *shdr;
+	for (ord = order; ord != TAILQ_END(ord);
+	    ord = TAILQ_NEXT(ord, ldo_entry)) {
+		if (ord->ldo_order == ldo_symbol ||
+		    ord->ldo_order == ldo_expr ||
+		    ord->ldo_type == SHT_NOBITS ||
+		    (ord->ldo_flags & LD_ZDEBUG))
+			continue;
+
+		shdr = ord->ldo_sect->os_sect;
+		size = MAX(size,
+		    shdr->sh_offset + (ord->ldo_addr - ord->ldo_start));
+	}
+	if (fstat(fileno(fp), &sb) < 0)
+		err(1, "fstat: %s", name);
+	/* devices and pipes are written as they go */
+	if (S_ISREG(sb.st_mode) &&
+	    (errno = posix_fallocate(fileno(fp), 0, size))) {
+		if (errno != EINVAL && errno != EOPNOTSUPP && errno != ENOSYS)
+			err(1, "posix_fallocate: %s", name);
+		if (ftruncate(fileno(fp), size) < 0)
+			err(1, "ftruncate: %s", name);
+	}
+
+	/* dump out sections */
+	for (ord = order; ord != TAILQ_END(ord);
+	    ord = TAILQ_NEXT(ord, ldo_entry)) {
+		const char *inname = NULL;
+		FILE *sfp = NULL;
+
+		if (ord->ldo_order == ldo_symbol ||
+		    ord->ldo_order == ldo_expr)
+			continue;
+
+		shdr = ord->ldo_sect->os_sect;
+		if (shdr->sh_flags & SHF_ALLOC)
+			shdr->sh_addr = ord->ldo_start;
+		shdr->sh_size = ord->ldo_addr - ord->ldo_start;
+
+		/* nothing to write */
+		if (ord->ldo_type == SHT_NOBITS)
+			continue;
+
+		if (ord->ldo_flags & LD_ZDEBUG) {
+			if (elf_zdebug(name, ord))
+				return -1;
+			continue;
+		}
+
+		if (elf_seek(fp, shdr->sh_offset, ord->ldo_filler) < 0)
+			err(1, "elf_seek: %s", name);
+
+		/* done w/ meat -- generate symbols */
+		if (ord->ldo_type == SHT_SYMTAB) {
+			stat_begin("symtab");
+			if (relocatable) {
+				if (fseek(fp, sizeof(Elf_Sym), SEEK_CUR) < 0)
+					err(1, "fseek: %s", name);
+				elf_relsymwrite(fp, name, ord);
+			} else
+				elf_symout(fp, name, ord);
+			stat_end();
+			continue;
+		}
+
+		if (ord->ldo_order == ldo_reloc) {
+			elf_relwrite(fp, name, ord);
+			continue;
+		}
+
+		/* the id goes in last */
+		if (build_id && !relocatable &&
+		    !strcmp(ord->ldo_name, ELF_NOTE_BUILDID) &&
+		    (os = TAILQ_FIRST(&ord->ldo_seclst)))
+			bidoff = ((Elf_Shdr *)os->os_sect)->sh_offset + 16;
+
+		if (ord->ldo_flags & LD_CONTAINS) {
+			if (fwrite(ord->ldo_wurst, ord->ldo_wsize, 1, fp) != 1)
+				err(1, "fwrite: %s", name);
+
+			continue;
+		}
+
+		/*
 		 * scan thru the sections alike and dump 'em all out
 		 * into the a.out;
 		 * either dump per object or per order depending
@@ -706,7 +2798,7 @@ ldload(const char *name, struct ldorder *order)
 		TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry) {
 			struct section *osp, *esp;
 
-			if (inname != os->os_obj->ol_path) {
+			if (!os->os_data && inname != os->os_obj->ol_path) {
 				if (sfp)
 					fclose(sfp);
 				inname = os->os_obj->ol_path;
@@ -735,15 +2827,42 @@ osp = os;
 		}
 	}
 
+	/* the compressed debugging goes past everything else */
+	if (compress_debug && !relocatable) {
+		off_t eof;
+
+		if (fseeko(fp, 0, SEEK_END) < 0)
+			err(1, "fseeko: %s", name);
+		eof = MAX(ftello(fp),
+		    (off_t)(eh->e_shoff + eh->e_shnum * sizeof *shdr));
+		for (ord = order; ord != TAILQ_END(ord);
+		    ord = TAILQ_NEXT(ord, ldo_entry)) {
+			if (!(ord->ldo_flags & LD_ZDEBUG))
+				continue;
+
+			shdr = ord->ldo_sect->os_sect;
+			shdr->sh_offset = eof = roundup(eof, ELF_ADDRALIGN);
+			shdr->sh_size = ord->ldo_wsize;
+			if (elf_seek(fp, eof, ord->ldo_filler) < 0)
+				err(1, "elf_seek: %s", name);
+			if (fwrite(ord->ldo_wurst, ord->ldo_wsize, 1, fp) != 1)
+				err(1, "fwrite: %s", name);
+			eof += ord->ldo_wsize;
+			free(ord->ldo_wurst);
+			ord->ldo_wurst = NULL;
+		}
+	}
+
 	shdr = sysobj.ol_sects;
 	elf_fix_shdrs(eh, shdr);
 	if (elf_save_shdrs(name, fp, 0, eh, shdr))
 		return -1;
 
-	phdr = sysobj.ol_aux;
-	elf_fix_phdrs(eh, phdr);
-	if (elf_save_phdrs(name, fp, 0, eh, phdr))
-		return -1;
+	if ((phdr = sysobj.ol_aux)) {
+		elf_fix_phdrs(eh, phdr);
+		if (elf_save_phdrs(name, fp, 0, eh, phdr))
+			return -1;
+	}
 
 	rewind(fp);
 
@@ -751,12 +2870,29 @@ osp = os;
 	if (fwrite(eh, sizeof *eh, 1, fp) != 1)
 		err(1, "fwrite: %s", name);
 
+	if (fflush(fp) == EOF)
+		err(1, "fflush: %s", name);
 	if (fstat(fileno(fp), &sb))
 		err(1, "stat: %s", name);
+	stat_count(LD_ST_WRITTEN, sb.st_size);
+
+	/* hash the whole output with the id zeroed and patch it in */
+	if (bidoff && S_ISREG(sb.st_mode)) {
+		u_char id[LD_BUILDID_MAX];
+
+		stat_begin("build-id");
+		buildid_hash(name, fileno(fp), sb.st_size, id);
+		if (pwrite(fileno(fp), id, buildid_len(), bidoff) !=
+		    buildid_len())
+			err(1, "pwrite: %s", name);
+		stat_end();
+	}
 
-	sb.st_mode |= (S_IXUSR|S_IXGRP|S_IXOTH) & ~umask(0);
-	if (fchmod(fileno(fp), sb.st_mode))
-		err(1, "fchmod: %s", name);
+	if (!relocatable && S_ISREG(sb.st_mode)) {
+		sb.st_mode |= (S_IXUSR|S_IXGRP|S_IXOTH) & ~umask(0);
+		if (fchmod(fileno(fp), sb.st_mode))
+			err(1, "fchmod: %s", name);
+	}
 
 	fclose(fp);
 
@@ -764,6 +2900,73 @@ osp = os;
 	return 0;
 }
 
+/*
+ * produce the contents of a debugging order in memory and
+ * compress them into the ldo_wurst prefixed with the Elf_Chdr;
+ * the empty ones are left as they are.
+ */
+int
+elf_zdebug(const char *name, struct ldorder *ord)
+{
+	Elf_Shdr *shdr = ord->ldo_sect->os_sect;
+	const char *inname = NULL;
+	struct section *os;
+	FILE *sfp = NULL, *zfp;
+	u_char *buf, *p;
+	size_t zlen;
+
+	if (!shdr->sh_size) {
+		ord->ldo_flags &= ~LD_ZDEBUG;
+		return 0;
+	}
+
+	if (!(buf = calloc(1, shdr->sh_size)))
+		err(1, "calloc");
+	if (!(zfp = fmemopen(buf, shdr->sh_size, "r+")))
+		err(1, "fmemopen");
+
+	TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry) {
+		if (!os->os_data && inname != os->os_obj->ol_path) {
+			if (sfp)
+				fclose(sfp);
+			inname = os->os_obj->ol_path;
+			if (!(sfp = fopen(inname, "r")))
+				err(1, "fopen: %s", inname);
+		}
+
+		if (!(os->os_flags & SECTION_LOADED) &&
+		    ldloadasect(sfp, zfp, name, ord, os)) {
+			fclose(zfp);
+			free(buf);
+			return -1;
+		}
+		os->os_flags |= SECTION_LOADED;
+	}
+	if (sfp)
+		fclose(sfp);
+	if (fclose(zfp) == EOF)
+		err(1, "fclose: %s", name);
+
+	p = zdebug_deflate(buf, shdr->sh_size, sizeof(Elf_Chdr), &zlen);
+	memset(p, 0, sizeof(Elf_Chdr));
+	elf_ehput(p, ELFCOMPRESS_ZLIB);
+#if ELFSIZE == 32
+	elf_ehput(p + 4, shdr->sh_size);
+	elf_ehput(p + 8, shdr->sh_addralign);
+#else
+	elf_ehput(p + (endian == ELFDATA2LSB? 8 : 12), shdr->sh_size);
+	elf_ehput(p + (endian == ELFDATA2LSB? 12 : 8), shdr->sh_size >> 32);
+	elf_ehput(p + (endian == ELFDATA2LSB? 16 : 20), shdr->sh_addralign);
+#endif
+	free(buf);
+
+	shdr->sh_flags |= SHF_COMPRESSED;
+	shdr->sh_addralign = ELF_ADDRALIGN;
+	ord->ldo_wurst = p;
+	ord->ldo_wsize = zlen;
+	return 0;
+}
+
 /*
  * load one section from one object fixing relocs;
  * luckily we might fit all data in one buffer and loops are small (;
@@ -780,24 +2983,45 @@ ldloadasect(FILE *fp, FILE *ofp, const char *name, const struct ldorder *ord,
 	if (elf_seek(ofp, shdr->sh_offset, ord->ldo_filler) < 0)
 		err(1, "elf_seek: %s", name);
 
+	/* merged contents have no relocs to fix */
+	if (os->os_data) {
+		if (shdr->sh_size &&
+		    fwrite(os->os_data, shdr->sh_size, 1, ofp) != 1)
+			err(1, "fwrite: %s", name);
+		return (0);
+	}
+
 	if (fseeko(fp, os->os_off, SEEK_SET) < 0)
 		err(1, "fseeko: %s", os->os_obj->ol_name);
 
+	/* lowmem reads them again just for now */
+	if (!relocatable)
+		elf_relget(os, fileno(fp));
+
 	for (sl = shdr->sh_size, off = 0, bof = 0; off < sl; off += len) {
+		/* the carried bytes have been read already */
 		len = sizeof sbuf - bof;
-		if (len > sl - off)
-			len = sl - off;
+		if (len > sl - off - bof)
+			len = sl - off - bof;
 		if (fread(sbuf + bof, len, 1, fp) != 1) {
 			if (feof(fp))
 				errx(1, "fread: %s: EOF", os->os_obj->ol_name);
 			else
 				err(1, "fread: %s", os->os_obj->ol_name);
 		}
+		stat_count(LD_ST_READ, len);
 		len += bof;
-		bof = ord->ldo_arch->la_fix(off, os, sbuf, len);
-		if (bof < 0 || bof >= ELF_SBUFSZ)
+		/* the relocatable output keeps the relocations instead */
+		if (relocatable)
+			bof = 0;
+		else if (ord->ldo_flags & LD_DEBUG)
+			bof = elf_dbgfix(ord, off, os, sbuf, len);
+		else
+			bof = ord->ldo_arch->la_fix(off, os, sbuf, len);
+		if (bof < 0 || bof >= ELF_SBUFSZ) {
+			elf_relput(os);
 			return -1;
-		else {
+		} else {
 			if (fwrite(sbuf, len - bof, 1, ofp) != 1)
 				err(1, "fwrite: %s", name);
 			if (bof) {
@@ -806,126 +3030,328 @@ ldloadasect(FILE *fp, FILE *ofp, const char *name, const struct ldorder *ord,
 			}
 		}
 	}
+	elf_relput(os);
 
 	return (0);
 }
 
 /*
- * load the relocations for the section;
- * resolve symbol references and sort out relocs
- * according to the address as required by the loader
+ * fix the relocations in the debugging sections;
+ * these are only the absolute addresses and offsets
+ * thus streamed through here rather than the arch engine
+ * keeping the place in the relocations on the section.
+ * the ones against the sections gone resolve to zero.
  */
 int
-elf_loadrelocs(struct objlist *ol, struct section *os, Elf_Shdr *shdr,
-    FILE *fp, off_t foff)
+elf_dbgfix(const struct ldorder *ord, off_t off, struct section *os,
+    char *sbuf, int len)
+{
+	struct relist *rp, *erp = os->os_rels + os->os_nrls;
+	struct objlist *ol = os->os_obj;
+	struct symlist *sym;
+	struct section *ts, *ms;
+	uint64_t v;
+	uint8_t *p;
+	int n, isrel;
+
+	isrel = os->os_nrls &&
+	    ((Elf_Shdr *)os->os_sect + 1)->sh_type == SHT_REL;
+	if (!os->os_rp || !off)
+		os->os_rp = os->os_rels;
+	for (rp = os->os_rp; rp < erp && rp->rl_addr < off; rp++)
+		;
+
+	for (; rp < erp && rp->rl_addr < off + len; rp++) {
+		if (!(n = ord->ldo_arch->la_dbgrel(rp->rl_type)))
+			errx(1, "%s: unsupported reloc type %d in %s",
+			    os->os_obj->ol_name, rp->rl_type, os->os_name);
+
+		/* straddles the buffer; done in the next one */
+		if (rp->rl_addr + n > off + len)
+			break;
+
+		p = (uint8_t *)sbuf + (rp->rl_addr - off);
+		sym = RL_SYM(os, rp);
+		ts = sym? sym->sl_sect : NULL;
+		if (!sym || (ts && ((ts->os_flags & SECTION_DISCARD) ||
+		    (gc_sections && !(ts->os_flags & SECTION_USED)))))
+			v = 0;
+		else if (isrel && !sym->sl_name && ts && (ms = &ol->
+		    ol_sections[ELF_SYM(sym->sl_elfsym).st_shndx])->os_merged) {
+			/* the piece offset is only known in place */
+			v = ((Elf_Shdr *)ts->os_sect)->sh_addr +
+			    elf_mergeoff(ms, elf_ehget(p, n));
+		} else {
+			if (sym->sl_name)
+				v = ELF_SYM(sym->sl_elfsym).st_value;
+			else if (ts)
+				v = ((Elf_Shdr *)ts->os_sect)->sh_addr;
+			else
+				v = 0;
+			v += rp->rl_addend + elf_ehget(p, n);
+		}
+		elf_putn(p, v, n);
+	}
+
+	os->os_rp = rp;
+	return rp < erp && rp->rl_addr < off + len? off + len - rp->rl_addr : 0;
+}
+
+/*
+ * read the relocations for the section;
+ * the whole section is read at once and converted in place
+ * then sorted by the address as required by the loader
+ * (unless it was sorted already which is most often the case).
+ */
+struct relist *
+elf_readrelocs(struct objlist *ol, struct section *os, Elf_Shdr *shdr,
+    int fd, off_t foff, size_t *np)
 {
-	off_t off;
 	Elf_Ehdr *eh = &ELF_HDR(ol->ol_hdr);
-	struct relist *r;
-	int i, n, sz;
+	Elf_Shdr *shbits = os->os_sect;
+	struct relist *rels, *r;
+	Elf_RelA *rela;
+	uint64_t last;
+	char *buf, *p;
+	size_t i, n, sz, esz;
+	u_long si;
+	int isrela, sorted;
+
+	isrela = shdr->sh_type == SHT_RELA;
+	sz = isrela? sizeof(Elf_RelA) : sizeof(Elf_Rel);
+	if (sz > (esz = shdr->sh_entsize))
+		errx(1, "%s: corrupt elf header", ol->ol_path);
+	if (!(*np = n = shdr->sh_size / esz))
+		return NULL;
+
+	if (!(buf = malloc(n * esz)))
+		err(1, "malloc");
+
+	if (pread(fd, buf, n * esz, foff + shdr->sh_offset) !=
+	    (ssize_t)(n * esz))
+		err(1, "pread: %s", ol->ol_path);
+	stat_count(LD_ST_READ, n * esz);
+
+	if (isrela)
+		elf_fix_relas(eh, buf, n, esz);
+	else
+		elf_fix_rels(eh, buf, n, esz);
+
+	if (!(rels = r = reallocarray(NULL, n, sizeof *r)))
+		err(1, "reallocarray");
+
+	sorted = 1;
+	last = 0;
+	for (i = 0, p = buf; i < n; i++, r++, p += esz) {
+		/* the rel is the head of the rela */
+		rela = (Elf_RelA *)p;
+		if ((si = ELF_R_SYM(rela->r_info)) >= ol->ol_nsyms)
+			errx(1, "%s: invalid reloc #%zu 0x%x",
+			    ol->ol_path, i, (unsigned)rela->r_info);
+		if (rela->r_offset > shbits->sh_size)
+			errx(1, "%s: reloc #%zu offset 0x%llx is out of range",
+			    ol->ol_path, i, (quad_t)rela->r_offset);
+
+		/* the symbol is only known once the object is merged */
+		r->rl_si = si;
+		r->rl_type = ELF_R_TYPE(rela->r_info);
+		r->rl_addr = rela->r_offset;
+		/* we assume that r_addend is added last */
+		r->rl_addend = isrela? rela->r_addend : 0;
+
+		if (r->rl_addr < last)
+			sorted = 0;
+		last = r->rl_addr;
+	}
+	free(buf);
+
+	/* we gotta sort them by addr if they come unsorted */
+	if (!sorted)
+		rel_sort(rels, n);
+
+	return rels;
+}
 
-	off = ftello(fp);
-	if (fseeko(fp, foff + shdr->sh_offset, SEEK_SET) < 0)
-		err(1, "fseeko: %s", ol->ol_path);
+/*
+ * the first stage of loading only takes the count of the relocations;
+ * they are read later for the sections that are still in the link
+ * (see elf_relload()) thus the members pulled for a single symbol
+ * or dropped by the gc cost none.
+ */
+int
+elf_loadrelocs(struct objlist *ol, struct section *os, Elf_Shdr *shdr)
+{
+	size_t sz;
 
-	sz = shdr->sh_type == SHT_REL? sizeof(Elf_Rel) : sizeof(Elf_RelA);
+	sz = shdr->sh_type == SHT_RELA? sizeof(Elf_RelA) : sizeof(Elf_Rel);
 	if (sz > shdr->sh_entsize)
 		errx(1, "%s: corrupt elf header", ol->ol_path);
-	sz = shdr->sh_entsize - sz;
-	n = shdr->sh_size / shdr->sh_entsize;
-	if (!(r = calloc(n, sizeof *r)))
-		err(1, "calloc");
 
-	os->os_rels = r;
-	os->os_nrls = n;
-	if (shdr->sh_type == SHT_REL) {
-		Elf_Rel rel;
+	if (!(os->os_nrls = shdr->sh_size / shdr->sh_entsize))
+		return 0;
+
+	if (shdr->sh_type == SHT_RELA)
+		os->os_flags |= SECTION_RELA;
 
-		for (i = 0; i < n; i++, r++) {
-			if (fread(&rel, sizeof rel, 1, fp) != 1)
-				err(1, "fread: %s", ol->ol_path);
+	return 0;
+}
 
-			if (sz && fseeko(fp, sz, SEEK_CUR))
-				err(1, "fseeko: %s", ol->ol_path);
+struct relload {
+	struct section **rd_sects;
+	int rd_fds[LD_MAXTHREADS];	/* per worker cache */
+	const char *rd_paths[LD_MAXTHREADS];
+};
 
-			elf_fix_rel(eh, &rel);
-			elf_addreloc(ol, os, r, &rel, 0);
-		}
-	} else {
-		Elf_RelA rela;
+/*
+ * by the file and the offset in it
+ */
+int
+elf_relloadcmp(const void *a, const void *b)
+{
+	const struct section *sa = *(struct section * const *)a;
+	const struct section *sb = *(struct section * const *)b;
+	int rv;
 
-		for (i = 0; i < n; i++, r++) {
-			if (fread(&rela, sizeof rela, 1, fp) != 1)
-				err(1, "fread: %s", ol->ol_path);
+	if (sa->os_obj != sb->os_obj &&
+	    (rv = strcmp(sa->os_obj->ol_path, sb->os_obj->ol_path)))
+		return rv;
 
-			if (sz && fseeko(fp, sz, SEEK_CUR))
-				err(1, "fseeko: %s", ol->ol_path);
+	return sa->os_off < sb->os_off? -1 : sa->os_off > sb->os_off;
+}
 
-			elf_fix_rela(eh, &rela);
-			/* we assume that r_addend is added last */
-			elf_addreloc(ol, os, r,
-			    (Elf_Rel *)&rela, rela.r_addend);
-		}
+void
+elf_relloadone(void *v, int i, int w)
+{
+	struct relload *rd = v;
+	struct section *os = rd->rd_sects[i];
+
+	if (os->os_rels || !os->os_nrls)
+		return;
+
+	if (rd->rd_paths[w] != os->os_obj->ol_path) {
+		if (rd->rd_paths[w])
+			close(rd->rd_fds[w]);
+		rd->rd_paths[w] = os->os_obj->ol_path;
+		if ((rd->rd_fds[w] = open(rd->rd_paths[w], O_RDONLY)) < 0)
+			err(1, "open: %s", rd->rd_paths[w]);
 	}
 
-	if (fseeko(fp, off, SEEK_SET) < 0)
-		err(1, "fseeko: %s", ol->ol_path);
+	elf_relget(os, rd->rd_fds[w]);
+	stat_count(LD_ST_RELS, os->os_nrls);
+}
 
-	/* we gotta sort them by addr as they come unsorted */
-	qsort(os->os_rels, os->os_nrls, sizeof *os->os_rels, rel_addrcmp);
+/*
+ * the second stage of loading: read the relocations for the sections;
+ * sorted by the object so the workers mostly keep the file open
+ * and read through it forward.
+ */
+void
+elf_relload(struct section **sects, size_t n)
+{
+	struct relload rd;
+	int j;
+
+	if (!n)
+		return;
+
+	qsort(sects, n, sizeof *sects, elf_relloadcmp);
+	memset(&rd, 0, sizeof rd);
+	rd.rd_sects = sects;
+	pool_run(n, elf_relloadone, &rd);
+	for (j = 0; j < LD_MAXTHREADS; j++)
+		if (rd.rd_paths[j])
+			close(rd.rd_fds[j]);
+}
 
-	return 0;
+/*
+ * the relocations for all the sections left in the order
+ */
+void
+elf_relorder(struct headorder *headorder)
+{
+	struct ldorder *ord;
+	struct section *os, **sects;
+	size_t n, maxn;
+
+	n = maxn = 0;
+	sects = NULL;
+	TAILQ_FOREACH(ord, headorder, ldo_entry) {
+		if (ord->ldo_order != ldo_section)
+			continue;
+
+		TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry) {
+			if (os->os_rels || !os->os_nrls)
+				continue;
+
+			if (n == maxn) {
+				maxn = maxn? maxn * 2 : 256;
+				if (!(sects = reallocarray(sects, maxn,
+				    sizeof *sects)))
+					err(1, "reallocarray");
+			}
+			sects[n++] = os;
+		}
+	}
+
+	elf_relload(sects, n);
+	free(sects);
 }
 
-int
-elf_addreloc(struct objlist *ol, struct section *os, struct relist *r,
-    Elf_Rel *rel, uint64_t addend)
+/*
+ * make the relocations available for the output;
+ * with the lowmem they are read from the input again and
+ * the relocations against the merged sections are moved
+ * onto the pieces now (see elf_mergefix()).
+ * fd is open on the object file.
+ */
+struct relist *
+elf_relget(struct section *os, int fd)
 {
-	struct symlist *sym, **sidx = ol->ol_aux;
-	Elf_Shdr *shbits = os->os_sect;
-	Elf_Sym *esym;
-	const char *snam;
-	int si;
+	struct objlist *ol = os->os_obj;
+	struct relist *rp, *erp;
+	struct section *ms;
+	struct symlist *sym;
+	uint8_t *data = NULL;
+	size_t n;
 
-	if ((si = ELF_R_SYM(rel->r_info)) >= ol->ol_naux)
-		errx(1, "%s: invalid reloc #%ld 0x%x",
-		    ol->ol_path, r - os->os_rels, (unsigned)rel->r_info);
-	if (rel->r_offset > shbits->sh_size)
-		errx(1, "%s: reloc #%ld offset 0x%llx is out of range",
-		    ol->ol_path, r - os->os_rels, (quad_t)rel->r_offset);
+	if (os->os_rels || !os->os_nrls)
+		return os->os_rels;
 
-	sym = sidx[si];
-	esym = &ELF_SYM(sym->sl_elfsym);
+	os->os_rels = elf_readrelocs(ol, os, (Elf_Shdr *)os->os_sect + 1,
+	    fd, ol->ol_off, &n);
+	if (n != os->os_nrls)
+		errx(1, "%s: relocations have changed", ol->ol_name);
 
-#if 0
-	/*
-	 * replace local compiler-generated symbols
-	 * with section-relative and remove from the symtab
-	 */
-	snam = sym->sl_name;
-	if (ELF_ST_BIND(esym->st_info) == STB_LOCAL && *snam &&
-	    (Xflag == 2 || (*snam == 'L') ||
-	     (snam[0] == '.' && snam[1] == 'L'))) {
-		int j;
-		for (j = 1; j < ol->ol_nsect; j++)
-			if (ELF_ST_TYPE(ELF_SYM(sidx[j]->sl_elfsym).st_info) == STT_SECTION &&
-			    ELF_SYM(sidx[j]->sl_elfsym).st_shndx == esym->st_shndx)
-				break;
-		if (j == ol->ol_nsect)
-			errx(1, "%s: reloc for local symbol "
-			    "\"%s\" without section %d",
-			    ol->ol_path, snam, esym->st_shndx);
-		addend += esym->st_value;
-		sym_remove(sym);
-		sidx[si = j] = sym = sidx[j];
+	for (rp = os->os_rels, erp = rp + n; !relocatable && rp < erp; rp++) {
+		sym = RL_SYM(os, rp);
+		if (!sym || sym->sl_name || !sym->sl_sect)
+			continue;
+
+		ms = &ol->ol_sections[ELF_SYM(sym->sl_elfsym).st_shndx];
+		if (!ms->os_merged)
+			continue;
+		if (!elf_relinplace(os))
+			rp->rl_addend = elf_mergeoff(ms, rp->rl_addend);
+		else
+			rp->rl_addend = elf_mergerel(os, rp, ms, fd, &data);
 	}
-#endif
+	free(data);
 
-	r->rl_sym = sym;
-	r->rl_addr = rel->r_offset;
-	r->rl_addend = addend;
-	r->rl_type = ELF_R_TYPE(rel->r_info);
-	return 0;
+	return os->os_rels;
+}
+
+/*
+ * done with the relocations for the output
+ */
+void
+elf_relput(struct section *os)
+{
+	if (!lowmem)
+		return;
+
+	free(os->os_rels);
+	os->os_rels = NULL;
+	os->os_rp = NULL;
 }
 
 /*
@@ -946,13 +3372,11 @@ elf_symadd(struct elf_symtab *es, int is, void *vs, void *v)
 	if (!is && esym->st_shndx == SHN_UNDEF && esym->st_name == 0)
 		return 0;
 
-	/* allocate symindex */
-	if (!ol->ol_aux) {
-		if (!(ol->ol_aux = calloc(es->nsyms, sizeof sidx[0])))
-			err(1, "calloc");
-		ol->ol_naux = es->nsyms;
-	}
-	sidx = ol->ol_aux;
+	/* allocate symindex; kept for the relocations to refer to */
+	if (!ol->ol_sidx &&
+	    !(ol->ol_sidx = calloc(es->nsyms, sizeof sidx[0])))
+		err(1, "calloc");
+	sidx = ol->ol_sidx;
 
 	/* skip file names and size defs */
 	if (ELF_ST_TYPE(esym->st_info) == STT_FILE)
@@ -975,14 +3399,11 @@ elf_symadd(struct elf_symtab *es, int is, void *vs, void *v)
 
 	if (ELF_ST_TYPE(esym->st_info) == STT_SECTION) {
 		if (esym->st_shndx >= ol->ol_nsect)
-			errx(1, "%s: corrupt symbol table", es->name);
-
-		if (!(sym = calloc(1, sizeof *sym)))
-			err(1, "calloc");
+			errx(1, "%s: corrupt symbol table", es->name);
 
+		sym = sym_new(NULL);
 		ELF_SYM(sym->sl_elfsym) = *esym;
 		sym->sl_sect = ol->ol_sections + esym->st_shndx;
-		sym->sl_name = NULL;
 		sidx[is] = sym;
 		return 0;
 	}
@@ -1030,12 +3451,18 @@ if (is && *name == '\0') {
 	switch (esym->st_shndx) {
 	case SHN_UNDEF:
 		if (!sym && !(sym = sym_isundef(name))) {
-			/* weak undef is a weak abs with NULL addr */
-			if (ELF_ST_BIND(esym->st_info) == STB_WEAK)
+			/*
+			 * weak undef is a weak abs with NULL addr
+			 * unless it is left for the final link
+			 */
+			if (ELF_ST_BIND(esym->st_info) == STB_WEAK &&
+			    !relocatable)
 				sym = elf_absadd(name, STB_WEAK);
 			else {
 				sym = sym_undef(name);
 				sym->sl_sect = ol->ol_sections;
+				ELF_SYM(sym->sl_elfsym).st_info =
+				    esym->st_info;
 			}
 		}
 		break;
@@ -1083,9 +3510,9 @@ if (is && *name == '\0') {
 			if (ELF_ST_BIND(esym->st_info) == STB_LOCAL) {
 				laname = NULL;
 				do {
-					if (sym->sl_next == INT_MAX)
+					if (sym->sl_next == UINT32_MAX)
 						errx(1, "static overflow");
-					if (asprintf(&name, "%s.%ld", name,
+					if (asprintf(&name, "%s.%u", name,
 					    sym->sl_next++) < 0)
 						err(1, "asprintf");
 					if (laname)
@@ -1097,169 +3524,1079 @@ if (is && *name == '\0') {
 			} else if (ELF_ST_BIND(ELF_SYM(sym->sl_elfsym).st_info)
 			    == STB_LOCAL) {
 				char *nn;
-				if (asprintf(&nn, "%s.%ld", name,
+				if (asprintf(&nn, "%s.%u", name,
 				    sym->sl_next++) < 0)
 					err(1, "asprintf");
-				/* discard const */
-				/*
-				 * here we assume that the new name would
-				 * not change the symbol tree order
-				 * (since names like this did not exist)
-				 */
-				laname = (char *)sym->sl_name;
-				sym->sl_name = nn;
+				sym_rename(sym, nn);
+				laname = nn;
 				sym = NULL;
 			}
 		}
 
-		if (sym &&
-		    ELF_ST_BIND(ELF_SYM(sym->sl_elfsym).st_info) == STB_WEAK)
-			sym = sym_redef(sym, os, esym);
-		else if (sym && ELF_SYM(sym->sl_elfsym).st_shndx == SHN_COMMON)
-			sym = sym_redef(sym, os, esym);
-		else if (sym)
-			warnx("%s: %s: already defined in %s",
-			    ol->ol_path, name,
-			    sym->sl_sect->os_obj->ol_path);
-		else if ((sym = sym_isundef(name)))
-			sym = sym_define(sym, os, vs);
-		else
-			sym = sym_add(name, os, vs);
-		if (laname)
-			free(laname);
+		if (sym &&
+		    ELF_ST_BIND(ELF_SYM(sym->sl_elfsym).st_info) == STB_WEAK)
+			sym = sym_redef(sym, os, esym);
+		else if (sym && ELF_SYM(sym->sl_elfsym).st_shndx == SHN_COMMON)
+			sym = sym_redef(sym, os, esym);
+		else if (sym)
+			warnx("%s: %s: already defined in %s",
+			    ol->ol_path, name,
+			    sym->sl_sect->os_obj->ol_path);
+		else if ((sym = sym_isundef(name)))
+			sym = sym_define(sym, os, vs);
+		else
+			sym = sym_add(name, os, vs);
+		if (laname)
+			free(laname);
+	}
+
+	sidx[is] = sym;
+	if (cref && sym && ol) {
+		struct xreflist *xl;
+
+		if (!(xl = calloc(1, sizeof *xl)))
+			errx(1, "calloc");
+		xl->xl_obj = ol;
+		if (sym->sl_sect && sym->sl_sect->os_obj == ol)
+			TAILQ_INSERT_HEAD(sym_xref(sym), xl, xl_entry);
+		else
+			TAILQ_INSERT_TAIL(sym_xref(sym), xl, xl_entry);
+	}
+	return 0;
+}
+
+/*
+ * stash a symbol from the object until the object is merged;
+ * a hook called from elf_symload(3).
+ */
+int
+elf_symstage(struct elf_symtab *es, int is, void *vs, void *v)
+{
+	struct objlist *ol = v;
+	Elf_Sym *syms;
+	u_long i;
+
+	if (!ol->ol_syms) {
+		if (!(syms = calloc(es->nsyms, sizeof *syms)))
+			err(1, "calloc");
+		/* mark all as invalid; elf_symload(3) skips those */
+		for (i = 0; i < es->nsyms; i++)
+			syms[i].st_name = es->stabsz;
+		ol->ol_syms = syms;
+		ol->ol_nsyms = es->nsyms;
+	}
+	syms = ol->ol_syms;
+	syms[is] = *(Elf_Sym *)vs;
+
+	return 0;
+}
+
+/*
+ * load the section headers of an object and its section groups;
+ * the groups are resolved before the rest of the object is loaded
+ * so the sections of the duplicate groups are never loaded at all.
+ * this does not touch any global state either.
+ */
+int
+elf_objhead(struct objlist *ol, FILE *fp, off_t foff)
+{
+	struct section *os;
+	struct objgroup *og;
+	Elf_Ehdr *eh;
+	Elf_Shdr *shdr;
+	int i, n, ng;
+
+	eh = &ELF_HDR(ol->ol_hdr);
+	if (eh->e_type != ET_REL) {
+		warnx("%s: not a relocatable file", ol->ol_name);
+		return 1;
+	}
+
+	if (!(shdr = elf_load_shdrs(ol->ol_name, fp, foff, eh)))
+		return 1;
+	elf_fix_shdrs(eh, shdr);
+	ol->ol_sects = shdr;
+	stat_count(LD_ST_READ, sizeof *eh + eh->e_shnum * sizeof *shdr);
+
+	n = ol->ol_nsect = eh->e_shnum;
+	if (!(ol->ol_sections = calloc(n, sizeof(struct section))))
+		err(1, "calloc");
+
+	for (i = ng = 0, os = ol->ol_sections; i < n; os++, i++) {
+		os->os_no = i;
+		os->os_sect = &shdr[i];
+		os->os_obj = ol;
+		os->os_off = foff + shdr[i].sh_offset;
+		os->os_flags = shdr[i].sh_flags;
+		SYMQ_INIT(&os->os_syms);
+		if (shdr[i].sh_type == SHT_GROUP)
+			ng++;
+	}
+
+	if (!ng)
+		return 0;
+
+	if (!(og = calloc(ng, sizeof *og)))
+		err(1, "calloc");
+	ol->ol_groups = og;
+	for (i = 0; i < n; i++)
+		if (shdr[i].sh_type == SHT_GROUP &&
+		    !elf_objgroup(ol, og, &shdr[i], fp, foff))
+			og++;
+	ol->ol_ngroups = og - ol->ol_groups;
+
+	return 0;
+}
+
+/*
+ * load one COMDAT group: the member list and the signature
+ * (the name of the symbol referenced from the group header);
+ * other kinds of groups are not of any interest.
+ */
+int
+elf_objgroup(struct objlist *ol, struct objgroup *og, Elf_Shdr *gsh,
+    FILE *fp, off_t foff)
+{
+	Elf_Ehdr *eh = &ELF_HDR(ol->ol_hdr);
+	Elf_Shdr *ssh, *stsh;
+	Elf_Sym sym;
+	uint32_t *gw;
+	size_t i, n, len, cl;
+	char *sig;
+	int fd = fileno(fp);
+
+	n = gsh->sh_size / sizeof *gw;
+	if (n < 1 || gsh->sh_link >= ol->ol_nsect)
+		errx(1, "%s: corrupt section group", ol->ol_name);
+
+	if (!(gw = reallocarray(NULL, n, sizeof *gw)))
+		err(1, "reallocarray");
+	if (pread(fd, gw, n * sizeof *gw, foff + gsh->sh_offset) !=
+	    (ssize_t)(n * sizeof *gw))
+		err(1, "pread: %s", ol->ol_name);
+	stat_count(LD_ST_READ, n * sizeof *gw);
+	if (eh->e_ident[EI_DATA] != ELF_TARG_DATA)
+		for (i = 0; i < n; i++)
+			gw[i] = swap32(gw[i]);
+
+	if (!(gw[0] & GRP_COMDAT)) {
+		free(gw);
+		return 1;
+	}
+
+	/* fetch the signature symbol and its name */
+	ssh = (Elf_Shdr *)ol->ol_sects + gsh->sh_link;
+	if (gsh->sh_info >= ssh->sh_size / sizeof sym ||
+	    ssh->sh_link >= ol->ol_nsect)
+		errx(1, "%s: corrupt section group", ol->ol_name);
+	if (pread(fd, &sym, sizeof sym, foff + ssh->sh_offset +
+	    gsh->sh_info * sizeof sym) != sizeof sym)
+		err(1, "pread: %s", ol->ol_name);
+	elf_fix_sym(eh, &sym);
+
+	stsh = (Elf_Shdr *)ol->ol_sects + ssh->sh_link;
+	if (sym.st_name >= stsh->sh_size)
+		errx(1, "%s: corrupt section group", ol->ol_name);
+	/* read on in chunks up to the NUL; the table may not end with one */
+	sig = NULL;
+	len = 0;
+	do {
+		if (sym.st_name + len >= stsh->sh_size)
+			errx(1, "%s: corrupt section group", ol->ol_name);
+		cl = MIN(MAXPATHLEN, stsh->sh_size - sym.st_name - len);
+		if (!(sig = realloc(sig, len + cl)))
+			err(1, "realloc");
+		if (pread(fd, sig + len, cl, foff + stsh->sh_offset +
+		    sym.st_name + len) != (ssize_t)cl)
+			err(1, "pread: %s", ol->ol_name);
+		stat_count(LD_ST_READ, cl);
+		len += cl;
+	} while (!memchr(sig + len - cl, '\0', cl));
+
+	og->og_sig = sig;
+	og->og_nsects = n - 1;
+	og->og_sects = (int *)gw;
+	for (i = 1; i < n; i++) {
+		if (gw[i] >= ol->ol_nsect)
+			errx(1, "%s: corrupt section group", ol->ol_name);
+		og->og_sects[i - 1] = gw[i];
+	}
+
+	return 0;
+}
+
+/*
+ * load an object for the link editing order;
+ * load needed headers, raw symbols and relocations where available
+ * and sort out relocs by address.
+ * this does not touch any global state and thus can be run
+ * on many objects at once; see elf_objmerge() for the rest.
+ */
+int
+elf_objload(struct objlist *ol, FILE *fp, off_t foff)
+{
+	struct section *os;
+	struct elf_symtab es;
+	Elf_Ehdr *eh;
+	Elf_Shdr *shdr;
+	int i, n;
+
+	eh = &ELF_HDR(ol->ol_hdr);
+	shdr = ol->ol_sects;
+	n = ol->ol_nsect;
+
+	/* load symbol table */
+	es.name = ol->ol_name;
+	es.ehdr = eh;
+	es.shdr = shdr;
+	es.shstr = NULL;
+
+	if (elf_symload(&es, fp, foff, elf_symstage, ol))
+		return 1;
+	ol->ol_sects = es.shdr;
+	ol->ol_snames = es.shstr;
+	ol->ol_stab = es.stab;
+	ol->ol_stabsz = es.stabsz;
+	ol->ol_nsyms = es.nsyms;
+	stat_count(LD_ST_READ, es.stabsz + es.nsyms * sizeof(Elf_Sym));
+
+	/* scan thru the section list looking for progbits and relocs */
+	for (i = 0, os = ol->ol_sections; i < n; shdr++, os++, i++) {
+		os->os_name = ol->ol_snames + shdr->sh_name;
+		if (shdr->sh_type != SHT_PROGBITS)
+			continue;
+
+		/* lost to a group in another object */
+		if (os->os_flags & SECTION_DISCARD)
+			continue;
+
+		if (i + 1 >= n)
+			continue;
+
+		if (shdr[1].sh_type != SHT_RELA &&
+		    shdr[1].sh_type != SHT_REL)
+			continue;
+
+		if (elf_loadrelocs(ol, os, &shdr[1]))
+			continue;
+	}
+
+	return 0;
+}
+
+/*
+ * a section-less local resolving to zero; stands for the symbol #0
+ * and the locals of the discarded groups in the relocations
+ */
+static struct symlist elf_nullsym = { .sl_name = "" };
+
+/*
+ * merge a loaded object into the link editing order;
+ * resolve the staged symbols against other objects (as undefined)
+ * and link up the relocations with the resolved symbols.
+ * objects have to be merged in the command line order.
+ */
+int
+elf_objmerge(struct objlist *ol)
+{
+	struct section *os;
+	struct elf_symtab es;
+	Elf_Ehdr *eh;
+	Elf_Shdr *shdr;
+	Elf_Sym *syms;
+	u_long is;
+	int i, n;
+
+	eh = &ELF_HDR(ol->ol_hdr);
+	if (elf_ld_chkhdr(ol->ol_name, eh, ET_REL,
+	    &machine, &elfclass, &endian))
+		return 1;
+
+	/* groups claimed by the objects merged since loading */
+	if (obj_groups(ol, 1))
+		for (i = 0, os = ol->ol_sections; i < ol->ol_nsect; os++, i++)
+			if (os->os_flags & SECTION_DISCARD) {
+				free(os->os_rels);
+				os->os_rels = NULL;
+				os->os_nrls = 0;
+			}
+
+	es.name = ol->ol_name;
+	es.ehdr = eh;
+	es.shdr = ol->ol_sects;
+	es.shstr = ol->ol_snames;
+	es.stab = ol->ol_stab;
+	es.stabsz = ol->ol_stabsz;
+	es.nsyms = ol->ol_nsyms;
+
+	syms = ol->ol_syms;
+	for (is = 0; syms && is < ol->ol_nsyms; is++) {
+		Elf_Sym *esym = &syms[is];
+
+		if (esym->st_name >= es.stabsz)
+			continue;
+
+		/*
+		 * symbols from the discarded groups: locals are dropped
+		 * (the references left, say from .eh_frame, resolve to
+		 * zero) and the rest become references to the kept group
+		 */
+		if (esym->st_shndx != SHN_UNDEF &&
+		    esym->st_shndx < ol->ol_nsect &&
+		    (ol->ol_sections[esym->st_shndx].os_flags &
+		    SECTION_DISCARD)) {
+			if (ELF_ST_BIND(esym->st_info) == STB_LOCAL) {
+				if (!ol->ol_sidx && !(ol->ol_sidx =
+				    calloc(ol->ol_nsyms, sizeof *ol->ol_sidx)))
+					err(1, "calloc");
+				ol->ol_sidx[is] = &elf_nullsym;
+				continue;
+			}
+			esym->st_shndx = SHN_UNDEF;
+			esym->st_value = 0;
+			esym->st_size = 0;
+		}
+
+		if (elf_symadd(&es, is, esym, ol))
+			return 1;
+	}
+	/* and so do the relocations against no symbol at all */
+	if (ol->ol_sidx)
+		ol->ol_sidx[0] = &elf_nullsym;
+	free(ol->ol_syms);
+	ol->ol_syms = NULL;
+	free(ol->ol_stab);
+	ol->ol_stab = NULL;
+
+	n = ol->ol_nsect;
+	shdr = ol->ol_sects;
+	for (i = 0, os = ol->ol_sections; i < n; shdr++, os++, i++) {
+		if (shdr->sh_type == SHT_NOBITS &&
+		    !strcmp(os->os_name, ELF_BSS)) {
+			if (ol->ol_bss) {
+				warnx("%s: too many .bss sections",
+				    ol->ol_name);
+				errors++;
+			} else
+				ol->ol_bss = os;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * check if object is editable by linking;
+ * first object on the command line defines the machine
+ * and endianess whilst later ones have to match.
+ */
+int
+elf_ld_chkhdr(const char *path, Elf_Ehdr *eh, int type, int *mach,
+    int *class, int *endian)
+{
+
+	if (eh->e_type != type) {
+		warnx("%s: not a relocatable file", path);
+		return EFTYPE;
+	}
+
+	if (*mach == EM_NONE) {
+		*mach = eh->e_machine;
+		*class = eh->e_ident[EI_CLASS];
+		*endian = eh->e_ident[EI_DATA];
+		ldarch = ldinit();
+		return ldarch == NULL? EINVAL : 0;
+	}
+
+	if (*mach != eh->e_machine ||
+	    *class != eh->e_ident[EI_CLASS] ||
+	    *endian != eh->e_ident[EI_DATA]) {
+		warnx("%s: incompatible file type", path);
+		return EFTYPE;
+	}
+
+	return 0;
+}
+
+/*
+ * incremental linking state: which input section went where,
+ * how much room is left in each output section, the global
+ * symbols and the relocations against them (see incr.c)
+ */
+struct incrsave {
+	struct incr sv_in;
+	struct strtab sv_names;
+	struct symlist **sv_gsyms;	/* globals in the name order */
+	size_t sv_maxobjs, sv_maxslots, sv_maxsyms, sv_maxents, sv_maxrels;
+	const struct section *sv_os;	/* last section seen */
+	uint32_t sv_rank;
+};
+
+/*
+ * grow the state array as needed
+ */
+static void *
+incr_grow(void *p, uint32_t n, size_t *max, size_t sz)
+{
+	if (n < *max)
+		return p;
+
+	*max = *max? *max * 2 : 256;
+	if (!(p = reallocarray(p, *max, sz)))
+		err(1, "reallocarray");
+	return p;
+}
+
+/*
+ * number the objects and take their fingerprints
+ */
+int
+elf_incrobj(struct objlist *ol, void *v)
+{
+	struct incrsave *sv = v;
+	struct incr *in = &sv->sv_in;
+	struct incrobj *io;
+
+	if (ol == &sysobj) {
+		ol->ol_no = -1;
+		return 0;
+	}
+
+	in->in_objs = incr_grow(in->in_objs, in->in_hdr.ih_nobjs,
+	    &sv->sv_maxobjs, sizeof *in->in_objs);
+	ol->ol_no = in->in_hdr.ih_nobjs;
+	io = &in->in_objs[in->in_hdr.ih_nobjs++];
+	io->io_path = strtab_add(&sv->sv_names, ol->ol_path);
+	io->io_name = strtab_add(&sv->sv_names, ol->ol_name);
+	io->io_off = ol->ol_off;
+	if (incr_stat(ol->ol_path, &io->io_size, &io->io_mtime, &io->io_ino))
+		err(1, "stat: %s", ol->ol_path);
+
+	return 0;
+}
+
+/*
+ * record the global symbols that made it into the output
+ */
+int
+elf_incrglob(struct symlist *sym, void *v)
+{
+	struct incrsave *sv = v;
+	struct incr *in = &sv->sv_in;
+	struct incrsym *ig;
+	Elf_Sym *esym = &ELF_SYM(sym->sl_elfsym);
+
+	if (ELF_ST_BIND(esym->st_info) == STB_LOCAL)
+		return 0;
+
+	if (sym->sl_sect && sym->sl_sect->os_obj != &sysobj &&
+	    !(sym->sl_sect->os_flags & SECTION_INCR))
+		return 0;
+
+	in->in_syms = incr_grow(in->in_syms, in->in_hdr.ih_nsyms,
+	    &sv->sv_maxsyms, sizeof *in->in_syms);
+	sv->sv_gsyms = reallocarray(sv->sv_gsyms, sv->sv_maxsyms,
+	    sizeof *sv->sv_gsyms);
+	if (!sv->sv_gsyms)
+		err(1, "reallocarray");
+	sv->sv_gsyms[in->in_hdr.ih_nsyms] = sym;
+	ig = &in->in_syms[in->in_hdr.ih_nsyms++];
+	memset(ig, 0, sizeof *ig);
+	ig->ig_name = strtab_add(&sv->sv_names, sym->sl_name);
+	ig->ig_obj = sym->sl_sect? sym->sl_sect->os_obj->ol_no : -1;
+	ig->ig_value = esym->st_value;
+	ig->ig_size = esym->st_size;
+	ig->ig_info = esym->st_info;
+
+	return 0;
+}
+
+/*
+ * record the output symbol table entries in the order written
+ */
+int
+elf_incrent(const struct ldorder *order, const struct section *os,
+    struct symlist *sym, void *v)
+{
+	struct incrsave *sv = v;
+	struct incr *in = &sv->sv_in;
+	struct incrent *ie;
+
+	if (os != sv->sv_os) {
+		sv->sv_os = os;
+		sv->sv_rank = 0;
 	}
 
-	sidx[is] = sym;
-	if (cref && sym && ol) {
-		struct xreflist *xl;
+	in->in_ents = incr_grow(in->in_ents, in->in_hdr.ih_nents,
+	    &sv->sv_maxents, sizeof *in->in_ents);
+	ie = &in->in_ents[in->in_hdr.ih_nents++];
+	memset(ie, 0, sizeof *ie);
+	ie->ie_name = strtab_add(&sv->sv_names, sym->sl_name);
+	ie->ie_sidx = in->in_hdr.ih_nents;	/* the first one is null */
+	ie->ie_obj = os->os_obj->ol_no;
+	ie->ie_sect = os->os_no;
+	ie->ie_rank = sv->sv_rank++;
 
-		if (!(xl = calloc(1, sizeof *xl)))
-			errx(1, "calloc");
-		xl->xl_obj = ol;
-		if (sym->sl_sect && sym->sl_sect->os_obj == ol)
-			TAILQ_INSERT_HEAD(&sym->sl_xref, xl, xl_entry);
-		else
-			TAILQ_INSERT_TAIL(&sym->sl_xref, xl, xl_entry);
-	}
 	return 0;
 }
 
+static int
+incr_gsymcmp(const void *a, const void *b)
+{
+	const struct symlist *sym = *(struct symlist * const *)b;
+
+	return strcmp(a, sym->sl_name);
+}
+
 /*
- * add an object to the link editing ordee;
- * load needed headers and relocations where available;
- * load symbols and resolve references from relocs and other
- * objects (as undefined);
- * prepare the relocs for the final output and sort by address.
+ * save the state of the link just done for the next incremental one
  */
 int
-elf_objadd(struct objlist *ol, FILE *fp, off_t foff)
+elf_incrsave(const char *output, struct ldorder *order)
 {
+	struct incrsave sv;
+	struct incr *in = &sv.sv_in;
+	struct incrhdr *ih = &in->in_hdr;
+	struct incrord *ir;
+	struct incrslot *ic;
+	struct increl *il;
+	struct ldorder *ord;
 	struct section *os;
-	struct elf_symtab es;
-	Elf_Ehdr *eh;
+	struct relist *rp, *erp;
+	struct symlist *sym, **gp;
 	Elf_Shdr *shdr;
-	int i, n;
+	uint32_t i;
 
-	eh = &ELF_HDR(ol->ol_hdr);
-	if (elf_ld_chkhdr(ol->ol_name, eh, ET_REL,
-	    &machine, &elfclass, &endian))
-		return 1;
+	memset(&sv, 0, sizeof sv);
+	strtab_init(&sv.sv_names);
+	ih->ih_class = ELFCLASS;
+	ih->ih_mach = machine;
+	obj_foreach(elf_incrobj, &sv);
 
-	if (!(shdr = elf_load_shdrs(ol->ol_name, fp, foff, eh)))
-		return 1;
-	elf_fix_shdrs(eh, shdr);
+	for (ord = order; ord != TAILQ_END(ord);
+	    ord = TAILQ_NEXT(ord, ldo_entry)) {
+		if (ord->ldo_order == ldo_symtab)
+			ih->ih_symoff = ((Elf_Shdr *)
+			    ord->ldo_sect->os_sect)->sh_offset;
+		if (ord->ldo_order != ldo_section)
+			continue;
 
-	n = ol->ol_nsect = eh->e_shnum;
-	if (!(ol->ol_sections = calloc(n, sizeof(struct section))))
-		err(1, "calloc");
+		if (!(ih->ih_nords % 64) && !(in->in_ords = reallocarray(
+		    in->in_ords, ih->ih_nords + 64, sizeof *in->in_ords)))
+			err(1, "reallocarray");
+		ir = &in->in_ords[ih->ih_nords];
+		memset(ir, 0, sizeof *ir);
+		ir->ir_name = strtab_add(&sv.sv_names, ord->ldo_name);
+		ir->ir_type = ord->ldo_type;
+		ir->ir_off = ((Elf_Shdr *)ord->ldo_sect->os_sect)->sh_offset;
+		ir->ir_start = ir->ir_end = ord->ldo_start;
+		ir->ir_max = ord->ldo_addr;
+		ir->ir_filler = ord->ldo_filler;
 
-	for (i = 0, os = ol->ol_sections; i < n; os++, i++) {
-		os->os_no = i;
-		os->os_sect = &shdr[i];
-		os->os_obj = ol;
-		os->os_off = foff + shdr[i].sh_offset;
-		os->os_flags = shdr[i].sh_flags;
-		TAILQ_INIT(&os->os_syms);
+		TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry) {
+			if (os->os_obj == &sysobj)
+				continue;
+
+			shdr = os->os_sect;
+			in->in_slots = incr_grow(in->in_slots, ih->ih_nslots,
+			    &sv.sv_maxslots, sizeof *in->in_slots);
+			ic = &in->in_slots[ih->ih_nslots++];
+			ic->ic_obj = os->os_obj->ol_no;
+			ic->ic_no = os->os_no;
+			ic->ic_ord = ih->ih_nords;
+			ic->ic_type = shdr->sh_type;
+			ic->ic_addr = shdr->sh_addr;
+			ic->ic_off = shdr->sh_type == SHT_NOBITS? 0 :
+			    shdr->sh_offset;
+			ic->ic_size = shdr->sh_size;
+			ic->ic_align = shdr->sh_addralign;
+			if (ir->ir_end < ic->ic_addr + ic->ic_size)
+				ir->ir_end = ic->ic_addr + ic->ic_size;
+			os->os_flags |= SECTION_INCR;
+		}
+		ih->ih_nords++;
 	}
 
-	/* load symbol table */
-	es.name = ol->ol_name;
-	es.ehdr = eh;
-	es.shdr = shdr;
-	es.shstr = NULL;
+	sym_foreach(elf_incrglob, &sv);
+	sym_scan(order, NULL, elf_incrent, &sv);
+
+	/* relocations against the globals */
+	for (ord = order; ord != TAILQ_END(ord);
+	    ord = TAILQ_NEXT(ord, ldo_entry)) {
+		if (ord->ldo_order != ldo_section)
+			continue;
+
+		TAILQ_FOREACH(os, &ord->ldo_seclst, os_entry) {
+			if (os->os_obj == &sysobj || !os->os_obj->ol_sidx)
+				continue;
+
+			shdr = os->os_sect;
+			for (rp = os->os_rels, erp = rp + os->os_nrls;
+			    rp < erp; rp++) {
+				sym = RL_SYM(os, rp);
+				if (!sym || !sym->sl_name ||
+				    ELF_ST_BIND(ELF_SYM(sym->sl_elfsym).st_info)
+				    == STB_LOCAL)
+					continue;
+
+				if (!(gp = bsearch(sym->sl_name, sv.sv_gsyms,
+				    ih->ih_nsyms, sizeof *gp, incr_gsymcmp)))
+					continue;
+
+				in->in_rels = incr_grow(in->in_rels,
+				    ih->ih_nrels, &sv.sv_maxrels,
+				    sizeof *in->in_rels);
+				il = &in->in_rels[ih->ih_nrels++];
+				memset(il, 0, sizeof *il);
+				il->il_off = shdr->sh_offset + rp->rl_addr;
+				il->il_sym = gp - sv.sv_gsyms;
+				il->il_type = rp->rl_type;
+				il->il_obj = os->os_obj->ol_no;
+			}
+		}
+	}
+
+	/* all the names are offsets in the strings from now on */
+	ih->ih_strsz = strtab_finish(&sv.sv_names);
+	if (!(in->in_strs = malloc(ih->ih_strsz)))
+		err(1, "malloc");
+	strtab_write(&sv.sv_names, in->in_strs);
+	for (i = 0; i < ih->ih_nobjs; i++) {
+		in->in_objs[i].io_path =
+		    strtab_off(&sv.sv_names, in->in_objs[i].io_path);
+		in->in_objs[i].io_name =
+		    strtab_off(&sv.sv_names, in->in_objs[i].io_name);
+	}
+	for (i = 0; i < ih->ih_nords; i++)
+		in->in_ords[i].ir_name =
+		    strtab_off(&sv.sv_names, in->in_ords[i].ir_name);
+	for (i = 0; i < ih->ih_nsyms; i++)
+		in->in_syms[i].ig_name =
+		    strtab_off(&sv.sv_names, in->in_syms[i].ig_name);
+	for (i = 0; i < ih->ih_nents; i++)
+		in->in_ents[i].ie_name =
+		    strtab_off(&sv.sv_names, in->in_ents[i].ie_name);
+	strtab_free(&sv.sv_names);
+	free(sv.sv_gsyms);
+
+	i = incr_write(output, in);
+	incr_free(in);
+	return i;
+}
+
+/*
+ * fill the space left by a section with the filler
+ */
+static void
+incr_fill(FILE *fp, off_t off, uint64_t len, uint64_t filler)
+{
+	if (fseeko(fp, off, SEEK_SET) < 0)
+		err(1, "fseeko");
+	if (elf_fill(fp, off, len, filler))
+		err(1, "fwrite");
+}
+
+static const struct incr *incr_cur;	/* for the bsearch */
+
+static int
+incr_symcmp(const void *a, const void *b)
+{
+	const struct incr *in = incr_cur;
+
+	return strcmp(a, in->in_strs + ((const struct incrsym *)b)->ig_name);
+}
 
-	if (elf_symload(&es, fp, foff, elf_symadd, ol))
+static int
+incr_entcmp(const void *a, const void *b)
+{
+	const struct incrent *ea = *(struct incrent * const *)a;
+	const struct incrent *eb = *(struct incrent * const *)b;
+
+	if (ea->ie_obj != eb->ie_obj)
+		return ea->ie_obj < eb->ie_obj? -1 : 1;
+	if (ea->ie_sect != eb->ie_sect)
+		return ea->ie_sect < eb->ie_sect? -1 : 1;
+	return ea->ie_rank < eb->ie_rank? -1 : ea->ie_rank > eb->ie_rank;
+}
+
+/*
+ * patch the changed objects into the output in place;
+ * returns non-zero if a full link is needed instead.
+ * this is run in a child process (see incr_relink())
+ * and does not have to clean up after itself.
+ */
+int
+elf_incrlink(const char *output, struct incr *in)
+{
+	static struct section incr_abs;
+	static Elf_Shdr incr_shdr;
+	struct incrhdr *ih = &in->in_hdr;
+	struct incrslot *ic, **slots;
+	struct incrord *ir;
+	struct incrsym *ig;
+	struct incrent *ie, **ents, key, *kp, **ep;
+	struct increl *il, *nl;
+	struct objlist **objs, *ol;
+	struct section *os, **sects;
+	struct relist *rp, *erp;
+	struct symlist *sym;
+	struct ldorder stub;
+	Elf_Ehdr eh, feh;
+	Elf_Shdr *shdr;
+	Elf_Sym esym;
+	int64_t *delta;
+	uint64_t addr, off, align;
+	uint32_t i, j, k, n, nents, nglob, nfound, nsects;
+	char buf[8];
+	FILE *ofp, *sfp;
+	ssize_t rn;
+	int fd;
+
+	incr_cur = in;
+	if (ih->ih_class != ELFCLASS)
 		return 1;
-	ol->ol_sects = es.shdr;
-	ol->ol_snames = es.shstr;
-	free(es.stab);
 
-	/* scan thru the section list looking for progbits and relocs */
-	for (i = 0, os = ol->ol_sections; i < n; shdr++, os++, i++) {
-		os->os_name = ol->ol_snames + shdr->sh_name;
-		if (shdr->sh_type == SHT_NULL)
+	/* globals from the objects that stay are absolute now */
+	incr_abs.os_obj = &sysobj;
+	incr_abs.os_sect = &incr_shdr;
+	SYMQ_INIT(&incr_abs.os_syms);
+	for (ig = in->in_syms; ig < in->in_syms + ih->ih_nsyms; ig++) {
+		if (ig->ig_obj >= 0 && in->in_changed[ig->ig_obj])
 			continue;
 
-		if (shdr->sh_type == SHT_NOBITS) {
-			if (!strcmp(os->os_name, ELF_BSS)) {
-				if (ol->ol_bss) {
-					warnx("%s: too many .bss sections",
-					    ol->ol_name);
-					errors++;
-				} else
-					ol->ol_bss = os;
+		memset(&esym, 0, sizeof esym);
+		esym.st_value = ig->ig_value;
+		esym.st_size = ig->ig_size;
+		esym.st_info = ig->ig_info;
+		esym.st_shndx = SHN_ABS;
+		sym_add(in->in_strs + ig->ig_name, &incr_abs, &esym);
+	}
+
+	/* reload the changed ones */
+	if (!(objs = calloc(ih->ih_nobjs, sizeof *objs)))
+		err(1, "calloc");
+	for (n = i = 0; i < ih->ih_nobjs; i++)
+		if (in->in_changed[i]) {
+			objs[n] = obj_new(in->in_strs + in->in_objs[i].io_path,
+			    NULL, 0);
+			objs[n++]->ol_no = i;
+		}
+	obj_loadv(objs, n, 1);
+	for (i = 0; i < n; i++) {
+		if (objs[i]->ol_ngroups)
+			return 1;
+		obj_merge(objs[i], NULL);
+	}
+	if (errors || machine != ih->ih_mach)
+		return 1;
+
+	if (!(ofp = fopen(output, "r+")))
+		err(1, "fopen: %s", output);
+	fd = fileno(ofp);
+	if (pread(fd, &feh, sizeof feh, 0) != sizeof feh)
+		err(1, "pread: %s", output);
+	eh = feh;
+	elf_fix_header(&eh);
+
+	/* place the sections in their old slots or in the room left */
+	for (k = 0; k < n; k++) {
+		ol = objs[k];
+		if (!SYMQ_EMPTY(&ol->ol_sections[0].os_syms))
+			return 1;	/* commons */
+
+		if (!(slots = calloc(ol->ol_nsect, sizeof *slots)))
+			err(1, "calloc");
+		for (ic = in->in_slots; ic < in->in_slots + ih->ih_nslots; ic++)
+			if (ic->ic_obj == ol->ol_no) {
+				if (ic->ic_no >= ol->ol_nsect)
+					return 1;
+				slots[ic->ic_no] = ic;
 			}
-			continue;
+
+		for (i = 1; i < ol->ol_nsect; i++) {
+			os = &ol->ol_sections[i];
+			shdr = os->os_sect;
+			if (!(ic = slots[i])) {
+				if ((shdr->sh_flags & SHF_ALLOC) &&
+				    shdr->sh_size &&
+				    (shdr->sh_type == SHT_PROGBITS ||
+				     shdr->sh_type == SHT_NOBITS))
+					return 1;
+				continue;
+			}
+
+			if (ic->ic_type != shdr->sh_type ||
+			    (shdr->sh_flags & SHF_MERGE))
+				return 1;
+
+			ir = &in->in_ords[ic->ic_ord];
+			align = MAX(shdr->sh_addralign, 1);
+			if (shdr->sh_size <= ic->ic_size) {
+				addr = ic->ic_addr;
+				off = ic->ic_off;
+				if (ic->ic_off && shdr->sh_size < ic->ic_size)
+					incr_fill(ofp, off + shdr->sh_size,
+					    ic->ic_size - shdr->sh_size,
+					    ir->ir_filler);
+			} else {
+				addr = roundup(ir->ir_end, align);
+				if (addr + shdr->sh_size > ir->ir_max)
+					return 1;
+				off = shdr->sh_type == SHT_NOBITS? 0 :
+				    ir->ir_off + (addr - ir->ir_start);
+				if (ic->ic_off)
+					incr_fill(ofp, ic->ic_off, ic->ic_size,
+					    ir->ir_filler);
+				ir->ir_end = addr + shdr->sh_size;
+			}
+			if (addr % align)
+				return 1;
+
+			ic->ic_addr = shdr->sh_addr = addr;
+			ic->ic_off = off;
+			shdr->sh_offset = off;
+			ic->ic_size = shdr->sh_size;
+			ic->ic_align = shdr->sh_addralign;
+			os->os_flags |= SECTION_INCR;
+			SYMQ_FOREACH(sym, &os->os_syms)
+				ELF_SYM(sym->sl_elfsym).st_value += addr;
+		}
+		free(slots);
+
+		/* anything new to resolve needs a full link */
+		for (i = 0; i < ol->ol_nsyms; i++)
+			if ((sym = ol->ol_sidx[i]) && sym->sl_name &&
+			    sym_isundef(sym->sl_name) == sym)
+				return 1;
+
+		/* and so does a change in the globals defined */
+		for (nglob = 0, ig = in->in_syms;
+		    ig < in->in_syms + ih->ih_nsyms; ig++)
+			if (ig->ig_obj == ol->ol_no)
+				nglob++;
+		for (i = 1; i < ol->ol_nsect; i++)
+			SYMQ_FOREACH(sym, &ol->ol_sections[i].os_syms) {
+				if (ELF_ST_BIND(ELF_SYM(sym->sl_elfsym).
+				    st_info) == STB_LOCAL)
+					continue;
+				if (!(ig = bsearch(sym->sl_name, in->in_syms,
+				    ih->ih_nsyms, sizeof *ig, incr_symcmp)) ||
+				    ig->ig_obj != ol->ol_no || !nglob--)
+					return 1;
+			}
+		if (nglob)
+			return 1;
+	}
+
+	/* read the relocations for the changed sections at once */
+	for (nsects = k = 0; k < n; k++)
+		nsects += objs[k]->ol_nsect;
+	if (!(sects = reallocarray(NULL, nsects, sizeof *sects)))
+		err(1, "reallocarray");
+	for (nsects = k = 0; k < n; k++)
+		for (i = 1; i < objs[k]->ol_nsect; i++) {
+			os = &objs[k]->ol_sections[i];
+			if (os->os_flags & SECTION_INCR)
+				sects[nsects++] = os;
+		}
+	elf_relload(sects, nsects);
+	free(sects);
+
+	/* write out the changed sections */
+	memset(&stub, 0, sizeof stub);
+	stub.ldo_arch = ldarch;
+	for (k = 0; k < n; k++) {
+		ol = objs[k];
+		if (!(sfp = fopen(ol->ol_path, "r")))
+			err(1, "fopen: %s", ol->ol_path);
+		for (i = 1; i < ol->ol_nsect; i++) {
+			os = &ol->ol_sections[i];
+			shdr = os->os_sect;
+			if (!(os->os_flags & SECTION_INCR) ||
+			    shdr->sh_type == SHT_NOBITS)
+				continue;
+			if (ldloadasect(sfp, ofp, output, &stub, os))
+				return 1;
 		}
+		fclose(sfp);
+	}
+	if (fflush(ofp) == EOF)
+		err(1, "fflush: %s", output);
 
-		if (shdr->sh_type != SHT_PROGBITS)
+	/* move the globals and fix up the references to them */
+	if (!(delta = calloc(ih->ih_nsyms, sizeof *delta)))
+		err(1, "calloc");
+	for (ig = in->in_syms; ig < in->in_syms + ih->ih_nsyms; ig++) {
+		if (ig->ig_obj < 0 || !in->in_changed[ig->ig_obj])
 			continue;
 
-		if (i + 1 >= n)
+		if (!(sym = sym_isdefined(in->in_strs + ig->ig_name, NULL)))
+			return 1;
+		delta[ig - in->in_syms] =
+		    ELF_SYM(sym->sl_elfsym).st_value - ig->ig_value;
+		ig->ig_value = ELF_SYM(sym->sl_elfsym).st_value;
+		ig->ig_size = ELF_SYM(sym->sl_elfsym).st_size;
+		ig->ig_info = ELF_SYM(sym->sl_elfsym).st_info;
+	}
+
+	/* a field that is not a plain sum wants the full link */
+	for (il = in->in_rels; il < in->in_rels + ih->ih_nrels; il++) {
+		if (il->il_obj >= 0 && in->in_changed[il->il_obj])
 			continue;
+		if (delta[il->il_sym] && !ldarch->la_additive(il->il_type))
+			return 1;
+	}
 
-		if (shdr[1].sh_type != SHT_RELA &&
-		    shdr[1].sh_type != SHT_REL)
+	for (nl = il = in->in_rels; il < in->in_rels + ih->ih_nrels; il++) {
+		if (il->il_obj >= 0 && in->in_changed[il->il_obj])
 			continue;
 
-		if (elf_loadrelocs(ol, os, &shdr[1], fp, foff))
+		*nl++ = *il;
+		if (!delta[il->il_sym])
 			continue;
+
+		/* the last one may sit right at the end */
+		if ((rn = pread(fd, buf, sizeof buf, il->il_off)) < 4)
+			err(1, "pread: %s", output);
+		ldarch->la_fixone(buf, delta[il->il_sym], 0, il->il_type);
+		if (pwrite(fd, buf, rn, il->il_off) != rn)
+			err(1, "pwrite: %s", output);
 	}
+	ih->ih_nrels = nl - in->in_rels;
+
+	/* the relocations from the changed objects as they are now */
+	for (k = 0; k < n; k++) {
+		ol = objs[k];
+		for (i = 1; i < ol->ol_nsect; i++) {
+			os = &ol->ol_sections[i];
+			shdr = os->os_sect;
+			if (!(os->os_flags & SECTION_INCR))
+				continue;
 
-	free(ol->ol_aux);
-	ol->ol_aux = NULL;
+			for (rp = os->os_rels, erp = rp + os->os_nrls;
+			    rp < erp; rp++) {
+				sym = RL_SYM(os, rp);
+				if (!sym || !sym->sl_name ||
+				    ELF_ST_BIND(ELF_SYM(sym->sl_elfsym).st_info)
+				    == STB_LOCAL)
+					continue;
 
-	return 0;
+				if (!(ig = bsearch(sym->sl_name, in->in_syms,
+				    ih->ih_nsyms, sizeof *ig, incr_symcmp)))
+					return 1;
+
+				if (!(ih->ih_nrels % 256) &&
+				    !(in->in_rels = reallocarray(in->in_rels,
+				    ih->ih_nrels + 256, sizeof *in->in_rels)))
+					err(1, "reallocarray");
+				il = &in->in_rels[ih->ih_nrels++];
+				memset(il, 0, sizeof *il);
+				il->il_off = shdr->sh_offset + rp->rl_addr;
+				il->il_sym = ig - in->in_syms;
+				il->il_type = rp->rl_type;
+				il->il_obj = ol->ol_no;
+			}
+		}
+	}
+
+	/* update the symbol table entries of the changed objects */
+	if (ih->ih_symoff) {
+		if (!(ents = calloc(ih->ih_nents, sizeof *ents)))
+			err(1, "calloc");
+		for (nents = 0, ie = in->in_ents;
+		    ie < in->in_ents + ih->ih_nents; ie++)
+			if (ie->ie_obj >= 0 && in->in_changed[ie->ie_obj])
+				ents[nents++] = ie;
+		qsort(ents, nents, sizeof *ents, incr_entcmp);
+		nfound = 0;
+
+		for (k = 0; k < n; k++) {
+			ol = objs[k];
+			for (i = 1; i < ol->ol_nsect; i++) {
+				os = &ol->ol_sections[i];
+				if (!(os->os_flags & SECTION_INCR))
+					continue;
+
+				j = 0;
+				SYMQ_FOREACH(sym, &os->os_syms) {
+					key.ie_obj = ol->ol_no;
+					key.ie_sect = i;
+					key.ie_rank = j++;
+					kp = &key;
+					if (!(ep = bsearch(&kp, ents, nents,
+					    sizeof *ents, incr_entcmp)) ||
+					    !incr_samename(in->in_strs +
+					    (*ep)->ie_name, sym->sl_name))
+						return 1;
+
+					nfound++;
+					off = ih->ih_symoff +
+					    (*ep)->ie_sidx * sizeof esym;
+					if (pread(fd, &esym, sizeof esym, off) !=
+					    sizeof esym)
+						err(1, "pread: %s", output);
+					elf_fix_sym(&eh, &esym);
+					esym.st_value =
+					    ELF_SYM(sym->sl_elfsym).st_value;
+					esym.st_size =
+					    ELF_SYM(sym->sl_elfsym).st_size;
+					elf_fix_sym(&eh, &esym);
+					if (pwrite(fd, &esym, sizeof esym,
+					    off) != sizeof esym)
+						err(1, "pwrite: %s", output);
+				}
+			}
+		}
+		if (nfound != nents)
+			return 1;
+		free(ents);
+	}
+
+	/* the entry point might have moved too */
+	if (entry_name && (sym = sym_isdefined(entry_name, NULL)) &&
+	    eh.e_entry != ELF_SYM(sym->sl_elfsym).st_value) {
+		eh.e_entry = ELF_SYM(sym->sl_elfsym).st_value;
+		feh = eh;
+		elf_fix_header(&feh);
+		if (pwrite(fd, &feh, sizeof feh, 0) != sizeof feh)
+			err(1, "pwrite: %s", output);
+	}
+
+	if (fclose(ofp) == EOF)
+		err(1, "fclose: %s", output);
+
+	for (i = 0; i < ih->ih_nobjs; i++)
+		if (in->in_changed[i] && incr_stat(in->in_strs +
+		    in->in_objs[i].io_path, &in->in_objs[i].io_size,
+		    &in->in_objs[i].io_mtime, &in->in_objs[i].io_ino))
+			return 1;
+
+	return incr_write(output, in);
 }
 
 /*
- * check if object is editable by linking;
- * first object on the command line defines the machine
- * and endianess whilst later ones have to match.
+ * write len bytes of the filler at the current place in the output
+ * that is at the offset off; the pattern is kept in phase with the
+ * offset (thus the address) and laid out in the output byte order.
  */
 int
-elf_ld_chkhdr(const char *path, Elf_Ehdr *eh, int type, int *mach,
-    int *class, int *endian)
+elf_fill(FILE *fp, off_t off, uint64_t len, uint64_t filler)
 {
+	u_char buf[ELF_OBUFSZ], pat[sizeof filler];
+	size_t i, n;
 
-	if (eh->e_type != type) {
-		warnx("%s: not a relocatable file", path);
-		return EFTYPE;
-	}
+	for (i = 0; i < sizeof pat; i++)
+		pat[i] = filler >> (8 * (endian == ELFDATA2MSB?
+		    sizeof pat - 1 - i : i));
 
-	if (*mach == EM_NONE) {
-		*mach = eh->e_machine;
-		*class = eh->e_ident[EI_CLASS];
-		*endian = eh->e_ident[EI_DATA];
-		ldarch = ldinit();
-		return ldarch == NULL? EINVAL : 0;
-	}
+	n = MIN(len, sizeof buf);
+	for (i = 0; i < n; i++)
+		buf[i] = pat[(off + i) % sizeof pat];
 
-	if (*mach != eh->e_machine ||
-	    *class != eh->e_ident[EI_CLASS] ||
-	    *endian != eh->e_ident[EI_DATA]) {
-		warnx("%s: incompatible file type", path);
-		return EFTYPE;
+	for (; len; len -= n) {
+		n = MIN(len, sizeof buf);
+		if (fwrite(buf, n, 1, fp) != 1)
+			return -1;
 	}
 
 	return 0;
@@ -1267,17 +4604,47 @@ elf_ld_chkhdr(const char *path, Elf_Ehdr *eh, int type, int *mach,
 
 /*
  * seek forward in the output file and fill
- * the gap with the filler (not yet ;)
+ * the gap with the filler; the output is preallocated
+ * thus the zeroes are there already.
  */
 int
 elf_seek(FILE *fp, off_t off, uint64_t filler)
 {
+	off_t cur;
+
+	if (filler && (cur = ftello(fp)) >= 0 && cur < off)
+		return elf_fill(fp, cur, off - cur, filler);
+
 	if (fseeko(fp, off, SEEK_SET) < 0)
 		return -1;
 
 	return 0;
 }
 
+struct uldhole {
+	uint64_t uh_off;	/* cut out of the output */
+	uint64_t uh_len;
+};
+
+/*
+ * map the file offset past the holes cut out of the output
+ */
+static uint64_t
+uld_off(const struct uldhole *hole, int nh, uint64_t off)
+{
+	uint64_t d;
+	int i;
+
+	for (d = 0, i = 0; i < nh; i++) {
+		if (off >= hole[i].uh_off + hole[i].uh_len)
+			d += hole[i].uh_len;
+		else if (off > hole[i].uh_off)
+			d += off - hole[i].uh_off;
+	}
+
+	return off - d;
+}
+
 /*
  * a micro-linker that is only used for cleaning up
  * a single file from unwanted symbol entries and
@@ -1285,86 +4652,123 @@ elf_seek(FILE *fp, off_t off, uint64_t filler)
  * depending on the flags may as well completely
  * fix the object in memory thus performing "dynamic" loading
  *
- * operates on the file already in-memory
+ * operates on the file already in-memory (a private mapping);
+ * nothing is moved around but the ranges of the file to be
+ * written out are returned in the iov (up to LD_ULD_NIOV).
  */
 int
-uLD(const char *name, char *v, int *size, int flags)
+uLD(const char *name, char *v, size_t size, struct iovec *iov, int *niov,
+    int flags)
 {
 	Elf_Ehdr *eh = (Elf_Ehdr *)v;
-	Elf_Shdr *shdr, *sh, *esh, *ssh;
-	Elf_Sym **syms;
-	char *strs, *estr, *p;
-	int i, j, k, nsyms, *nus, *sect;
+	Elf_Shdr *shdr, *sh, *esh, *ssh, *rsh;
+	Elf_Sym *sym;
+	struct uldhole hole[2], t;
+	char *st, *strs, *estr, *snam, *nstr, *p;
+	uint64_t al, o;
+	size_t n, es;
+	u_char *drop;
+	int i, j, k, nsyms, nrels, nlocal, *nus, *sect;
+
+	iov[0].iov_base = v;
+	iov[0].iov_len = size;
+	*niov = 1;
+	if (!flags)
+		return 0;
+
+	if (size < sizeof *eh || eh->e_shentsize != sizeof *shdr ||
+	    eh->e_shoff >= size ||
+	    eh->e_shoff + (uint64_t)eh->e_shnum * sizeof *shdr > size)
+		errx(1, "%s: corrupt elf header", name);
 
 	shdr = (Elf_Shdr *)(v + eh->e_shoff);
 	/* find the symbol table */
-	for (sh = shdr, esh = sh + eh->e_shnum; sh < esh; sh++)
-		if (sh->sh_type == SHT_SYMTAB)
-			break;
-	if (sh >= esh)
+	for (ssh = NULL, sh = shdr, esh = sh + eh->e_shnum; sh < esh; sh++)
+		if (sh->sh_type == SHT_SYMTAB_SHNDX)
+			errx(1, "%s: extended section indexes", name);
+		else if (sh->sh_type == SHT_SYMTAB && !ssh)
+			ssh = sh;
+	if (!ssh)
 		errx(1, "%s: no symbol table", name);
 
-	if (sh->sh_link >= eh->e_shnum)
+	if (ssh->sh_link >= eh->e_shnum)
 		errx(1, "%s: invalid symtab link", name);
 
-	esh = shdr + sh->sh_link;
+	esh = shdr + ssh->sh_link;
 	if (esh->sh_type != SHT_STRTAB)
 		errx(1, "%s: no strings attached", name);
 
-	if (sh->sh_offset >= *size || sh->sh_offset + sh->sh_size > *size)
-		errx(1, "%s: corrupt section header #%td", name, sh - shdr);
+	if (ssh->sh_offset >= size || ssh->sh_offset + ssh->sh_size > size)
+		errx(1, "%s: corrupt section header #%td", name, ssh - shdr);
 
-	if (esh->sh_offset >= *size || esh->sh_offset + esh->sh_size > *size)
+	if (esh->sh_offset >= size || esh->sh_offset + esh->sh_size > size ||
+	    !esh->sh_size)
 		errx(1, "%s: corrupt section header #%td", name, esh - shdr);
 
-	if (sh->sh_size / sh->sh_entsize >= INT_MAX)
+	if ((es = ssh->sh_entsize) < sizeof *sym)
+		errx(1, "%s: invalid symtab entry size", name);
+
+	if (ssh->sh_size / es >= INT_MAX)
 		errx(1, "%s: symtab is too big %llu",
-		    name, (long long)sh->sh_size);
+		    name, (long long)ssh->sh_size);
 
-	if (sh->sh_entsize < sizeof **syms)
-		errx(1, "%s: invalid symtab entry size", name);
+	st = v + ssh->sh_offset;
+	nsyms = ssh->sh_size / es;
+	strs = v + esh->sh_offset;
+	estr = strs + esh->sh_size;
+	if (estr[-1] != '\0')
+		errx(1, "%s: unterminated strings section", name);
 
-	ssh = sh;
-	nsyms = sh->sh_size / sh->sh_entsize;
-	if (!(syms = calloc(nsyms, sizeof *syms)))
+	if (!(nus = calloc(nsyms, sizeof *nus)))
 		err(1, "calloc");
 
-	if (!(nus = calloc(nsyms, sizeof *nus)))
+	if (!(drop = calloc(nsyms, sizeof *drop)))
 		err(1, "calloc");
 
 	if (!(sect = calloc(eh->e_shnum, sizeof *sect)))
 		err(1, "calloc");
 
-	for (i = 0; i < nsyms; i++) {
-		syms[i] = (Elf_Sym *)(v + sh->sh_offset + i * sh->sh_entsize);
-		syms[i]->st_other = 1;
-		nus[i] = i;
-		if (ELF_ST_TYPE(syms[i]->st_info) == STT_SECTION) {
+	/* mark the symbols to dispose; the section ones stay */
+	for (i = 1; i < nsyms; i++) {
+		sym = (Elf_Sym *)(st + i * es);
+		if (sym->st_name >= esh->sh_size)
+			errx(1, "%s: corrupt syment #%d", name, i);
+
+		if (ELF_ST_TYPE(sym->st_info) == STT_SECTION) {
 			/* XXX for now do not care about MD sections */
-			if (syms[i]->st_shndx >= eh->e_shnum)
+			if (sym->st_shndx >= eh->e_shnum)
 				errx(1, "%s: invalid shndx in a sym #%d",
 				    name, i);
-			sect[syms[i]->st_shndx] = i;
+			sect[sym->st_shndx] = i;
+			continue;
 		}
+
+		snam = strs + sym->st_name;
+		drop[i] = ELF_ST_BIND(sym->st_info) == STB_LOCAL &&
+		    ((snam[0] == '.' && snam[1] == 'L') ||
+		    *snam == 'L' || flags > 1);
 	}
-	strs = v + esh->sh_offset;
-	estr = strs + esh->sh_size;
-	if (estr[-1] != '\0')
-		errx(1, "%s: unterminated strings section", name);
 
-	/* fix relocs; mark symbols to dispose */
-	for (sh = shdr, esh = sh + eh->e_shnum; sh < esh; sh++) {
-		Elf_Shdr *rsh;
-		int nrels;
+	/* the group signatures are referenced by the index too */
+	for (sh = shdr, esh = sh + eh->e_shnum; sh < esh; sh++)
+		if (sh->sh_type == SHT_GROUP && sh->sh_link == ssh - shdr) {
+			if (sh->sh_info >= nsyms)
+				errx(1, "%s: corrupt section group #%td",
+				    name, sh - shdr);
+			drop[sh->sh_info] = 0;
+		}
 
-		if ((rsh = sh + 1) >= esh)
+	/* fix relocs to become section-relative */
+	for (rsh = shdr; rsh < esh; rsh++) {
+		if (rsh->sh_type != SHT_REL && rsh->sh_type != SHT_RELA)
 			continue;
 
-		if (rsh->sh_type != SHT_REL && rsh->sh_type != SHT_RELA)
+		if (rsh->sh_link != ssh - shdr)
 			continue;
 
-		if (rsh->sh_offset >= *size ||
-		    rsh->sh_offset + rsh->sh_size > *size)
+		if (rsh->sh_info >= eh->e_shnum ||
+		    rsh->sh_offset >= size ||
+		    rsh->sh_offset + rsh->sh_size > size)
 			errx(1, "%s: corrupt section header #%td",
 			    name, rsh - shdr);
 
@@ -1376,44 +4780,39 @@ uLD(const char *name, char *v, int *size, int flags)
 
 		if (rsh->sh_size / rsh->sh_entsize >= INT_MAX)
 			errx(1, "%s: too many relocs for section %td",
-			    name, sh - shdr);
+			    name, rsh - shdr);
+
+		sh = shdr + rsh->sh_info;
+		if (rsh->sh_type == SHT_REL &&
+		    sh->sh_offset + sh->sh_size > size)
+			errx(1, "%s: corrupt section header #%d",
+			    name, (int)rsh->sh_info);
 
-		/* take a point of the relocs */
 		p = v + rsh->sh_offset;
 		nrels = rsh->sh_size / rsh->sh_entsize;
 		for (i = 0; i < nrels; i++) {
 			Elf_Rel *r = (Elf_Rel *)(p + i * rsh->sh_entsize);
-			Elf_RelA *ra = (Elf_RelA *)(p + i * rsh->sh_entsize);
-			Elf_Sym *sym;
-			char *snam;
+			Elf_RelA *ra = (Elf_RelA *)r;
+			u_long si = ELF_R_SYM(r->r_info);
 
 			/* XXX this does not include the reloc size */
 			if (r->r_offset >= sh->sh_size)
 				errx(1, "%s: reloc #%d offset out of range",
 				     name, i);
 
-			if (ELF_R_SYM(r->r_info) >= nsyms)
-				errx(1, "%s: broken reloc #%d for section %td",
-				    name, i, sh - shdr);
-
-			sym = syms[ELF_R_SYM(r->r_info)];
-			snam = strs + sym->st_name;
-			if (snam >= estr)
-				errx(1, "%s: corrupt syment", name);
-			
-			/* skip externals */
-			if (sym->st_shndx == SHN_UNDEF)
-				continue;
+			if (si >= nsyms)
+				errx(1, "%s: broken reloc #%d for section %d",
+				    name, i, (int)rsh->sh_info);
 
-			/* skip well [un]defined symbols */
-			if (!sym->st_shndx || sym->st_shndx >= eh->e_shnum)
+			if (!drop[si])
 				continue;
 
-			/* skip over non-local symbols */
-			if (ELF_ST_BIND(sym->st_info) != STB_LOCAL ||
-			    !((snam[0] == '.' && snam[1] == 'L') ||
-			    *snam == 'L' || flags > 1)) {
-				sym->st_other = 0;
+			/* keep the ones there is no section for */
+			sym = (Elf_Sym *)(st + si * es);
+			if (sym->st_shndx == SHN_UNDEF ||
+			    sym->st_shndx >= eh->e_shnum ||
+			    !sect[sym->st_shndx]) {
+				drop[si] = 0;
 				continue;
 			}
 
@@ -1424,7 +4823,7 @@ uLD(const char *name, char *v, int *size, int flags)
 			 * plain rels oughtta sought MD knowledge
 			 */
 			if (rsh->sh_type == SHT_RELA)
-				ra += sym->st_value;
+				ra->r_addend += sym->st_value;
 			else switch (eh->e_machine) {
 #if ELFSIZE == 32
 			case EM_ARM:
@@ -1451,75 +4850,35 @@ uLD(const char *name, char *v, int *size, int flags)
 				break;
 			}
 
-			if (!sect[sym->st_shndx])
-				errx(1, "%s: missing section #%d",
-				    name, sym->st_shndx);
-			nus[ELF_R_SYM(r->r_info)] = sect[sym->st_shndx];
-		}
-	}
-
-	/* recycle syms; minimise calls to memcpy */
-	for (i = j = k = 0; i < nsyms; i++) {
-		Elf_Sym *sym;
-		char *snam;
-
-		sym = syms[i];
-		if (!sym->st_other) {
-			if (!k)
-				k = i;
-			continue;
-		}
-
-		/* skip over non-local symbols */
-		snam = strs + sym->st_name;
-		if (ELF_ST_BIND(sym->st_info) != STB_LOCAL ||
-		    !((snam[0] == '.' && snam[1] == 'L') ||
-		    *snam == 'L' || flags > 1)) {
-			sym->st_other = 0;
-			if (!k)
-				k = i;
-			continue;
-		}
-
-		/* mark the beginning of the free fragment */
-		if (j == 0) {
-			j = i;
-			k = 0;
-			continue;
+			r->r_info = ELF_R_INFO((long)sect[sym->st_shndx],
+			    ELF_R_TYPE(r->r_info));
 		}
-
-		/* still running through the locals */
-		if (!k)
-			continue;
-
-/*
-printf("hit %s i %d j %d k %d\n", snam, i, j, k);
-*/
-		memcpy(syms[j], syms[k], (i - k) * ssh->sh_entsize);
-		/* mark up new positions for the moved syms */
-		for (k = j + i - k; j < k; j++)
-			nus[i - (k - j)] = j;
-		k = 0;
 	}
 
-	/* extra step in case we had bunch of 'em before the end */
-	if (k && k < i) {
-/*
-printf("i %d j %d k %d\n", i, j, k);
-*/
-		memcpy(syms[j], syms[k], (i - k) * ssh->sh_entsize);
-		for (k = j + i - k; j < k; j++)
-			nus[i - (k - j)] = j;
+	/* recycle syms; every run of the kept ones is moved at once */
+	for (nlocal = 0, i = 0; i < nsyms && i < ssh->sh_info; i++)
+		nlocal += !drop[i];
+	for (i = j = 0; i < nsyms; i = k) {
+		for (; i < nsyms && drop[i]; i++)
+			;
+		for (k = i; k < nsyms && !drop[k]; k++)
+			nus[k] = j + (k - i);
+		if (k > i && i != j)
+			memmove(st + j * es, st + i * es, (k - i) * es);
+		j += k - i;
 	}
 	nsyms = j;
+	ssh->sh_info = nlocal;
 
-	/* run through the relocs again and map symbol refs */
-	for (sh = shdr, esh = sh + eh->e_shnum; sh < esh; sh++) {
-		Elf_Shdr *rsh;
-		int nrels;
+	/* run through the relocs and groups again and map symbol refs */
+	for (rsh = shdr; rsh < esh; rsh++) {
+		if (rsh->sh_link != ssh - shdr)
+			continue;
 
-		if ((rsh = sh + 1) >= esh)
+		if (rsh->sh_type == SHT_GROUP) {
+			rsh->sh_info = nus[rsh->sh_info];
 			continue;
+		}
 
 		if (rsh->sh_type != SHT_REL && rsh->sh_type != SHT_RELA)
 			continue;
@@ -1530,46 +4889,81 @@ printf("i %d j %d k %d\n", i, j, k);
 			Elf_Rel *r = (Elf_Rel *)(p + i * rsh->sh_entsize);
 			int ns = ELF_R_SYM(r->r_info);
 
-/*
-printf("ns %d -> %d\n", ns, nus[ns]);
-*/
 			r->r_info = ELF_R_INFO((long)nus[ns], ELF_R_TYPE(r->r_info));
 		}
 	}
+	free(sect);
+	free(drop);
+	free(nus);
 
-	if (!flags)
-		return 0;
+	/* adjust .symtab size; the tail is cut out */
+	n = (size_t)nsyms * es;
+	hole[0].uh_off = ssh->sh_offset + n;
+	hole[0].uh_len = ssh->sh_size - n;
+	ssh->sh_size = n;
 
-	/* adjust .symtab size */
-	j = nsyms * ssh->sh_entsize;
-	k = ssh->sh_size - j;
-	ssh->sh_size = j;
+	/*
+	 * generate .strtab unless shared with the section names;
+	 * names go in the order of the symbols that may not be
+	 * the one of the strings thus a copy is made.
+	 */
 	sh = shdr + ssh->sh_link;
-	sh->sh_offset = ssh->sh_offset + ssh->sh_size;
-	p = v + sh->sh_offset;
-	*p++ = '\0';
-	/* generate .strtab; we assume copy would not overlap (; */
-	for (j = i = 1; i < nsyms; i++) {
-		char *snam = strs + syms[i]->st_name;
-		/* skip those we have already put out */
-		if (syms[i]->st_name < j)
-			continue;
-		j = syms[i]->st_name;
-		syms[i]->st_name = p - (v + sh->sh_offset);
-		p += strlcpy(p, snam, sh->sh_size) + 1;
-	}
-	*p++ = '\0';
-	j = p - (v + sh->sh_offset);
-	k += sh->sh_size - j;
-	sh->sh_size = j;
-	/* offset all the following sections; assuming they are sorted */
-	for (ssh = sh, sh = shdr, esh = sh + eh->e_shnum; sh < esh; sh++)
-		if (sh->sh_offset > ssh->sh_offset) {
-			sh->sh_offset -= k;
-			memcpy(v + sh->sh_offset, v + sh->sh_offset + k,
-			    sh->sh_size);
-		}
-	*size -= k;
+	for (n = 1, i = 1; i < nsyms; i++) {
+		sym = (Elf_Sym *)(st + i * es);
+		if (sym->st_name)
+			n += strlen(strs + sym->st_name) + 1;
+	}
+	if (ssh->sh_link == eh->e_shstrndx || n > sh->sh_size)
+		n = sh->sh_size;
+	else {
+		if (!(nstr = malloc(n)))
+			err(1, "malloc");
+		p = nstr;
+		*p++ = '\0';
+		for (i = 1; i < nsyms; i++) {
+			sym = (Elf_Sym *)(st + i * es);
+			if (!sym->st_name)
+				continue;
+			snam = strs + sym->st_name;
+			sym->st_name = p - nstr;
+			p = stpcpy(p, snam) + 1;
+		}
+		memcpy(strs, nstr, n);
+		free(nstr);
+	}
+	hole[1].uh_off = sh->sh_offset + n;
+	hole[1].uh_len = sh->sh_size - n;
+	sh->sh_size = n;
+
+	/* the holes keep the alignment of whatever follows */
+	al = ELF_ADDRALIGN;
+	for (sh = shdr, esh = sh + eh->e_shnum; sh < esh; sh++)
+		if (sh->sh_addralign > al && powerof2(sh->sh_addralign))
+			al = sh->sh_addralign;
+	for (i = 0; i < 2; i++)
+		hole[i].uh_len -= hole[i].uh_len % al;
+	if (hole[0].uh_off > hole[1].uh_off) {
+		t = hole[0];
+		hole[0] = hole[1];
+		hole[1] = t;
+	}
+
+	for (sh = shdr; sh < esh; sh++)
+		sh->sh_offset = uld_off(hole, 2, sh->sh_offset);
+	eh->e_shoff = uld_off(hole, 2, eh->e_shoff);
+
+	/* and whatever is left in between goes out */
+	for (o = 0, *niov = i = 0; i < 2; i++) {
+		if (hole[i].uh_off > o) {
+			iov[*niov].iov_base = v + o;
+			iov[(*niov)++].iov_len = hole[i].uh_off - o;
+		}
+		o = hole[i].uh_off + hole[i].uh_len;
+	}
+	if (size > o) {
+		iov[*niov].iov_base = v + o;
+		iov[(*niov)++].iov_len = size - o;
+	}
 
 	return 0;
 }
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2014 Michael Shalayeff
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef lint
+static const char rcsid[] =
+    "$ABSD$";
+#endif
+
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <elf_abi.h>
+#include <elfuncs.h>
+#include <a.out.h>
+#include <err.h>
+
+#include "ld.h"
+
+int nthreads;	/* 0 - one per cpu */
+
+/*
+ * this describes one batch of jobs handed out to the workers;
+ * jobs are taken strictly in the index order but might
+ * be finished in any order hence the caller must not care.
+ */
+struct pool {
+	pthread_mutex_t pl_lock;
+	void (*pl_func)(void *, int, int);
+	void *pl_arg;
+	int pl_next;		/* next job to hand out */
+	int pl_njobs;		/* total jobs in the batch */
+};
+
+struct poolworker {
+	struct pool *pw_pool;
+	pthread_t pw_thread;
+	int pw_no;		/* worker number */
+};
+
+void *pool_worker(void *);
+
+/*
+ * return the number of workers to run;
+ * default to as many as there are processors online
+ */
+int
+pool_size(void)
+{
+	long ncpu;
+
+	if (nthreads > 0)
+		return nthreads;
+
+	if ((ncpu = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		ncpu = 1;
+	if (ncpu > LD_MAXTHREADS)
+		ncpu = LD_MAXTHREADS;
+
+	return nthreads = ncpu;
+}
+
+void *
+pool_worker(void *v)
+{
+	struct poolworker *pw = v;
+	struct pool *pl = pw->pw_pool;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&pl->pl_lock);
+		i = pl->pl_next < pl->pl_njobs? pl->pl_next++ : -1;
+		pthread_mutex_unlock(&pl->pl_lock);
+
+		if (i < 0)
+			break;
+
+		(*pl->pl_func)(pl->pl_arg, i, pw->pw_no);
+	}
+
+	return NULL;
+}
+
+/*
+ * run a function over n jobs spreading them across the workers;
+ * the function receives the job index and the worker number
+ * (which is less than pool_size()) so it can keep per-worker state;
+ * returns when all the jobs are done.
+ * small batches or single-threaded setup are run in-line.
+ */
+void
+pool_run(int n, void (*func)(void *, int, int), void *v)
+{
+	struct poolworker *pw;
+	struct pool pl;
+	int i, nw;
+
+	if ((nw = pool_size()) > n)
+		nw = n;
+
+	if (nw <= 1) {
+		for (i = 0; i < n; i++)
+			(*func)(v, i, 0);
+		return;
+	}
+
+	pl.pl_func = func;
+	pl.pl_arg = v;
+	pl.pl_next = 0;
+	pl.pl_njobs = n;
+	if (pthread_mutex_init(&pl.pl_lock, NULL))
+		errx(1, "pthread_mutex_init");
+
+	if (!(pw = calloc(nw, sizeof *pw)))
+		err(1, "calloc");
+
+	for (i = 0; i < nw; i++) {
+		pw[i].pw_pool = &pl;
+		pw[i].pw_no = i;
+		if (pthread_create(&pw[i].pw_thread, NULL, pool_worker, &pw[i]))
+			errx(1, "pthread_create");
+	}
+
+	for (i = 0; i < nw; i++)
+		if (pthread_join(pw[i].pw_thread, NULL))
+			errx(1, "pthread_join");
+
+	pthread_mutex_destroy(&pl.pl_lock);
+	free(pw);
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2014 Michael Shalayeff
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef lint
+static const char rcsid[] =
+    "$ABSD$";
+#endif
+
+#include <sys/param.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <elf_abi.h>
+#include <elfuncs.h>
+#include <a.out.h>
+#include <err.h>
+
+#include "ld.h"
+
+int stats;		/* print the summary to stderr */
+char *tracefile;	/* chrome trace output */
+
+/*
+ * one timed phase; phases nest so the events are
+ * kept in the order they have been started
+ */
+struct stevent {
+	const char *se_name;
+	uint64_t se_start;	/* wall time (usec since the start) */
+	uint64_t se_dur;
+	uint64_t se_cpu;	/* cpu time (usec) */
+	uint64_t se_cpu0;
+};
+
+struct stevent *stevents;
+int nstevents, maxstevents;
+int ststack[LD_ST_DEPTH], ststdepth;
+uint64_t stcounters[LD_ST_NCOUNT];
+struct timespec stzero;
+
+const char * const stnames[LD_ST_NCOUNT] = {
+	"objects", "members", "symbols", "relocations",
+	"bytes_read", "bytes_written"
+};
+
+uint64_t stat_wall(void);
+uint64_t stat_cpu(void);
+
+uint64_t
+stat_wall(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		err(1, "clock_gettime");
+
+	if (!stzero.tv_sec && !stzero.tv_nsec)
+		stzero = ts;
+
+	return (ts.tv_sec - stzero.tv_sec) * 1000000ULL +
+	    (ts.tv_nsec - stzero.tv_nsec) / 1000;
+}
+
+uint64_t
+stat_cpu(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		err(1, "getrusage");
+
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+	    ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/*
+ * start the clock as early as possible
+ */
+void
+stat_init(void)
+{
+	stat_wall();
+}
+
+/*
+ * start a phase; must be paired with stat_end();
+ * phases are always recorded as the options are not known
+ * yet at the start and there are only few of them anyway.
+ */
+void
+stat_begin(const char *name)
+{
+	struct stevent *se;
+
+	if (ststdepth == LD_ST_DEPTH)
+		errx(1, "stat_begin: %s: nested too deep", name);
+
+	if (nstevents == maxstevents) {
+		maxstevents = maxstevents? maxstevents * 2 : 64;
+		if (!(stevents = reallocarray(stevents, maxstevents,
+		    sizeof *stevents)))
+			err(1, "reallocarray");
+	}
+
+	ststack[ststdepth++] = nstevents;
+	se = &stevents[nstevents++];
+	se->se_name = name;
+	se->se_cpu0 = stat_cpu();
+	se->se_start = stat_wall();
+}
+
+void
+stat_end(void)
+{
+	struct stevent *se;
+
+	if (!ststdepth)
+		errx(1, "stat_end: no phase");
+
+	se = &stevents[ststack[--ststdepth]];
+	se->se_dur = stat_wall() - se->se_start;
+	se->se_cpu = stat_cpu() - se->se_cpu0;
+}
+
+/*
+ * counters are bumped from the pool workers too
+ */
+void
+stat_count(int c, uint64_t n)
+{
+	__sync_fetch_and_add(&stcounters[c], n);
+}
+
+/*
+ * print the summary and/or write out the trace
+ */
+void
+stat_report(void)
+{
+	struct rusage ru;
+	struct stevent *se, *ee;
+	FILE *fp;
+	uint64_t wall, cpu, now;
+	int i;
+
+	if (!stats && !tracefile)
+		return;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		err(1, "getrusage");
+	now = stat_wall();
+
+	if (stats) {
+		fprintf(stderr, "%-16s %12s %12s\n", "phase", "wall ms",
+		    "cpu ms");
+		/* sum up the phases of the same name; first seen go first */
+		for (se = stevents; se < stevents + nstevents; se++) {
+			for (ee = stevents; ee < se; ee++)
+				if (!strcmp(ee->se_name, se->se_name))
+					break;
+			if (ee < se)
+				continue;
+
+			wall = cpu = 0;
+			for (ee = se; ee < stevents + nstevents; ee++)
+				if (!strcmp(ee->se_name, se->se_name)) {
+					wall += ee->se_dur;
+					cpu += ee->se_cpu;
+				}
+			fprintf(stderr, "%-16s %12.3f %12.3f\n", se->se_name,
+			    wall / 1000., cpu / 1000.);
+		}
+		fprintf(stderr, "%-16s %12.3f\n", "total", now / 1000.);
+
+		for (i = 0; i < LD_ST_NCOUNT; i++)
+			fprintf(stderr, "%-16s %12llu\n", stnames[i],
+			    (unsigned long long)stcounters[i]);
+		fprintf(stderr, "%-16s %12ld\n", "maxrss_kb",
+		    (long)ru.ru_maxrss);
+	}
+
+	if (!tracefile)
+		return;
+
+	if (!(fp = fopen(tracefile, "w")))
+		err(1, "fopen: %s", tracefile);
+
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for (se = stevents; se < stevents + nstevents; se++)
+		fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+		    "\"tid\":0,\"ts\":%llu,\"dur\":%llu,"
+		    "\"args\":{\"cpu_us\":%llu}},\n",
+		    se->se_name, (int)getpid(),
+		    (unsigned long long)se->se_start,
+		    (unsigned long long)se->se_dur,
+		    (unsigned long long)se->se_cpu);
+
+	fprintf(fp, "{\"name\":\"ld\",\"ph\":\"C\",\"pid\":%d,\"ts\":%llu,"
+	    "\"args\":{", (int)getpid(), (unsigned long long)now);
+	for (i = 0; i < LD_ST_NCOUNT; i++)
+		fprintf(fp, "\"%s\":%llu,", stnames[i],
+		    (unsigned long long)stcounters[i]);
+	fprintf(fp, "\"maxrss_kb\":%ld}}\n", (long)ru.ru_maxrss);
+	fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+
+	if (fclose(fp) == EOF)
+		err(1, "fclose: %s", tracefile);
+}
@@ -32,18 +32,280 @@ static const char rcsid[] =
 
 #include "ld.h"
 
-static inline int
-symcmp(struct symlist *a, struct symlist *b)
+/*
+ * symbols are allocated in slabs and numbered in the order
+ * starting from one; the names are copied into a pool of large
+ * chunks and looked up through the hash of the symbol numbers
+ * (the top bit marks the ones undefined).  the cross-references
+ * (only kept for the cref) and the indices in the relocatable
+ * output go aside by the symbol number.  nothing of it is ever freed.
+ */
+#define	SYM_HUNDEF	0x80000000U
+
+struct symlist **symslabs;
+uint32_t nsyms = 1;	/* zero ends the lists */
+uint32_t *symhash;
+uint32_t symhmask, symhused;
+struct xrefhead *symxrefs;
+uint32_t nsymxrefs;
+uint32_t *symidxs;
+uint32_t nsymidxs;
+char *namepool;
+size_t namefree;
+
+u_long sym_undgen;	/* bumped for every new undefined symbol */
+
+/* the symbols given in are of the class in use and may be packed */
+#define	SYM_ESIZE	\
+	(elfclass == ELFCLASS32? sizeof(Elf32_Sym) : sizeof(Elf64_Sym))
+
+static uint32_t *sym_hlook(const char *);
+static void sym_hadd(struct symlist *, uint32_t);
+static void sym_hdel(uint32_t *);
+static uint32_t *sym_sorted(uint32_t, uint32_t *);
+
+/*
+ * allocate a new symbol; name can be NULL
+ */
+struct symlist *
+sym_new(const char *name)
+{
+	struct symlist *sym;
+
+	if (nsyms == SYM_HUNDEF)
+		errx(1, "too many symbols");
+
+	if (!symslabs || !(nsyms % SYM_SLAB)) {
+		if (!(symslabs = reallocarray(symslabs,
+		    nsyms / SYM_SLAB + 1, sizeof *symslabs)))
+			err(1, "reallocarray");
+		if (!(symslabs[nsyms / SYM_SLAB] = calloc(SYM_SLAB,
+		    sizeof **symslabs)))
+			err(1, "calloc");
+	}
+
+	sym = &symslabs[nsyms / SYM_SLAB][nsyms % SYM_SLAB];
+	sym->sl_no = nsyms++;
+	if (name)
+		sym->sl_name = sym_name(name);
+
+	return sym;
+}
+
+struct symlist *
+sym_get(uint32_t no)
+{
+	if (!no || no >= nsyms)
+		return NULL;
+
+	return &symslabs[no / SYM_SLAB][no % SYM_SLAB];
+}
+
+/*
+ * copy the name into the pool
+ */
+const char *
+sym_name(const char *name)
 {
-	return strcmp(a->sl_name, b->sl_name);
+	size_t len;
+	char *p;
+
+	len = strlen(name) + 1;
+	if (len > SYM_NAMEPOOL / 4) {
+		if (!(p = strdup(name)))
+			err(1, "strdup");
+		return p;
+	}
+
+	if (len > namefree) {
+		if (!(namepool = malloc(SYM_NAMEPOOL)))
+			err(1, "malloc");
+		namefree = SYM_NAMEPOOL;
+	}
+
+	p = namepool;
+	memcpy(p, name, len);
+	namepool += len;
+	namefree -= len;
+	return p;
 }
 
-RB_HEAD(symtree, symlist) undsyms = RB_INITIALIZER(undsyms),
-    defsyms = RB_INITIALIZER(defsyms);
+/*
+ * the cross-references of the symbol
+ */
+struct xrefhead *
+sym_xref(struct symlist *sym)
+{
+	uint32_t n;
 
-RB_PROTOTYPE(symtree, symlist, sl_node, symcmp);
+	if (sym->sl_no >= nsymxrefs) {
+		n = nsymxrefs;
+		nsymxrefs = roundup(sym->sl_no + 1, SYM_SLAB);
+		if (!(symxrefs = reallocarray(symxrefs, nsymxrefs,
+		    sizeof *symxrefs)))
+			err(1, "reallocarray");
+		for (; n < nsymxrefs; n++)
+			TAILQ_INIT(&symxrefs[n]);
+	}
 
-RB_GENERATE(symtree, symlist, sl_node, symcmp);
+	return &symxrefs[sym->sl_no];
+}
+
+/*
+ * the index of the symbol in the relocatable output
+ */
+uint32_t *
+sym_idx(struct symlist *sym)
+{
+	uint32_t n;
+
+	if (sym->sl_no >= nsymidxs) {
+		n = nsymidxs;
+		nsymidxs = roundup(sym->sl_no + 1, SYM_SLAB);
+		if (!(symidxs = reallocarray(symidxs, nsymidxs,
+		    sizeof *symidxs)))
+			err(1, "reallocarray");
+		memset(symidxs + n, 0, (nsymidxs - n) * sizeof *symidxs);
+	}
+
+	return &symidxs[sym->sl_no];
+}
+
+/*
+ * find the hash slot of the name or the empty one for it
+ */
+static uint32_t *
+sym_hlook(const char *name)
+{
+	struct symlist *sym;
+	size_t len;
+	uint32_t i;
+
+	if (!symhash) {
+		symhmask = SYM_SLAB - 1;
+		if (!(symhash = calloc(symhmask + 1, sizeof *symhash)))
+			err(1, "calloc");
+	}
+
+	for (i = strtab_hash(name, &len) & symhmask; symhash[i];
+	    i = (i + 1) & symhmask) {
+		sym = sym_get(symhash[i] & ~SYM_HUNDEF);
+		if (!strcmp(sym->sl_name, name))
+			break;
+	}
+
+	return &symhash[i];
+}
+
+/*
+ * enter the symbol into the hash unless the name is there already;
+ * the hash is doubled when half full
+ */
+static void
+sym_hadd(struct symlist *sym, uint32_t undef)
+{
+	uint32_t *oh, *hp, i, omask;
+
+	if (*(hp = sym_hlook(sym->sl_name)))
+		return;
+	*hp = sym->sl_no | undef;
+	if (++symhused <= symhmask / 2)
+		return;
+
+	oh = symhash;
+	omask = symhmask;
+	symhmask = symhmask * 2 + 1;
+	if (!(symhash = calloc(symhmask + 1, sizeof *symhash)))
+		err(1, "calloc");
+	for (i = 0; i <= omask; i++)
+		if (oh[i]) {
+			hp = sym_hlook(sym_get(oh[i] & ~SYM_HUNDEF)->sl_name);
+			*hp = oh[i];
+		}
+	free(oh);
+}
+
+/*
+ * clear the slot moving up the entries that probed past it
+ */
+static void
+sym_hdel(uint32_t *hp)
+{
+	size_t len;
+	uint32_t i, j, k;
+
+	symhused--;
+	for (i = j = hp - symhash; ; ) {
+		j = (j + 1) & symhmask;
+		if (!symhash[j])
+			break;
+		k = strtab_hash(sym_get(symhash[j] & ~SYM_HUNDEF)->sl_name,
+		    &len) & symhmask;
+		/* stays if its home is cyclically within (i, j] */
+		if (i <= j? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		symhash[i] = symhash[j];
+		i = j;
+	}
+	symhash[i] = 0;
+}
+
+static int
+sym_namecmp(const void *a, const void *b)
+{
+	return strcmp(sym_get(*(const uint32_t *)a)->sl_name,
+	    sym_get(*(const uint32_t *)b)->sl_name);
+}
+
+/*
+ * the numbers of the symbols (un)defined sorted by the name;
+ * the table may change under the callers thus a copy
+ */
+static uint32_t *
+sym_sorted(uint32_t undef, uint32_t *pn)
+{
+	uint32_t *sv, i, n;
+
+	if (!(sv = reallocarray(NULL, symhused + 1, sizeof *sv)))
+		err(1, "reallocarray");
+
+	for (i = n = 0; symhash && i <= symhmask; i++)
+		if (symhash[i] && (symhash[i] & SYM_HUNDEF) == undef)
+			sv[n++] = symhash[i] & ~SYM_HUNDEF;
+	qsort(sv, n, sizeof *sv, sym_namecmp);
+
+	*pn = n;
+	return sv;
+}
+
+/*
+ * append to the list of the section symbols
+ */
+void
+sym_qadd(struct symq *q, struct symlist *sym)
+{
+	sym->sl_snext = 0;
+	sym->sl_sprev = q->sq_last;
+	if (q->sq_last)
+		sym_get(q->sq_last)->sl_snext = sym->sl_no;
+	else
+		q->sq_first = sym->sl_no;
+	q->sq_last = sym->sl_no;
+}
+
+void
+sym_qdel(struct symq *q, struct symlist *sym)
+{
+	if (sym->sl_snext)
+		sym_get(sym->sl_snext)->sl_sprev = sym->sl_sprev;
+	else
+		q->sq_last = sym->sl_sprev;
+	if (sym->sl_sprev)
+		sym_get(sym->sl_sprev)->sl_snext = sym->sl_snext;
+	else
+		q->sq_first = sym->sl_snext;
+	sym->sl_snext = sym->sl_sprev = 0;
+}
 
 /*
  * add and return a symbol as undefined
@@ -53,14 +315,13 @@ sym_undef(const char *name)
 {
 	struct symlist *sym;
 
-	if (!(sym = calloc(1, sizeof *sym)))
-		err(1, "calloc");
-	TAILQ_INIT(&sym->sl_xref);
-
-	if (!(sym->sl_name = strdup(name)))
-		err(1, "strdup");
+	if (name && (sym = sym_isundef(name)))
+		return sym;
 
-	RB_INSERT(symtree, &undsyms, sym);
+	sym = sym_new(name);
+	if (name)
+		sym_hadd(sym, SYM_HUNDEF);
+	sym_undgen++;
 	return sym;
 }
 
@@ -70,11 +331,13 @@ sym_undef(const char *name)
 struct symlist *
 sym_isundef(const char *name)
 {
-	struct symlist key;
+	uint32_t *hp;
 
-	bzero(&key, sizeof key);
-	key.sl_name = name;
-	return RB_FIND(symtree, &undsyms, &key);
+	hp = sym_hlook(name);
+	if (!(*hp & SYM_HUNDEF))
+		return NULL;
+
+	return sym_get(*hp & ~SYM_HUNDEF);
 }
 
 /*
@@ -83,13 +346,12 @@ sym_isundef(const char *name)
 struct symlist *
 sym_define(struct symlist *sym, struct section *os, void *esym)
 {
-	RB_REMOVE(symtree, &undsyms, sym);
+	*sym_hlook(sym->sl_name) &= ~SYM_HUNDEF;
 	sym->sl_sect = os;
-	memcpy(&sym->sl_elfsym, esym, sizeof sym->sl_elfsym);
-	RB_INSERT(symtree, &defsyms, sym);
+	memcpy(&sym->sl_elfsym, esym, SYM_ESIZE);
 	/* ABS symbols have no section */
 	if (os)
-		TAILQ_INSERT_TAIL(&os->os_syms, sym, sl_entry);
+		sym_qadd(&os->os_syms, sym);
 	return sym;
 }
 
@@ -100,11 +362,11 @@ struct symlist *
 sym_redef(struct symlist *sym, struct section *os, void *esym)
 {
 	if (sym->sl_sect)
-		TAILQ_REMOVE(&sym->sl_sect->os_syms, sym, sl_entry);
+		sym_qdel(&sym->sl_sect->os_syms, sym);
 	sym->sl_sect = os;
 	if (esym)
-		memcpy(&sym->sl_elfsym, esym, sizeof sym->sl_elfsym);
-	TAILQ_INSERT_TAIL(&os->os_syms, sym, sl_entry);
+		memcpy(&sym->sl_elfsym, esym, SYM_ESIZE);
+	sym_qadd(&os->os_syms, sym);
 	return sym;
 }
 
@@ -116,19 +378,13 @@ sym_add(const char *name, struct section *os, void *esym)
 {
 	struct symlist *sym;
 
-	if (!(sym = calloc(1, sizeof *sym)))
-		err(1, "calloc");
-	TAILQ_INIT(&sym->sl_xref);
-
-	if (!(sym->sl_name = strdup(name)))
-		err(1, "strdup");
-
+	sym = sym_new(name);
 	sym->sl_sect = os;
-	memcpy(&sym->sl_elfsym, esym, sizeof sym->sl_elfsym);
-	RB_INSERT(symtree, &defsyms, sym);
+	memcpy(&sym->sl_elfsym, esym, SYM_ESIZE);
+	sym_hadd(sym, 0);
 	/* ABS symbols have no section */
 	if (os)
-		TAILQ_INSERT_TAIL(&os->os_syms, sym, sl_entry);
+		sym_qadd(&os->os_syms, sym);
 	return sym;
 }
 
@@ -138,16 +394,60 @@ sym_add(const char *name, struct section *os, void *esym)
 struct symlist *
 sym_isdefined(const char *name, struct section *os)
 {
-	struct symlist key, *sym;
+	uint32_t *hp;
 
-	bzero(&key, sizeof key);
-	key.sl_name = name;
-	if (!(sym = RB_FIND(symtree, &defsyms, &key)) && os) {
-		key.sl_sect = os;
-		sym = RB_FIND(symtree, &defsyms, &key);
-	}
+	hp = sym_hlook(name);
+	if (!*hp || (*hp & SYM_HUNDEF))
+		return NULL;
 
-	return sym;
+	return sym_get(*hp);
+}
+
+/*
+ * give a defined symbol a new name (for the clashing locals)
+ */
+void
+sym_rename(struct symlist *sym, const char *name)
+{
+	sym_hdel(sym_hlook(sym->sl_name));
+	sym->sl_name = sym_name(name);
+	sym_hadd(sym, 0);
+}
+
+/*
+ * call a given function over all defined symbols in the name order
+ */
+int
+sym_foreach(int (*func)(struct symlist *, void *), void *v)
+{
+	uint32_t *sv, i, n;
+	int rv = 0;
+
+	sv = sym_sorted(0, &n);
+	for (i = 0; i < n; i++)
+		if ((rv = (*func)(sym_get(sv[i]), v)))
+			break;
+	free(sv);
+
+	return rv != 0;
+}
+
+/*
+ * same for the symbols still undefined
+ */
+int
+sym_undforeach(int (*func)(struct symlist *, void *), void *v)
+{
+	uint32_t *sv, i, n;
+	int rv = 0;
+
+	sv = sym_sorted(SYM_HUNDEF, &n);
+	for (i = 0; i < n; i++)
+		if ((rv = (*func)(sym_get(sv[i]), v)))
+			break;
+	free(sv);
+
+	return rv != 0;
 }
 
 /*
@@ -158,20 +458,35 @@ sym_isdefined(const char *name, struct section *os)
 void
 sym_remove(struct symlist *sym)
 {
+	struct xrefhead *xh;
 	struct xreflist *xl;
 
 	if (sym->sl_sect)
-		TAILQ_REMOVE(&sym->sl_sect->os_syms, sym, sl_entry);
-	RB_REMOVE(symtree, &defsyms, sym);
-	free((char *)sym->sl_name);	/* it was const */
+		sym_qdel(&sym->sl_sect->os_syms, sym);
+	sym_hdel(sym_hlook(sym->sl_name));
 	/* only when cref is set */
-	while (!TAILQ_EMPTY(&sym->sl_xref)) {
-		xl = TAILQ_FIRST(&sym->sl_xref);
-		TAILQ_REMOVE(&sym->sl_xref, xl, xl_entry);
-		free(xl);
+	if (sym->sl_no < nsymxrefs) {
+		xh = &symxrefs[sym->sl_no];
+		while (!TAILQ_EMPTY(xh)) {
+			xl = TAILQ_FIRST(xh);
+			TAILQ_REMOVE(xh, xl, xl_entry);
+			free(xl);
+		}
 	}
 }
 
+static int
+sym_undwarn(struct symlist *sym, void *v)
+{
+	if (sym->sl_sect)
+		warnx("%s: undefined, first used in %s",
+		    sym->sl_name, sym->sl_sect->os_obj->ol_name);
+	else
+		warnx("%s: undefined", sym->sl_name);
+	*(int *)v = -1;
+	return 0;
+}
+
 /*
  * if there are any undefined symbols left
  * report 'em now
@@ -179,22 +494,33 @@ sym_remove(struct symlist *sym)
 int
 sym_undcheck(void)
 {
-	struct symlist *sym;
 	int err = 0;
 
-	RB_FOREACH(sym, symtree, &undsyms) {
-		if (!sym->sl_name)
-			continue;
-		if (sym->sl_sect)
-			warnx("%s: undefined, first used in %s",
-			    sym->sl_name,
-			    sym->sl_sect->os_obj->ol_name);
-		else
-			warnx("%s: undefined", sym->sl_name);
-		err = -1;
+	sym_undforeach(sym_undwarn, &err);
+	return err;
+}
+
+static int
+sym_crefprint(struct symlist *sym, void *v)
+{
+	struct xreflist *xl;
+	FILE *mfp = v;
+	int first = 1;
+
+	if (sym->sl_no >= nsymxrefs)
+		return 0;
+
+	TAILQ_FOREACH(xl, &symxrefs[sym->sl_no], xl_entry) {
+		if (first) {
+			fprintf(mfp, "%-16s", sym->sl_name);
+			first = 0;
+		} else
+			fprintf(mfp, "\t\t");
+
+		fprintf(mfp, "\t%s\n", xl->xl_obj->ol_name);
 	}
 
-	return err;
+	return 0;
 }
 
 /*
@@ -213,26 +539,17 @@ sym_printmap(struct headorder *headorder, ordprint_t of, symprint_t sf)
 			err(1, "fopen: %s", mapfile);
 	}
 
+	if (sort_section)
+		fprintf(mfp, "Sections sorted: padding 0x%llx was 0x%llx, "
+		    "%lld bytes saved\n\n", (unsigned long long)sort_after,
+		    (unsigned long long)sort_before,
+		    (long long)(sort_before - sort_after));
+
 	sym_scan(TAILQ_FIRST(headorder), of, sf, mfp);
 
 	if (cref) {
-		struct symlist *sym;
-
 		fputs("\nCross reference table:\n\n", mfp);
-		RB_FOREACH(sym, symtree, &defsyms) {
-			struct xreflist *xl;
-			int first = 1;
-
-			TAILQ_FOREACH(xl, &sym->sl_xref, xl_entry) {
-				if (first) {
-					fprintf(mfp, "%-16s", sym->sl_name);
-					first = 0;
-				} else
-					fprintf(mfp, "\t\t");
-
-				fprintf(mfp, "\t%s\n", xl->xl_obj->ol_name);
-			}
-		}
+		sym_foreach(sym_crefprint, mfp);
 	}
 
 	if (mapfile)
@@ -257,7 +574,7 @@ sym_scan(const struct ldorder *order, ordprint_t of, symprint_t sf, void *v)
 		TAILQ_FOREACH(os, &order->ldo_seclst, os_entry) {
 			struct symlist *sym;
 
-			TAILQ_FOREACH(sym, &os->os_syms, sl_entry)
+			SYMQ_FOREACH(sym, &os->os_syms)
 				if (sf && (*sf)(order, os, sym, v))
 					return;
 		}
@@ -265,20 +582,530 @@ sym_scan(const struct ldorder *order, ordprint_t of, symprint_t sf, void *v)
 }
 
 /*
- * these are comparison functions used to sort relocation
- * array in elf_loadrelocs()
+ * sort the relocation array read in elf_readrelocs() by the address;
+ * lsd radix sort one byte at a time with all the counts collected
+ * in one pass; digits that are the same for all the entries
+ * (most of the upper bytes) are skipped.
+ * the sort is stable thus relocs for the same address keep the order.
+ */
+void
+rel_sort(struct relist *rl, size_t n)
+{
+	size_t cnt[sizeof rl->rl_addr][256], *c;
+	struct relist *tmp, *src, *dst, *t;
+	size_t i, j, sum;
+	uint64_t a;
+	int d, shift;
+
+	if (n < 2)
+		return;
+
+	/* too few to bother with */
+	if (n < 32) {
+		struct relist r;
+
+		for (i = 1; i < n; i++) {
+			r = rl[i];
+			for (j = i; j > 0 && rl[j - 1].rl_addr > r.rl_addr; j--)
+				rl[j] = rl[j - 1];
+			rl[j] = r;
+		}
+		return;
+	}
+
+	memset(cnt, 0, sizeof cnt);
+	for (i = 0; i < n; i++)
+		for (a = rl[i].rl_addr, d = 0; d < sizeof a; d++, a >>= 8)
+			cnt[d][a & 0xff]++;
+
+	if (!(tmp = reallocarray(NULL, n, sizeof *tmp)))
+		err(1, "reallocarray");
+
+	src = rl;
+	dst = tmp;
+	for (d = 0, shift = 0; d < sizeof a; d++, shift += 8) {
+		c = cnt[d];
+		/* all in one bucket -- nothing to move */
+		if (c[(src[0].rl_addr >> shift) & 0xff] == n)
+			continue;
+
+		for (sum = 0, j = 0; j < 256; j++) {
+			i = c[j];
+			c[j] = sum;
+			sum += i;
+		}
+
+		for (i = 0; i < n; i++)
+			dst[c[(src[i].rl_addr >> shift) & 0xff]++] = src[i];
+
+		t = src;
+		src = dst;
+		dst = t;
+	}
+
+	if (src != rl)
+		memcpy(rl, src, n * sizeof *rl);
+	free(tmp);
+}
+
+/*
+ * string table builder;
+ * strings are only kept once (looked up through the hash)
+ * and those that are a tail of some other string point
+ * into that longer string (as in "foo" pointing into "barfoo").
+ * strings are added first getting an index each and only after
+ * strtab_finish() is done the offsets are known.
+ */
+struct strent {
+	const char *se_str;
+	size_t se_len;
+	size_t se_off;			/* offset in the table */
+	int se_own;			/* the string is written out */
+};
+
+uint32_t
+strtab_hash(const char *s, size_t *plen)
+{
+	const u_char *p;
+	uint32_t h = 2166136261U;
+
+	for (p = (const u_char *)s; *p; p++)
+		h = (h ^ *p) * 16777619U;
+	*plen = p - (const u_char *)s;
+	return h;
+}
+
+void
+strtab_init(struct strtab *st)
+{
+	st->st_ents = NULL;
+	st->st_nents = st->st_maxents = 0;
+	st->st_hsize = 1024;
+	if (!(st->st_hash = calloc(st->st_hsize, sizeof *st->st_hash)))
+		err(1, "calloc");
+	st->st_size = 1;
+}
+
+/*
+ * add a string returning its index;
+ * the string must stay put until the table is written out
+ */
+u_int
+strtab_add(struct strtab *st, const char *str)
+{
+	size_t len;
+	uint32_t h;
+
+	h = strtab_hash(str, &len);
+	return strtab_addh(st, str, h, len);
+}
+
+/*
+ * same with the hash (see strtab_hash()) and the length known already
+ */
+u_int
+strtab_addh(struct strtab *st, const char *str, uint32_t h, size_t len)
+{
+	struct strent *se;
+	u_int *hp, *nh;
+	size_t i, j;
+
+	for (i = h & (st->st_hsize - 1); st->st_hash[i];
+	    i = (i + 1) & (st->st_hsize - 1)) {
+		se = &st->st_ents[st->st_hash[i] - 1];
+		if (se->se_len == len && !memcmp(se->se_str, str, len))
+			return st->st_hash[i] - 1;
+	}
+	hp = &st->st_hash[i];
+
+	if (st->st_nents == st->st_maxents) {
+		st->st_maxents = st->st_maxents? st->st_maxents * 2 : 256;
+		if (!(st->st_ents = reallocarray(st->st_ents,
+		    st->st_maxents, sizeof *st->st_ents)))
+			err(1, "reallocarray");
+	}
+
+	se = &st->st_ents[st->st_nents];
+	se->se_str = str;
+	se->se_len = len;
+	se->se_off = 0;
+	se->se_own = 0;
+	*hp = ++st->st_nents;
+
+	/* keep the hash at most half full */
+	if (st->st_nents * 2 > st->st_hsize) {
+		if (!(nh = calloc(st->st_hsize * 2, sizeof *nh)))
+			err(1, "calloc");
+		st->st_hsize *= 2;
+		for (j = 0; j < st->st_nents; j++) {
+			se = &st->st_ents[j];
+			h = strtab_hash(se->se_str, &len);
+			for (i = h & (st->st_hsize - 1); nh[i];
+			    i = (i + 1) & (st->st_hsize - 1))
+				;
+			nh[i] = j + 1;
+		}
+		free(st->st_hash);
+		st->st_hash = nh;
+	}
+
+	return st->st_nents - 1;
+}
+
+/*
+ * compare reversed strings; a string sorts right after
+ * all the strings it is a tail of
+ */
+static int
+strtab_tailcmp(const void *a0, const void *b0)
+{
+	const struct strent *a = *(struct strent * const *)a0;
+	const struct strent *b = *(struct strent * const *)b0;
+	const u_char *p, *q;
+
+	p = (const u_char *)a->se_str + a->se_len;
+	q = (const u_char *)b->se_str + b->se_len;
+	while (p > (const u_char *)a->se_str && q > (const u_char *)b->se_str)
+		if (*--p != *--q)
+			return *p < *q? -1 : 1;
+
+	/* longer goes first */
+	return (b->se_len > a->se_len) - (b->se_len < a->se_len);
+}
+
+/*
+ * the sort order above is the same as of the last two characters
+ * (a single character string goes after all the longer ones ending
+ * in the same character and the empty one goes last);
+ * buckets by those are independent and sorted in parallel
+ */
+#define	STRTAB_NKEYS	(256 * 257 + 1)
+
+static u_int
+strtab_key(const struct strent *se)
+{
+	const u_char *p = (const u_char *)se->se_str + se->se_len;
+
+	if (!se->se_len)
+		return STRTAB_NKEYS - 1;
+
+	return p[-1] * 257 + (se->se_len > 1? p[-2] : 256);
+}
+
+struct strtabs {
+	struct strent **ss_sv;
+	size_t *ss_jobs;		/* bucket start and size pairs */
+};
+
+static void
+strtab_sort(void *v, int i, int w)
+{
+	struct strtabs *ss = v;
+
+	qsort(ss->ss_sv + ss->ss_jobs[2 * i], ss->ss_jobs[2 * i + 1],
+	    sizeof *ss->ss_sv, strtab_tailcmp);
+}
+
+/*
+ * assign the offsets merging the tails;
+ * returns the table size
+ */
+size_t
+strtab_finish(struct strtab *st)
+{
+	struct strent **sv, *se, *prev;
+	struct strtabs ss;
+	size_t i, k, n, *cnt;
+
+	if (!st->st_nents)
+		return st->st_size;
+
+	if (!(sv = reallocarray(NULL, st->st_nents, sizeof *sv)))
+		err(1, "reallocarray");
+
+	if (st->st_nents < STRTAB_CHUNK) {
+		for (i = 0; i < st->st_nents; i++)
+			sv[i] = &st->st_ents[i];
+		qsort(sv, st->st_nents, sizeof *sv, strtab_tailcmp);
+	} else {
+		if (!(cnt = calloc(STRTAB_NKEYS + 1, sizeof *cnt)))
+			err(1, "calloc");
+		for (i = 0; i < st->st_nents; i++)
+			cnt[strtab_key(&st->st_ents[i]) + 1]++;
+
+		/* the bucket starts; collect those worth sorting */
+		if (!(ss.ss_jobs = reallocarray(NULL, STRTAB_NKEYS,
+		    2 * sizeof *ss.ss_jobs)))
+			err(1, "reallocarray");
+		for (n = 0, k = 0; k < STRTAB_NKEYS; k++) {
+			if (cnt[k + 1] > 1) {
+				ss.ss_jobs[2 * n] = cnt[k];
+				ss.ss_jobs[2 * n++ + 1] = cnt[k + 1];
+			}
+			cnt[k + 1] += cnt[k];
+		}
+
+		for (i = 0; i < st->st_nents; i++)
+			sv[cnt[strtab_key(&st->st_ents[i])]++] =
+			    &st->st_ents[i];
+		free(cnt);
+
+		ss.ss_sv = sv;
+		pool_run(n, strtab_sort, &ss);
+		free(ss.ss_jobs);
+	}
+
+	for (prev = NULL, i = 0; i < st->st_nents; i++) {
+		se = sv[i];
+		if (!se->se_len)
+			se->se_off = 0;
+		else if (prev && prev->se_len >= se->se_len &&
+		    !memcmp(prev->se_str + prev->se_len - se->se_len,
+		    se->se_str, se->se_len))
+			se->se_off = prev->se_off + prev->se_len - se->se_len;
+		else {
+			se->se_off = st->st_size;
+			se->se_own = 1;
+			st->st_size += se->se_len + 1;
+			prev = se;
+		}
+	}
+	free(sv);
+
+	return st->st_size;
+}
+
+size_t
+strtab_off(const struct strtab *st, u_int idx)
+{
+	return st->st_ents[idx].se_off;
+}
+
+struct strtabw {
+	const struct strtab *sw_st;
+	char *sw_p;
+};
+
+static void
+strtab_wchunk(void *v, int i, int w)
+{
+	struct strtabw *sw = v;
+	const struct strent *se, *ee;
+
+	se = sw->sw_st->st_ents + (size_t)i * STRTAB_CHUNK;
+	ee = sw->sw_st->st_ents + sw->sw_st->st_nents;
+	if (ee > se + STRTAB_CHUNK)
+		ee = se + STRTAB_CHUNK;
+
+	for (; se < ee; se++)
+		if (se->se_own)
+			memcpy(sw->sw_p + se->se_off, se->se_str,
+			    se->se_len + 1);
+}
+
+/*
+ * write out the table into the buffer (at least strtab_finish() bytes);
+ * the strings owned never overlap so the chunks go in parallel
+ */
+void
+strtab_write(const struct strtab *st, char *p)
+{
+	struct strtabw sw;
+
+	*p = '\0';
+	sw.sw_st = st;
+	sw.sw_p = p;
+	pool_run((st->st_nents + STRTAB_CHUNK - 1) / STRTAB_CHUNK,
+	    strtab_wchunk, &sw);
+}
+
+void
+strtab_free(struct strtab *st)
+{
+	free(st->st_ents);
+	free(st->st_hash);
+	st->st_ents = NULL;
+	st->st_hash = NULL;
+	st->st_nents = st->st_maxents = st->st_hsize = 0;
+}
+
+/*
+ * COMDAT group signatures claimed by the objects linked in
+ */
+struct comdat {
+	const char *cd_sig;
+	struct objlist *cd_obj;
+} *comdats;
+size_t ncomdats, comdatsz;
+
+/*
+ * find the object owning the group signature;
+ * if nobody does and asked to -- claim it for the object.
+ */
+struct objlist *
+comdat_claim(const char *sig, struct objlist *ol, int claim)
+{
+	struct comdat *cd, *ncd;
+	size_t i, j, len;
+	uint32_t h;
+
+	if (!comdatsz) {
+		if (!claim)
+			return NULL;
+		comdatsz = 1024;
+		if (!(comdats = calloc(comdatsz, sizeof *comdats)))
+			err(1, "calloc");
+	}
+
+	h = strtab_hash(sig, &len);
+	for (i = h & (comdatsz - 1); (cd = &comdats[i])->cd_sig;
+	    i = (i + 1) & (comdatsz - 1))
+		if (!strcmp(cd->cd_sig, sig))
+			return cd->cd_obj;
+
+	if (!claim)
+		return NULL;
+
+	cd->cd_sig = sig;
+	cd->cd_obj = ol;
+
+	/* keep the hash at most half full */
+	if (++ncomdats * 2 > comdatsz) {
+		if (!(ncd = calloc(comdatsz * 2, sizeof *ncd)))
+			err(1, "calloc");
+		for (j = 0; j < comdatsz; j++) {
+			if (!comdats[j].cd_sig)
+				continue;
+			h = strtab_hash(comdats[j].cd_sig, &len);
+			for (i = h & (comdatsz * 2 - 1); ncd[i].cd_sig;
+			    i = (i + 1) & (comdatsz * 2 - 1))
+				;
+			ncd[i] = comdats[j];
+		}
+		free(comdats);
+		comdats = ncd;
+		comdatsz *= 2;
+	}
+
+	return ol;
+}
+
+/*
+ * sub-orders for the sections pulled into an order;
+ * sections are grouped by the first matching name prefix
+ * in the order of the list; an empty prefix stands for the rest.
+ * keep cold code and data out of the hot pages.
+ */
+const char * const ld_textsub[] = {
+	".text.hot", "", ".text.startup", ".text.exit", ".text.unlikely",
+	NULL
+};
+
+const char * const ld_datasub[] = {
+	".data.rel.ro.hot", ".data.hot", ".data.rel.ro", "", ".data.unlikely",
+	NULL
+};
+
+/*
+ * find the sub-order rank for the section name;
+ * prefixes only match complete name components
  */
 int
-rel_addrcmp(const void *a0, const void *b0)
+order_subrank(const struct ldorder *order, const char *name)
 {
-	const struct relist *a = a0, *b = b0;
+	const char * const *sp;
+	size_t len;
+	int i, rest;
 
-	if (a->rl_addr < b->rl_addr)
-		return -1;
-	else if (a->rl_addr > b->rl_addr)
-		return 1;
-	else
-		return 0;
+	for (i = rest = 0, sp = order->ldo_subord; *sp; sp++, i++) {
+		if (!**sp) {
+			rest = i;
+			continue;
+		}
+
+		len = strlen(*sp);
+		if (!strncmp(name, *sp, len) &&
+		    (name[len] == '\0' || name[len] == '.'))
+			return i;
+	}
+
+	return rest;
+}
+
+/*
+ * add the section order to the index by its name
+ */
+void
+order_index(struct ordindex *oi, struct ldorder *order)
+{
+	struct ordtrie *ot;
+	const u_char *p;
+	int n, c;
+
+	if (!oi->oi_trie) {
+		oi->oi_maxtrie = 64;
+		if (!(oi->oi_trie = calloc(oi->oi_maxtrie, sizeof *ot)))
+			err(1, "calloc");
+		oi->oi_ntrie = 1;
+	}
+
+	for (n = 0, p = (const u_char *)order->ldo_name; *p; p++) {
+		for (c = oi->oi_trie[n].ot_child; c;
+		    c = oi->oi_trie[c].ot_next)
+			if (oi->oi_trie[c].ot_c == *p)
+				break;
+
+		if (!c) {
+			if (oi->oi_ntrie == oi->oi_maxtrie) {
+				oi->oi_maxtrie *= 2;
+				if (!(oi->oi_trie = reallocarray(oi->oi_trie,
+				    oi->oi_maxtrie, sizeof *ot)))
+					err(1, "reallocarray");
+			}
+			c = oi->oi_ntrie++;
+			ot = &oi->oi_trie[c];
+			ot->ot_order = NULL;
+			ot->ot_child = 0;
+			ot->ot_c = *p;
+			ot->ot_next = oi->oi_trie[n].ot_child;
+			oi->oi_trie[n].ot_child = c;
+		}
+		n = c;
+	}
+
+	/* first one wins */
+	if (!oi->oi_trie[n].ot_order)
+		oi->oi_trie[n].ot_order = order;
+}
+
+/*
+ * find the section order for the section name;
+ * the longest order name matching the beginning wins
+ * (thus .text.foo is pulled into .text unless there is .text.foo order).
+ */
+struct ldorder *
+order_find(const struct ordindex *oi, const char *name)
+{
+	struct ldorder *order;
+	const u_char *p;
+	int n, c;
+
+	if (!oi->oi_trie)
+		return NULL;
+
+	order = NULL;
+	for (n = 0, p = (const u_char *)name; *p; p++, n = c) {
+		for (c = oi->oi_trie[n].ot_child; c;
+		    c = oi->oi_trie[c].ot_next)
+			if (oi->oi_trie[c].ot_c == *p)
+				break;
+		if (!c)
+			break;
+		if (oi->oi_trie[c].ot_order)
+			order = oi->oi_trie[c].ot_order;
+	}
+
+	return order;
 }
 
 /*
@@ -298,6 +1125,8 @@ order_clone(const struct ldarch *lda, const struct ldorder *order)
 	neworder->ldo_type = order->ldo_type;
 	neworder->ldo_flags = order->ldo_flags;
 	neworder->ldo_shflags = order->ldo_shflags;
+	neworder->ldo_filler = order->ldo_filler;
+	neworder->ldo_subord = order->ldo_subord;
 	neworder->ldo_arch = lda;
 
 	return neworder;
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2014 Michael Shalayeff
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef lint
+static const char rcsid[] =
+    "$ABSD$";
+#endif
+
+/*
+ * compression of the debugging sections on output:
+ * every chunk is deflated on its own by the pool workers
+ * and flushed to the byte boundary so the raw streams can be
+ * glued together in one zlib stream with the checksums combined.
+ */
+
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <elf_abi.h>
+#include <elfuncs.h>
+#include <a.out.h>
+#include <err.h>
+
+#include "ld.h"
+
+int compress_debug;	/* 0 - none or LD_ZDEBUG_ZLIB */
+
+struct zdchunk {
+	u_char *zc_buf;		/* deflated */
+	size_t zc_len;
+	uLong zc_adler;		/* of the input */
+};
+
+struct zdjob {
+	const u_char *zj_buf;	/* input */
+	size_t zj_len;
+	int zj_nchunks;
+	struct zdchunk *zj_chunks;
+};
+
+void zd_chunk(void *, int, int);
+
+void
+zd_chunk(void *v, int i, int w)
+{
+	struct zdjob *zj = v;
+	struct zdchunk *zc = &zj->zj_chunks[i];
+	const u_char *p = zj->zj_buf + (size_t)i * LD_ZDEBUG_CHUNK;
+	z_stream zs;
+	size_t n;
+	int last;
+
+	n = MIN(LD_ZDEBUG_CHUNK, zj->zj_len - (size_t)i * LD_ZDEBUG_CHUNK);
+	last = i == zj->zj_nchunks - 1;
+	zc->zc_adler = adler32(adler32(0, NULL, 0), p, n);
+
+	memset(&zs, 0, sizeof zs);
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+	    8, Z_DEFAULT_STRATEGY) != Z_OK)
+		errx(1, "deflateInit2: %s", zs.msg? zs.msg : "failed");
+
+	/* the bound is for Z_FINISH; the full flush adds an empty block */
+	zc->zc_len = deflateBound(&zs, n) + 16;
+	if (!(zc->zc_buf = malloc(zc->zc_len)))
+		err(1, "malloc");
+
+	zs.next_in = (Bytef *)p;
+	zs.avail_in = n;
+	zs.next_out = zc->zc_buf;
+	zs.avail_out = zc->zc_len;
+	if (deflate(&zs, last? Z_FINISH : Z_FULL_FLUSH) !=
+	    (last? Z_STREAM_END : Z_OK) || zs.avail_in || !zs.avail_out)
+		errx(1, "deflate: %s", zs.msg? zs.msg : "botch");
+
+	zc->zc_len = zs.total_out;
+	deflateEnd(&zs);
+}
+
+/*
+ * deflate len bytes of the buf into a zlib stream returned
+ * in the buffer following the hlen bytes left for the header;
+ * the total length is returned in *zlen.
+ */
+u_char *
+zdebug_deflate(const u_char *buf, size_t len, size_t hlen, size_t *zlen)
+{
+	struct zdjob zj;
+	struct zdchunk *zc;
+	u_char *zbuf, *p;
+	uLong adler;
+	size_t n;
+
+	n = (len + LD_ZDEBUG_CHUNK - 1) / LD_ZDEBUG_CHUNK;
+	if (!n)
+		n = 1;
+	if (n > INT_MAX)
+		errx(1, "debugging section too large");
+
+	zj.zj_buf = buf;
+	zj.zj_len = len;
+	zj.zj_nchunks = n;
+	if (!(zj.zj_chunks = calloc(n, sizeof *zj.zj_chunks)))
+		err(1, "calloc");
+
+	pool_run(n, zd_chunk, &zj);
+
+	/* header, the chunks and the checksum */
+	*zlen = hlen + 2 + 4;
+	for (zc = zj.zj_chunks; zc < zj.zj_chunks + n; zc++)
+		*zlen += zc->zc_len;
+	if (!(zbuf = malloc(*zlen)))
+		err(1, "malloc");
+
+	p = zbuf + hlen;
+	*p++ = 0x78;	/* deflate, 32k window */
+	*p++ = 0x9c;	/* default level, checked */
+	adler = adler32(0, NULL, 0);
+	for (zc = zj.zj_chunks; zc < zj.zj_chunks + n; zc++) {
+		memcpy(p, zc->zc_buf, zc->zc_len);
+		p += zc->zc_len;
+		adler = adler32_combine(adler, zc->zc_adler,
+		    MIN(LD_ZDEBUG_CHUNK, len - (zc - zj.zj_chunks) *
+		    (size_t)LD_ZDEBUG_CHUNK));
+		free(zc->zc_buf);
+	}
+	*p++ = adler >> 24;
+	*p++ = adler >> 16;
+	*p++ = adler >> 8;
+	*p++ = adler;
+
+	free(zj.zj_chunks);
+	return zbuf;
+}
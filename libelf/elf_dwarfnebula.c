@@ -50,6 +50,7 @@ elf_dwarfnebula(const char *name, FILE *fp, off_t foff, const Elf_Ehdr *eh,
 	char *str = NULL;
 	char *abbrv = NULL;
 	char *info = NULL;
+	size_t size;
 
 	if (!flags)
 		return NULL;
@@ -77,9 +78,9 @@ elf_dwarfnebula(const char *name, FILE *fp, off_t foff, const Elf_Ehdr *eh,
 		goto kaput;
 	}
 
-	if (!(info = elf_sld(name, fp, foff, sh)))
+	if (!(info = elf_sldx(name, fp, foff, sh, &size)))
 		goto kaput;
-	dn->ninfo = (ssize_t)sh->sh_size;
+	dn->ninfo = (ssize_t)size;
 
 	if (!(sh = elf_scan_shdrs(eh, shdr, shstr,
 	    elf_lines_cmp, DWARF_ABBREV))) {
@@ -87,9 +88,9 @@ elf_dwarfnebula(const char *name, FILE *fp, off_t foff, const Elf_Ehdr *eh,
 		goto kaput;
 	}
 
-	if (!(abbrv = elf_sld(name, fp, foff, sh)))
+	if (!(abbrv = elf_sldx(name, fp, foff, sh, &size)))
 		goto kaput;
-	dn->nabbrv = (ssize_t)sh->sh_size;
+	dn->nabbrv = (ssize_t)size;
 
 	if (!(sh = elf_scan_shdrs(eh, shdr, shstr,
 	    elf_lines_cmp, DWARF_STR))) {
@@ -97,9 +98,9 @@ elf_dwarfnebula(const char *name, FILE *fp, off_t foff, const Elf_Ehdr *eh,
 		goto kaput;
 	}
 
-	if (!(str = elf_sld(name, fp, foff, sh)))
+	if (!(str = elf_sldx(name, fp, foff, sh, &size)))
 		goto kaput;
-	dn->nstr = (ssize_t)sh->sh_size;
+	dn->nstr = (ssize_t)size;
 
 	if (flags & ELF_DWARF_LINES) {
 		if (!(sh = elf_scan_shdrs(eh, shdr, shstr,
@@ -108,10 +109,10 @@ elf_dwarfnebula(const char *name, FILE *fp, off_t foff, const Elf_Ehdr *eh,
 			goto kaput;
 		}
 
-		if (!(lines = elf_sld(name, fp, foff, sh)))
+		if (!(lines = elf_sldx(name, fp, foff, sh, &size)))
 			goto kaput;
 
-		dn->nlines = (ssize_t)sh->sh_size;
+		dn->nlines = (ssize_t)size;
 	}
 
 	if (flags & ELF_DWARF_NAMES) {
@@ -121,10 +122,10 @@ elf_dwarfnebula(const char *name, FILE *fp, off_t foff, const Elf_Ehdr *eh,
 			goto kaput;
 		}
 
-		if (!(names = elf_sld(name, fp, foff, sh)))
+		if (!(names = elf_sldx(name, fp, foff, sh, &size)))
 			goto kaput;
 
-		dn->nnames = (ssize_t)sh->sh_size;
+		dn->nnames = (ssize_t)size;
 	}
 
 	free(shstr);
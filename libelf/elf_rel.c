@@ -60,3 +60,45 @@ elf_fix_rela(Elf_Ehdr *eh, Elf_RelA *rela)
 
 	return (1);
 }
+
+/*
+ * byteswap an array of n relocations that are entsize apart
+ */
+int
+elf_fix_rels(Elf_Ehdr *eh, void *v, size_t n, size_t entsize)
+{
+	Elf_Rel *rel;
+	char *p;
+
+	/* nothing to do */
+	if (eh->e_ident[EI_DATA] == ELF_TARG_DATA)
+		return (0);
+
+	for (p = v; n--; p += entsize) {
+		rel = (Elf_Rel *)p;
+		rel->r_offset = swap_addr(rel->r_offset);
+		rel->r_info = swap_xword(rel->r_info);
+	}
+
+	return (1);
+}
+
+int
+elf_fix_relas(Elf_Ehdr *eh, void *v, size_t n, size_t entsize)
+{
+	Elf_RelA *rela;
+	char *p;
+
+	/* nothing to do */
+	if (eh->e_ident[EI_DATA] == ELF_TARG_DATA)
+		return (0);
+
+	for (p = v; n--; p += entsize) {
+		rela = (Elf_RelA *)p;
+		rela->r_offset = swap_addr(rela->r_offset);
+		rela->r_info = swap_xword(rela->r_info);
+		rela->r_addend = swap_sxword(rela->r_addend);
+	}
+
+	return (1);
+}
@@ -29,6 +29,7 @@ static const char rcsid[] =
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <zlib.h>
 #include <a.out.h>
 #include <elf_abi.h>
 #include "elfuncs.h"
@@ -141,9 +142,20 @@ elf_shstrload(const char *fn, FILE *fp, off_t foff, const Elf_Ehdr *eh,
 
 char *
 elf_sld(const char *fn, FILE *fp, off_t foff, const Elf_Shdr *shdr)
+{
+	return elf_sldx(fn, fp, foff, shdr, NULL);
+}
+
+/*
+ * load the section contents inflating the compressed ones
+ * and return the size of what is loaded in *sizep if asked
+ */
+char *
+elf_sldx(const char *fn, FILE *fp, off_t foff, const Elf_Shdr *shdr,
+    size_t *sizep)
 {
 	size_t shsize;
-	char *sld;
+	char *sld, *p;
 
 	if (shdr->sh_size == 0 || shdr->sh_size > SSIZE_MAX) {
 		warnx("%s: no section name list", fn);
@@ -168,5 +180,79 @@ elf_sld(const char *fn, FILE *fp, off_t foff, const Elf_Shdr *shdr)
 		return (NULL);
 	}
 
+	if (shdr->sh_flags & SHF_COMPRESSED) {
+		p = elf_inflate(fn, sld, shsize, &shsize);
+		free(sld);
+		if ((sld = p) == NULL)
+			return (NULL);
+	}
+
+	if (sizep)
+		*sizep = shsize;
 	return sld;
 }
+
+/*
+ * inflate the SHF_COMPRESSED section contents;
+ * the header is in the byte order of the object which
+ * is not at hand here but the ch_type tells it anyway.
+ */
+char *
+elf_inflate(const char *fn, const char *buf, size_t size, size_t *sizep)
+{
+	Elf_Chdr ch;
+	z_stream zs;
+	char *p;
+	int rv;
+
+	if (size < sizeof ch) {
+		warnx("%s: short compressed section", fn);
+		return (NULL);
+	}
+
+	memcpy(&ch, buf, sizeof ch);
+	if (ch.ch_type != ELFCOMPRESS_ZLIB &&
+	    swap32(ch.ch_type) == ELFCOMPRESS_ZLIB) {
+		ch.ch_type = swap32(ch.ch_type);
+		ch.ch_size = swap_xword(ch.ch_size);
+	}
+
+	if (ch.ch_type != ELFCOMPRESS_ZLIB) {
+		warnx("%s: unsupported compression type %u", fn,
+		    (u_int)ch.ch_type);
+		return (NULL);
+	}
+
+	if (ch.ch_size == 0 || ch.ch_size > SSIZE_MAX ||
+	    ch.ch_size > UINT_MAX || size - sizeof ch > UINT_MAX) {
+		warnx("%s: invalid compressed section size", fn);
+		return (NULL);
+	}
+
+	if ((p = malloc(ch.ch_size)) == NULL) {
+		warn("malloc(%zd)", (size_t)ch.ch_size);
+		return (NULL);
+	}
+
+	memset(&zs, 0, sizeof zs);
+	zs.next_in = (Bytef *)buf + sizeof ch;
+	zs.avail_in = size - sizeof ch;
+	zs.next_out = (Bytef *)p;
+	zs.avail_out = ch.ch_size;
+	if (inflateInit(&zs) != Z_OK) {
+		warnx("%s: inflateInit: %s", fn, zs.msg? zs.msg : "failed");
+		free(p);
+		return (NULL);
+	}
+
+	rv = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+	if (rv != Z_STREAM_END || zs.total_out != ch.ch_size) {
+		warnx("%s: corrupt compressed section", fn);
+		free(p);
+		return (NULL);
+	}
+
+	*sizep = ch.ch_size;
+	return p;
+}
@@ -53,6 +53,8 @@
 #define	elf_shn2type	elf32_shn2type
 #define	elf_load_shdrs	elf32_load_shdrs
 #define	elf_sld		elf32_sld
+#define	elf_sldx	elf32_sldx
+#define	elf_inflate	elf32_inflate
 #define	elf_shstrload	elf32_shstrload
 #define	elf_strload	elf32_strload
 #define	elf_symloadx	elf32_symloadx
@@ -63,6 +65,8 @@
 #define	elf_fix_note	elf32_fix_note
 #define	elf_fix_rel	elf32_fix_rel
 #define	elf_fix_rela	elf32_fix_rela
+#define	elf_fix_rels	elf32_fix_rels
+#define	elf_fix_relas	elf32_fix_relas
 #elif ELFSIZE == 64
 #define	swap_addr	swap64
 #define	swap_off	swap64
@@ -100,6 +104,8 @@
 #define	elf_shn2type	elf64_shn2type
 #define	elf_load_shdrs	elf64_load_shdrs
 #define	elf_sld		elf64_sld
+#define	elf_sldx	elf64_sldx
+#define	elf_inflate	elf64_inflate
 #define	elf_shstrload	elf64_shstrload
 #define	elf_strload	elf64_strload
 #define	elf_symloadx	elf64_symloadx
@@ -110,6 +116,8 @@
 #define	elf_fix_note	elf64_fix_note
 #define	elf_fix_rel	elf64_fix_rel
 #define	elf_fix_rela	elf64_fix_rela
+#define	elf_fix_rels	elf64_fix_rels
+#define	elf_fix_relas	elf64_fix_relas
 #else
 #error "Unsupported ELF class"
 #endif
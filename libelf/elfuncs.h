@@ -105,12 +105,17 @@ int	elf32_fix_shdrs(const Elf32_Ehdr *eh, Elf32_Shdr *shdr);
 int	elf32_fix_phdrs(const Elf32_Ehdr *eh, Elf32_Phdr *phdr);
 int	elf32_fix_rel(Elf32_Ehdr *, Elf32_Rel *);
 int	elf32_fix_rela(Elf32_Ehdr *, Elf32_Rela *);
+int	elf32_fix_rels(Elf32_Ehdr *, void *, size_t, size_t);
+int	elf32_fix_relas(Elf32_Ehdr *, void *, size_t, size_t);
 int	elf32_fix_sym(const Elf32_Ehdr *eh, Elf32_Sym *sym);
 int	elf32_2nlist(Elf32_Sym *, const Elf32_Ehdr *, const Elf32_Shdr *,
 	    const char *, struct nlist *);
 int	elf32_size(const Elf32_Ehdr *, Elf32_Shdr *,
 	    u_long *, u_long *, u_long *);
 char	*elf32_sld(const char *, FILE *, off_t, const Elf32_Shdr *shdr);
+char	*elf32_sldx(const char *, FILE *, off_t, const Elf32_Shdr *shdr,
+	    size_t *);
+char	*elf32_inflate(const char *, const char *, size_t, size_t *);
 char	*elf32_shstrload(const char *, FILE *, off_t, const Elf32_Ehdr *,
 	    const Elf32_Shdr *shdr);
 int	elf32_symload(struct elf_symtab *, FILE *, off_t,
@@ -134,11 +139,16 @@ int	elf64_fix_phdrs(const Elf64_Ehdr *eh, Elf64_Phdr *phdr);
 int	elf64_fix_sym(const Elf64_Ehdr *eh, Elf64_Sym *sym);
 int	elf64_fix_rel(Elf64_Ehdr *, Elf64_Rel *);
 int	elf64_fix_rela(Elf64_Ehdr *, Elf64_Rela *);
+int	elf64_fix_rels(Elf64_Ehdr *, void *, size_t, size_t);
+int	elf64_fix_relas(Elf64_Ehdr *, void *, size_t, size_t);
 int	elf64_2nlist(Elf64_Sym *, const Elf64_Ehdr *, const Elf64_Shdr *,
 	    const char *, struct nlist *);
 int	elf64_size(const Elf64_Ehdr *, Elf64_Shdr *,
 	    u_long *, u_long *, u_long *);
 char	*elf64_sld(const char *, FILE *, off_t, const Elf64_Shdr *shdr);
+char	*elf64_sldx(const char *, FILE *, off_t, const Elf64_Shdr *shdr,
+	    size_t *);
+char	*elf64_inflate(const char *, const char *, size_t, size_t *);
 char	*elf64_shstrload(const char *, FILE *, off_t, const Elf64_Ehdr *,
 	    const Elf64_Shdr *shdr);
 int	elf64_symload(struct elf_symtab *, FILE *, off_t,
@@ -0,0 +1,10 @@
+inline int twice(int x) { return 2 * x; }
+
+int (*p1)(int) = twice;
+extern int (*p2)(int);
+
+extern "C" int
+start(void)
+{
+	return p1(2) + p2(1);
+}
@@ -0,0 +1,3 @@
+inline int twice(int x) { return 2 * x; }
+
+int (*p2)(int) = twice;
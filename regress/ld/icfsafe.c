@@ -0,0 +1,22 @@
+/* two identical functions whose addresses are compared in the code */
+
+int
+f1(int x)
+{
+	return x * 3 + 1;
+}
+
+int
+f2(int x)
+{
+	return x * 3 + 1;
+}
+
+int
+start(void)
+{
+	int (*volatile p1)(int) = f1;
+	int (*volatile p2)(int) = f2;
+
+	return p1 == p2;
+}
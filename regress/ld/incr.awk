@@ -0,0 +1,30 @@
+# gp and gvp in .data must hold the addresses of g and gv
+
+function hex(s,	i, v) {
+	v = 0;
+	for (i = 1; i <= length(s); i++)
+		v = v * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1;
+	return v;
+}
+
+# the little endian quad at the address as nm(1) prints it
+function quad(a,	o, i, q) {
+	o = (hex(a) - base) * 2;
+	q = "";
+	for (i = 0; i < 8; i++)
+		q = substr(data, o + i * 2 + 1, 2) q;
+	return q;
+}
+
+$2 ~ /^[DT]$/ { sym[$3] = $1 }
+
+/^  0x/ {
+	if (data == "")
+		base = hex(substr($1, 3));
+	for (i = 2; i <= 5 && length($i) == 8 && $i ~ /^[0-9a-f]+$/; i++)
+		data = data $i;
+}
+
+END {
+	exit quad(sym["gp"]) != sym["g"] || quad(sym["gvp"]) != sym["gv"];
+}
@@ -0,0 +1,13 @@
+/* the references to the globals of the other object */
+
+extern int g(int);
+extern int gv[];
+
+int (*gp)(int) = g;
+int *gvp = gv;
+
+int
+start(void)
+{
+	return gp(*gvp);
+}
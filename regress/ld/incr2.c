@@ -0,0 +1,16 @@
+/* the globals which move once the object has grown */
+
+#ifdef GROW
+int gv[3] = { 2 };
+#else
+int gv[1] = { 2 };
+#endif
+
+int
+g(int x)
+{
+#ifdef GROW
+	x = x * x + gv[x & 1];
+#endif
+	return x + gv[0];
+}
@@ -0,0 +1,9 @@
+/* the same string merged from two objects with the addends in place */
+
+const char *qa = "hello";
+
+int
+start(void)
+{
+	return 0;
+}
@@ -0,0 +1,7 @@
+const char *qb = "hello";
+
+const char *
+abc(void)
+{
+	return "abc";
+}
@@ -0,0 +1,25 @@
+/* enough of .debug_info for a relocation to straddle the read buffer */
+
+struct s0 { int a0; long b0; char c0[1]; };
+int f0(struct s0 *p) { return p->a0 + (int)p->b0; }
+struct s1 { int a1; long b1; char c1[2]; };
+int f1(struct s1 *p) { return p->a1 + (int)p->b1; }
+struct s2 { int a2; long b2; char c2[3]; };
+int f2(struct s2 *p) { return p->a2 + (int)p->b2; }
+struct s3 { int a3; long b3; char c3[4]; };
+int f3(struct s3 *p) { return p->a3 + (int)p->b3; }
+struct s4 { int a4; long b4; char c4[5]; };
+int f4(struct s4 *p) { return p->a4 + (int)p->b4; }
+struct s5 { int a5; long b5; char c5[6]; };
+int f5(struct s5 *p) { return p->a5 + (int)p->b5; }
+struct s6 { int a6; long b6; char c6[7]; };
+int f6(struct s6 *p) { return p->a6 + (int)p->b6; }
+struct s7 { int a7; long b7; char c7[8]; };
+int f7(struct s7 *p) { return p->a7 + (int)p->b7; }
+struct s8 { int a8; long b8; char c8[9]; };
+int f8(struct s8 *p) { return p->a8 + (int)p->b8; }
+struct s9 { int a9; long b9; char c9[10]; };
+int f9(struct s9 *p) { return p->a9 + (int)p->b9; }
+struct s10 { int a10; long b10; char c10[11]; };
+int f10(struct s10 *p) { return p->a10 + (int)p->b10; }
+int start(void) { return 7; }